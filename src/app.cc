@@ -8,29 +8,148 @@
 #endif
 
 #include <algorithm>
+#include <bit>
 #include <cassert>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <numbers>
+#include <strings.h>
 #include <thread>
 
 namespace app
 {
 
-f32 PipeWirePlayer::m_chunk[chunkSize] {};
-std::mutex PipeWireData::mtx;
-const pw_stream_events PipeWireData::streamEvents {
-    .version = PW_VERSION_STREAM_EVENTS,
-    .destroy {},
-    .state_changed = play::stateChangedCB,
-    .control_info {},
-    .io_changed = play::ioChangedCB,
-    .param_changed = play::paramChangedCB,
-    .add_buffer {},
-    .remove_buffer {},
-    .process = play::onProcessCB,
-    .drained {},
-    .command {},
-    .trigger_done {},
-};
+static const char*
+formatName(enum spa_audio_format eformat)
+{
+    switch (eformat)
+    {
+        case SPA_AUDIO_FORMAT_S16: return "s16";
+        case SPA_AUDIO_FORMAT_S24_32: return "s24";
+        case SPA_AUDIO_FORMAT_S32: return "s32";
+        default: return "f32";
+    }
+}
+
+/* `i`th sample of `pData` as float in [-1, 1] */
+static f32
+sampleToF32(const u8* pData, enum spa_audio_format eformat, long i)
+{
+    switch (eformat)
+    {
+        case SPA_AUDIO_FORMAT_S16: return ((const s16*)pData)[i] / 32768.0f;
+        case SPA_AUDIO_FORMAT_S24_32: return ((const s32*)pData)[i] / 8388608.0f;
+        case SPA_AUDIO_FORMAT_S32: return ((const s32*)pData)[i] / 2147483648.0f;
+        default: return ((const f32*)pData)[i];
+    }
+}
+
+/* source rate the resampler can do at `deviceRate`, or the time-stretch around `origRate` */
+static u32
+clampRate(long rate, u32 origRate, u32 deviceRate, bool bPreservePitch)
+{
+    long lo = std::max(defaults::minSampleRate, (long)std::ceil(deviceRate * resample::minRatio));
+    long hi = std::min(defaults::maxSampleRate, (long)(deviceRate * resample::maxRatio));
+    if (bPreservePitch)
+    {
+        lo = std::max(lo, (long)std::ceil(origRate * stretch::minTempo));
+        hi = std::min(hi, (long)(origRate * stretch::maxTempo));
+    }
+
+    return std::clamp(rate, lo, hi);
+}
+
+static enum resample::quality
+resampleQuality()
+{
+    return (enum resample::quality)std::clamp(defaults::resampleQuality, 0, (int)resample::quality::size - 1);
+}
+
+/* one partition per sink quantum, so every callback does the same fft work */
+static long
+convolutionBlock(long quantum)
+{
+    if (quantum <= 0) return defaults::convolutionBlock;
+    return std::clamp((long)std::bit_ceil((u64)quantum), 64L, sink::maxQuantum);
+}
+
+/* format the file stores samples in, if pipewire takes it as is */
+static enum spa_audio_format
+nativeFormat(SndfileHandle& h)
+{
+    switch (h.format() & SF_FORMAT_SUBMASK)
+    {
+        /* libsndfile left-justifies 8 bit into 16 without losing anything */
+        case SF_FORMAT_PCM_S8:
+        case SF_FORMAT_PCM_U8:
+        case SF_FORMAT_PCM_16: return SPA_AUDIO_FORMAT_S16;
+        case SF_FORMAT_PCM_24: return SPA_AUDIO_FORMAT_S24_32;
+        case SF_FORMAT_PCM_32: return SPA_AUDIO_FORMAT_S32;
+        case SF_FORMAT_FLOAT: return SPA_AUDIO_FORMAT_F32;
+        default: return SPA_AUDIO_FORMAT_UNKNOWN;
+    }
+}
+
+/* what the stream should carry for this file, `*ppWhy` says why it's not bit-perfect */
+static enum spa_audio_format
+pickFormat(SndfileHandle& h, const channels::Layout& in, const channels::Layout& out, const char** ppWhy)
+{
+    *ppWhy = nullptr;
+
+    if (!defaults::bBitPerfect)
+        return SPA_AUDIO_FORMAT_F32;
+
+    enum spa_audio_format eformat = nativeFormat(h);
+    if (eformat == SPA_AUDIO_FORMAT_UNKNOWN)
+    {
+        *ppWhy = "source format";
+        return SPA_AUDIO_FORMAT_F32;
+    }
+
+    /* mixing matrix works on floats */
+    if (!(in == out))
+    {
+        *ppWhy = "channel mix";
+        return SPA_AUDIO_FORMAT_F32;
+    }
+
+    return eformat;
+}
+
+/* opened, and with no more channels than a layout holds, `readf()` would still write every one of them */
+static bool
+playable(const SndfileHandle& h)
+{
+    return h.error() == 0 && h.channels() > 0 && h.channels() <= (int)SPA_AUDIO_MAX_CHANNELS;
+}
+
+/* read `nFrames` as `eformat` samples, S24_32 is right-justified */
+static sf_count_t
+readFrames(SndfileHandle& h, enum spa_audio_format eformat, u8* pDst, sf_count_t nFrames)
+{
+    switch (eformat)
+    {
+        case SPA_AUDIO_FORMAT_S16:
+            return h.readf((short*)pDst, nFrames);
+
+        case SPA_AUDIO_FORMAT_S32:
+            return h.readf((int*)pDst, nFrames);
+
+        case SPA_AUDIO_FORMAT_S24_32:
+        {
+            sf_count_t nRead = h.readf((int*)pDst, nFrames);
+            s32* p = (s32*)pDst;
+            for (long i = 0; i < nRead * h.channels(); i++)
+                p[i] >>= 8;
+
+            return nRead;
+        }
+
+        default:
+            return h.readf((float*)pDst, nFrames);
+    }
+}
 
 static void
 drawBorders(WINDOW* pWin, enum color::curses color = defaults::borderColor)
@@ -48,8 +167,11 @@ drawBorders(WINDOW* pWin, enum color::curses color = defaults::borderColor)
 }
 
 
-CursesUI::CursesUI()
+void
+CursesUI::init()
 {
+    m_bInit = true;
+
     /* reopen stdin to fix getch if pipe was used */
     if (!freopen("/dev/tty", "r", stdin))
         LOG_BAD("freopen(\"/dev/tty\", \"r\", stdin)\n");
@@ -107,7 +229,7 @@ CursesUI::CursesUI()
 
 CursesUI::~CursesUI()
 {
-    endwin();
+    if (m_bInit) endwin();
 
     if (m_p->m_songs.empty())
         COUT("kmp: no input provided\n");
@@ -116,6 +238,8 @@ CursesUI::~CursesUI()
 void
 CursesUI::drawUI()
 {
+    if (!m_bInit) return;
+
     /* disallow drawing to ncurses screen from multiple threads */
     std::lock_guard lock(m_mtx);
 
@@ -193,8 +317,9 @@ CursesUI::toggleVisualizer()
 void
 CursesUI::drawTime()
 {
-    u64 t = (m_p->m_pcmPos/m_p->m_pw.channels) / m_p->m_pw.sampleRate;
-    u64 maxT = (m_p->m_pcmSize/m_p->m_pw.channels) / m_p->m_pw.sampleRate;
+    PlayerState s = m_p->state();
+    u64 t = m_p->getCurrTimeInSec();
+    u64 maxT = s.nFrames / s.origSampleRate;
 
     f64 mF = t / 60.0;
     u64 m = u64(mF);
@@ -205,11 +330,11 @@ CursesUI::drawTime()
     u64 fracMax = 60 * (mFMax - mMax);
 
     auto timeStr = FMT("{}:{:02.0f} / {}:{:02d}", m, frac, mMax, fracMax);
-    if (m_p->m_bPaused) { timeStr = "(paused) " + timeStr; }
+    if (s.bPaused) { timeStr = "(paused) " + timeStr; }
     timeStr = "time: " + timeStr;
 
-    if (m_p->m_pw.sampleRate != m_p->m_pw.origSampleRate)
-        timeStr += FMT(" ({:.0f}% speed)", m_p->m_speedMul * 100);
+    if (s.sampleRate != s.origSampleRate)
+        timeStr += FMT(" ({:.0f}% speed{})", s.speedMul * 100, s.bPreservePitch ? ", same pitch" : "");
 
     auto col = COLOR_PAIR(color::white);
     wattron(m_status.pCon, col);
@@ -220,14 +345,17 @@ CursesUI::drawTime()
 enum color::curses 
 CursesUI::drawVolume()
 {
-    auto volumeStr = FMT("volume: {:3.0f}%\n", 100.0 * m_p->m_volume);
+    PlayerState s = m_p->state();
+    auto volumeStr = FMT("volume: {:3.0f}%\n", 100.0 * s.volume);
+    if (f32 reduction = m_p->m_limiter.takeReduction(); reduction < -0.05f)
+        volumeStr = FMT("volume: {:3.0f}% (limit {:.1f}dB)\n", 100.0 * s.volume, reduction);
     int maxx = getmaxx(m_status.pCon);
 
     long maxWidth = maxx - volumeStr.size() - 1;
-    f64 maxLine = (m_p->m_volume * (f64)maxWidth) * (1.0 - (defaults::maxVolume - 1.0));
+    f64 maxLine = (s.volume * (f64)maxWidth) * (1.0 - (defaults::maxVolume - 1.0));
 
     auto getColor = [&](f64 i) -> int {
-        f64 val = m_p->m_volume * (i / (maxLine));
+        f64 val = s.volume * (i / (maxLine));
 
         if (val > 1.01) return color::curses::red;
         else if (val > 0.51) return color::curses::yellow;
@@ -235,7 +363,7 @@ CursesUI::drawVolume()
     };
 
     auto mutedColor = COLOR_PAIR(defaults::mutedColor);
-    int sCol = m_p->m_bMuted ? mutedColor : (A_BOLD | COLOR_PAIR(getColor(maxLine)));
+    int sCol = s.bMuted ? mutedColor : (A_BOLD | COLOR_PAIR(getColor(maxLine)));
     wattron(m_status.pCon, sCol);
     mvwaddnstr(m_status.pCon, 1, 0, volumeStr.data(), maxx);
     wattroff(m_status.pCon, sCol);
@@ -244,7 +372,7 @@ CursesUI::drawVolume()
     {
         int color;
         const wchar_t* icon;
-        if (m_p->m_bMuted)
+        if (s.bMuted)
         {
             color = mutedColor;
             icon = blockIcon2;
@@ -264,12 +392,71 @@ CursesUI::drawVolume()
 }
 
 void
-CursesUI::drawPlayListCounter()
+CursesUI::drawBufferFill()
 {
-    auto songCounterStr = FMT("total: {} / {}", m_p->m_currSongIdx + 1, m_p->m_songs.size());
+    long fill = m_p->m_ring.size();
+    long minFill = std::min(fill, m_p->m_minFill.load(std::memory_order_relaxed));
+
+    auto bufferStr = FMT("buffer: {:.0f}ms (min {:.0f}ms)", m_p->bytesToMs(fill), m_p->bytesToMs(minFill));
+    if (long n = m_p->m_nUnderruns.load(std::memory_order_relaxed); n > 0)
+        bufferStr += FMT(" underruns: {}", n);
+
+    PlayerState s = m_p->state();
+    if (s.convolverTaps > 0)
+    {
+        bufferStr += FMT(" conv: {} taps/{} ({:.1f}% cpu/ch)",
+            s.convolverTaps, s.convolverBlock, m_p->m_chain.convolverLoad() * 100.0f);
+    }
+
+    if (cache::Stats c = m_p->m_pcmCache.stats(); c.capBytes > 0 && c.nHits + c.nMisses > 0)
+    {
+        bufferStr += FMT(" cache: {:.0f}% hit {:.0f}/{:.0f} MiB",
+            100.0 * c.nHits / (c.nHits + c.nMisses), c.nBytes / 1048576.0, c.capBytes / 1048576.0);
+    }
+
+    /* per minute of playback, not wall time, so pausing doesn't make reads look cheaper */
+    if (f64 min = m_p->m_playedSec.load(std::memory_order_relaxed) / 60.0; min > 1.0 / 60.0)
+    {
+        vio::Stats io = vio::stats();
+        bufferStr += FMT(" io {}: {:.0f} calls/min {:.1f} MiB/min",
+            vio::backendStrings[(int)m_p->m_eIo], io.nSyscalls / min, io.nBytes / 1048576.0 / min);
+    }
+
+    if (defaults::bBitPerfect)
+    {
+        const char* why = m_p->m_notBitPerfect.load(std::memory_order_relaxed);
+        if (!why && s.bMuted) why = "muted";
+        else if (!why && s.volume != 1.0) why = "volume";
+        else if (!why && s.replayGain != 1.0f) why = "replaygain";
+        else if (!why && !defaults::eqPresets[s.eqPreset].bands.empty()) why = "eq";
+        else if (!why && s.convolverTaps > 0) why = "convolution";
+        else if (!why && s.sampleRate != s.origSampleRate) why = "speed";
+        else if (!why && m_p->m_pw.deviceRate != s.origSampleRate) why = "resampled";
+
+        if (why) bufferStr += FMT(" (not bit-perfect: {})", why);
+        else bufferStr += FMT(" (bit-perfect {})", formatName(m_p->m_pw.eformat));
+    }
+
+    auto col = COLOR_PAIR(color::white);
+    wattron(m_status.pCon, col);
+    mvwaddnstr(m_status.pCon, 2, 0, bufferStr.data(), getmaxx(m_status.pCon));
+    wattroff(m_status.pCon, col);
+}
 
-    if (m_p->m_eRepeat != repeatMethod::none)
-        songCounterStr += FMT(" (repeat {})", repeatMethodStrings[(int)m_p->m_eRepeat]);
+void
+CursesUI::drawPlayListCounter()
+{
+    PlayerState s = m_p->state();
+    auto songCounterStr = FMT("total: {} / {}", s.currSongIdx + 1, m_p->m_songs.size());
+
+    if (s.eRepeat != repeatMethod::none)
+        songCounterStr += FMT(" (repeat {})", repeatMethodStrings[(int)s.eRepeat]);
+    if (m_p->m_bGapless)
+        songCounterStr += " (gapless)";
+    if (m_p->m_crossfadeSec > 0.0)
+        songCounterStr += FMT(" (crossfade {:g}s)", m_p->m_crossfadeSec);
+    if (!defaults::eqPresets[s.eqPreset].bands.empty())
+        songCounterStr += FMT(" (eq {})", defaults::eqPresets[s.eqPreset].name);
 
     auto col = COLOR_PAIR(color::white);
     wattron(m_status.pCon, col);
@@ -280,7 +467,7 @@ CursesUI::drawPlayListCounter()
 void
 CursesUI::drawTitle()
 {
-    auto ls = "playing: " + m_p->m_info.title;
+    auto ls = "playing: " + m_p->info()->title;
     ls.resize(getmaxx(m_pl.pBor) - 1);
 
     move(5, 0);
@@ -297,6 +484,7 @@ CursesUI::drawPlayList()
     long startFromY = 0; /* offset from border */
 
     adjustListToPosition();
+    long currSongIdx = m_p->state().currSongIdx;
 
     werase(m_pl.pBor);
     for (long i = m_firstInList; i < (long)m_p->m_songs.size() && startFromY < maxy; i++, startFromY++)
@@ -307,7 +495,7 @@ CursesUI::drawPlayList()
 
         if (i == m_selected)
             wattron(m_pl.pCon, col | A_REVERSE);
-        if (i == m_p->m_currSongIdx)
+        if (i == currSongIdx)
             wattron(m_pl.pCon, A_BOLD | COLOR_PAIR(color::curses::yellow));
 
         mvwaddnstr(m_pl.pCon, startFromY, getbegx(m_pl.pCon), lineStr.data(), getmaxx(m_pl.pCon) - 1);
@@ -346,6 +534,7 @@ void
 CursesUI::drawInfo()
 {
     int maxx = getmaxx(m_info.pCon);
+    auto pInfo = m_p->info();
     constexpr std::string_view sTitle = "title: ";
     constexpr std::string_view sAlbum = "album: ";
     constexpr std::string_view sArtist = "artist: ";
@@ -357,19 +546,19 @@ CursesUI::drawInfo()
     wattron(m_info.pCon, col);
     mvwaddnstr(m_info.pCon, 0, 0, sTitle.data(), maxx*2);
     wattron(m_info.pCon, A_BOLD | A_ITALIC | COLOR_PAIR(color::curses::yellow));
-    mvwaddnstr(m_info.pCon, 0, sTitle.size(), m_p->m_info.title.data(), (maxx*2) - sTitle.size());
+    mvwaddnstr(m_info.pCon, 0, sTitle.size(), pInfo->title.data(), (maxx*2) - sTitle.size());
     wattroff(m_info.pCon, A_BOLD | A_ITALIC | COLOR_PAIR(color::curses::yellow));
 
     wattron(m_info.pCon, col);
     mvwaddnstr(m_info.pCon, 2, 0, sAlbum.data(), maxx);
     wattron(m_info.pCon, A_BOLD | col);
-    mvwaddnstr(m_info.pCon, 2, sAlbum.size(), m_p->m_info.album.data(), maxx - sAlbum.size());
+    mvwaddnstr(m_info.pCon, 2, sAlbum.size(), pInfo->album.data(), maxx - sAlbum.size());
     wattroff(m_info.pCon, A_BOLD | col);
 
     wattron(m_info.pCon, col);
     mvwaddnstr(m_info.pCon, 3, 0, sArtist.data(), maxx);
     wattron(m_info.pCon, A_BOLD | col);
-    mvwaddnstr(m_info.pCon, 3, sArtist.size(), m_p->m_info.artist.data(), maxx - sArtist.size());
+    mvwaddnstr(m_info.pCon, 3, sArtist.size(), pInfo->artist.data(), maxx - sArtist.size());
     wattroff(m_info.pCon, A_BOLD | col);
 
     drawBorders(m_info.pBor);
@@ -382,6 +571,7 @@ CursesUI::drawStatus()
 
     drawTime();
     auto color = drawVolume();
+    drawBufferFill();
     drawPlayListCounter();
 
     drawBorders(m_status.pBor, (color::curses)PAIR_NUMBER(color));
@@ -397,13 +587,14 @@ CursesUI::drawVisualizer()
     int lastNFrames = m_p->m_pw.lastNFrames; /* lastChunkSize == lastNFrames * nChannels */
 
     std::vector<u32> bars(maxx);
-    f32* pChunk = m_p->m_chunk;
+    const u8* pChunk = m_p->m_chunk.data();
+    enum spa_audio_format eformat = m_p->m_pw.eformat;
     f32 accSize = (f32)lastNFrames / (f32)bars.size();
     long chunkPos = 0;
 
     std::valarray<std::complex<f32>> aFreqDomain(lastNFrames);
     for (size_t i = 0, j = 0; i < aFreqDomain.size(); i++, j += nChannels)
-        aFreqDomain[i] = std::complex(pChunk[j], 0.0f);
+        aFreqDomain[i] = std::complex(sampleToF32(pChunk, eformat, j), 0.0f);
 
     utils::fft(aFreqDomain);
     if (aFreqDomain.size() > 0)
@@ -481,16 +672,91 @@ CursesUI::adjustListToPosition()
 PipeWirePlayer::PipeWirePlayer(int argc, char** argv)
 {
     m_term.m_p = this;
-    m_term.resizeWindows();
-
-    pw_init(&argc, &argv);
-
-    m_term.m_firstInList = 0;
+    std::string responsePath = defaults::convolutionResponse;
 
     for (int i = 1; i < argc; i++)
     {
         std::string s = argv[i];
 
+        /* --render out.wav, no ui, no pipewire, as fast as decoding goes, takes over from any `--sink=` */
+        if (s == "--render" && i + 1 < argc)
+        {
+            if (m_pSink && !m_bHeadless) LOG_WARN("--render replaces --sink\n");
+            m_pSink = std::make_unique<sink::Wav>(argv[++i], defaults::nullSinkQuantum, false);
+            m_bHeadless = true;
+            continue;
+        }
+
+        if (s.starts_with("--volume="))
+        {
+            m_volume = std::clamp(std::atof(s.data() + 9), defaults::minVolume, defaults::maxVolume);
+            continue;
+        }
+
+        if (s.starts_with("--speed="))
+        {
+            /* what `cmd::speed` gets clamped to when the device follows the file */
+            f64 speed = std::atof(s.data() + 8);
+            if (m_bPreservePitch) speed = std::clamp(speed, stretch::minTempo, stretch::maxTempo);
+            else speed = std::clamp(speed, resample::minRatio, resample::maxRatio);
+            if (speed > 0.0) m_speedMul = speed;
+            continue;
+        }
+
+        if (s.starts_with("--replaygain="))
+        {
+            for (int m = 0; m < (int)loudness::mode::size; m++)
+                if (strcasecmp(s.data() + 13, loudness::modeStrings[m].data()) == 0)
+                    m_eReplayGain = (enum loudness::mode)m;
+            continue;
+        }
+
+        if (s.starts_with("--eq="))
+        {
+            for (long e = 0; e < (long)std::size(defaults::eqPresets); e++)
+                if (strcasecmp(s.data() + 5, defaults::eqPresets[e].name.data()) == 0)
+                    m_eqPreset = e;
+            continue;
+        }
+
+        if (s.starts_with("--crossfade="))
+        {
+            m_crossfadeSec = std::clamp(std::atof(s.data() + 12), 0.0, 12.0);
+            continue;
+        }
+
+        if (s.starts_with("--io="))
+        {
+            for (int b = 0; b < (int)vio::backend::size; b++)
+                if (strcasecmp(s.data() + 5, vio::backendStrings[b].data()) == 0)
+                    m_eIo = (enum vio::backend)b;
+            continue;
+        }
+
+        if (s.starts_with("--convolve="))
+        {
+            responsePath = s.substr(11);
+            continue;
+        }
+
+        if (s.starts_with("--repeat="))
+        {
+            for (int r = 0; r < (int)repeatMethod::size; r++)
+                if (strcasecmp(s.data() + 9, repeatMethodStrings[r].data()) == 0)
+                    m_eRepeat = (enum repeatMethod)r;
+            continue;
+        }
+
+        /* --sink=pipewire|null|wav:out.wav, before the extension check since the last one ends with one */
+        if (s.starts_with("--sink="))
+        {
+            if (m_bHeadless)
+                LOG_WARN("--render already picked the sink, ignoring '{}'\n", s);
+            else if (!(m_pSink = sink::make(std::string_view(s).substr(7))))
+                LOG_WARN("unknown sink '{}', using pipewire\n", s.substr(7));
+            continue;
+        }
+
         for (auto& f : m_supportedFormats)
             if (s.ends_with(f))
             {
@@ -499,9 +765,35 @@ PipeWirePlayer::PipeWirePlayer(int argc, char** argv)
             }
     }
 
-    if (m_songs.empty())
+    if (!m_pSink) m_pSink = sink::make("pipewire");
+
+    /* convolver itself gets built for the device rate in `playCurrent()` */
+    if (!responsePath.empty())
+    {
+        if (convolve::load(responsePath, &m_response)) m_chain.setConvolve(defaults::bConvolve);
+        else LOG_WARN("can't read impulse response '{}'\n", responsePath);
+    }
+
+    if (!m_bHeadless)
+    {
+        m_term.init();
+        m_term.resizeWindows();
+    }
+
+    m_term.m_firstInList = 0;
+    if (m_eReplayGain != loudness::mode::off && !m_songs.empty())
+        m_loudness.start(m_songs, 0);
+    if (defaults::bPrefetch && !m_songs.empty())
+        m_prefetch.start(m_songs);
+    if (defaults::bSeekIndex && !m_songs.empty())
+        m_seekIndex.start();
+    updateGain();
+    m_lastGain = m_gain;
+    publishState();
+
+    if (m_songs.empty() || m_bHeadless)
     {
-        m_bFinished = true;
+        m_bFinished = m_songs.empty();
         return;
     }
 
@@ -509,135 +801,273 @@ PipeWirePlayer::PipeWirePlayer(int argc, char** argv)
     inputThread.detach();
 }
 
-PipeWirePlayer::~PipeWirePlayer()
-{
-    pw_deinit();
-}
-
-void
-PipeWirePlayer::setupPlayer(enum spa_audio_format format, u32 sampleRate, u32 channels)
-{
-    u8 setupBuffer[1024] {};
-    const spa_pod* params[1] {};
-    spa_pod_builder b = SPA_POD_BUILDER_INIT(setupBuffer, sizeof(setupBuffer));
-
-    m_pw.pLoop = pw_main_loop_new(nullptr);
-
-    m_pw.pStream = pw_stream_new_simple(pw_main_loop_get_loop(m_pw.pLoop),
-                                      "kmpStream",
-                                      pw_properties_new(PW_KEY_MEDIA_TYPE, "Audio",
-                                                        PW_KEY_MEDIA_CATEGORY, "Playback",
-                                                        PW_KEY_MEDIA_ROLE, "Music",
-                                                        nullptr),
-                                      &m_pw.streamEvents,
-                                      this);
-
-
-    spa_audio_info_raw rawInfo {
-        .format = format,
-        .flags {},
-        .rate = sampleRate,
-        .channels = channels,
-        .position {}
-    };
-
-    params[0] = spa_format_audio_raw_build(&b, SPA_PARAM_EnumFormat, &rawInfo);
-
-    pw_stream_connect(m_pw.pStream,
-                      PW_DIRECTION_OUTPUT,
-                      PW_ID_ANY,
-                      (enum pw_stream_flags)(PW_STREAM_FLAG_AUTOCONNECT |
-                                             PW_STREAM_FLAG_MAP_BUFFERS |
-                                             PW_STREAM_FLAG_ASYNC),
-                      params, std::size(params));
-}
-
 void
 PipeWirePlayer::playAll()
 {
+    f64 startTime = utils::timeNow();
+
     while (!m_bFinished)
     {
 #ifdef MPRIS_LIB
         /* doing it here effectively raises kmp for playerctl without actually implementing raise method
          * https://specifications.freedesktop.org/mpris-spec/latest/Media_Player.html#Method:Raise */
-        mpris::init(this);
+        if (!m_bHeadless) mpris::init(this);
 #endif
 
         playCurrent();
 
 #ifdef MPRIS_LIB
-        mpris::clean();
+        if (!m_bHeadless) mpris::clean();
 #endif
     }
+
+    joinPreload();
+    m_pSink->stop();
+    m_loudness.stop();
+    m_prefetch.stop();
+    m_seekIndex.stop();
+
+    auto* pNull = dynamic_cast<sink::Null*>(m_pSink.get());
+    if (m_bHeadless && pNull && !m_songs.empty())
+    {
+        f64 renderSec = utils::timeNow() - startTime;
+        f64 audioSec = pNull->playedSec();
+        COUT("rendered {:.2f}s of audio in {:.2f}s ({:.1f}x realtime)\n",
+             audioSec, renderSec, renderSec > 0.0 ? audioSec / renderSec : 0.0);
+
+        vio::Stats io = vio::stats();
+        f64 min = audioSec / 60.0;
+        COUT("io ({}): {} syscalls, {:.2f} MiB read ({:.0f} syscalls, {:.2f} MiB per minute)\n",
+             vio::backendStrings[(int)m_eIo], io.nSyscalls, io.nBytes / 1048576.0,
+             min > 0.0 ? io.nSyscalls / min : 0.0, min > 0.0 ? io.nBytes / 1048576.0 / min : 0.0);
+
+        cache::Stats c = m_pcmCache.stats();
+        if (c.nHits + c.nMisses > 0)
+            COUT("pcm cache: {} hits, {} misses, {:.2f} MiB\n", c.nHits, c.nMisses, c.nBytes / 1048576.0);
+    }
 }
 
 void
 PipeWirePlayer::playCurrent()
 {
-    m_hSnd = SndfileHandle(currSongName().data(), SFM_READ);
+    /* natural end of the previous track already spliced this one into the ring, see `spliceNext()` */
+    bool bSpliced = m_bSpliced && m_next.idx == m_currSongIdx;
+    m_seekTo = m_noSeek; /* was meant for the previous track */
+    bool bPreloaded = false;
+    m_bSpliced = false;
+
+    if (!bSpliced)
+    {
+        joinPreload();
+        if (m_next.idx == m_currSongIdx && playable(m_next.hSnd))
+        {
+            m_hSnd = m_next.hSnd;
+            bPreloaded = true;
+        }
+        else
+        {
+            m_hSnd = vio::open(currSongName(), m_eIo);
+        }
+    }
 
     /* skip song on error */
-    if (m_hSnd.error() == 0)
+    if (playable(m_hSnd))
     {
-        m_pw.eformat = SPA_AUDIO_FORMAT_F32;
-        m_pw.sampleRate = m_hSnd.samplerate();
-        m_pw.channels = m_hSnd.channels();
-        m_pw.origSampleRate = m_pw.sampleRate;
+        m_prefetch.plan(upcoming());
 
-        m_pcmPos = 0;
-        m_pcmSize = m_hSnd.frames() * m_pw.channels;
+        /* before anything goes out, headless output shouldn't depend on how far the scanner got */
+        m_replayGain = m_loudness.gain(m_currSongIdx, m_eReplayGain, m_bHeadless);
+        updateGain();
 
-        m_info = song::Info(currSongName(), m_hSnd);
+        if (bSpliced)
+        {
+            /* same format, stream and ring are left untouched, `play::render()` restarted `m_pcmPos` at the mark */
+            m_info = std::move(m_next.info);
+            m_pInfo.store(std::make_shared<const song::Info>(m_info), std::memory_order_release);
+            m_pcmSize = m_decodeLen * m_pw.channels;
+            m_minFill = m_ring.capacity();
+            m_nUnderruns = 0;
+        }
+        else
+        {
+            u32 sampleRate = m_hSnd.samplerate();
+            u32 deviceRate = defaults::outputSampleRate > 0 ? defaults::outputSampleRate : sampleRate;
+            channels::Layout inLayout = channels::fileLayout(m_hSnd);
+            channels::Layout outLayout = channels::outputLayout(inLayout);
+            /* a file can't change format halfway, later tracks get resampled and mixed into what the first one started */
+            if (m_pSink->started() && m_pSink->fixedFormat())
+            {
+                deviceRate = m_pw.deviceRate;
+                outLayout = m_pw.layout;
+            }
+            const char* notBitPerfect;
+            enum spa_audio_format eformat = pickFormat(m_hSnd, inLayout, outLayout, &notBitPerfect);
+            enum spa_audio_format sinkFormat = eformat == SPA_AUDIO_FORMAT_F32 ? defaults::outputFormat : eformat;
+            bool bNewFormat = deviceRate != m_pw.deviceRate || !(outLayout == m_pw.layout) || sinkFormat != m_pw.sinkFormat;
+
+            /* previous track can only fade out through the same stream at the same rate */
+            if (bNewFormat || sampleRate != m_pw.origSampleRate || eformat != SPA_AUDIO_FORMAT_F32)
+                stopFade();
+
+            /* restore speed multiplier, filter for it is built here and not under the sink lock */
+            u32 speedRate = clampRate(std::lround(sampleRate * m_speedMul), sampleRate, deviceRate, m_bPreservePitch);
+            f64 tempo = m_bPreservePitch ? (f64)speedRate / (f64)sampleRate : 1.0;
+            f64 ratio = (f64)(m_bPreservePitch ? sampleRate : speedRate) / (f64)deviceRate;
+            resample::Filter filter {};
+            if (m_resampler.needsFilter(ratio))
+                filter = resample::Filter(resampleQuality(), ratio);
+
+            /* same for the convolver, its response is resampled to the device rate, quantum is known once the sink ran */
+            std::unique_ptr<convolve::Convolver> pConv {};
+            const convolve::Convolver* pOldConv = m_chain.convolver();
+            const long convBlock = convolutionBlock(m_pSink->quantum());
+            if (m_response.nFrames > 0 &&
+                (!pOldConv || pOldConv->sampleRate() != deviceRate || pOldConv->nChannels() != outLayout.nChannels ||
+                 pOldConv->block() != convBlock))
+            {
+                pConv = std::make_unique<convolve::Convolver>(m_response, deviceRate, outLayout.nChannels, convBlock);
+            }
 
-        /* restore speed multiplier */
-        m_pw.sampleRate *= m_speedMul;
-        setupPlayer(m_pw.eformat, m_pw.sampleRate, m_pw.channels);
+            m_info = bPreloaded ? std::move(m_next.info) : song::Info(currSongName(), m_hSnd);
+            m_pInfo.store(std::make_shared<const song::Info>(m_info), std::memory_order_release);
+            m_notBitPerfect = notBitPerfect;
+
+            /* decoder is this thread, nobody else touches these */
+            m_mix.build(inLayout, outLayout);
+            m_decodeBuff.resize(decodeFrames * inLayout.nChannels * sizeof(f32));
+            m_mixBuff.resize(decodeFrames * outLayout.nChannels);
+
+            /* `play::render()` can't run while the sink is locked, so it's safe to act as a consumer here */
+            m_pSink->lock();
+
+            /* fade picks up right where the ring is cut, its file only gets touched after unlocking */
+            const s64 fadeFrom = m_pcmPos / m_pw.channels;
+
+            /* drop leftovers of the previous track */
+            m_ring.flush();
+            m_ring.applyFlush();
+            m_trackMark = m_noMark;
+            m_bEof = false;
+            m_tailLeft = 0;
+            m_minFill = m_ring.capacity();
+            m_nUnderruns = 0;
+
+            m_pw.origSampleRate = sampleRate;
+            m_pw.sampleRate = speedRate;
+            /* visualizer and buffer fill read these too */
+            {
+                std::lock_guard lock(m_term.m_mtx);
+                m_pw.deviceRate = deviceRate;
+                m_pw.layout = outLayout;
+                m_pw.channels = outLayout.nChannels;
+                m_pw.eformat = eformat;
+                m_pw.sampleSize = sink::sampleSize(eformat);
+                m_pw.sinkFormat = sinkFormat;
+                if (m_chunk.size() < sink::maxQuantum * m_pw.channels * sizeof(f32))
+                    m_chunk.resize(sink::maxQuantum * m_pw.channels * sizeof(f32));
+            }
 
-        m_term.updateAll();
-        m_term.drawUI();
+            /* coefficients depend on the device rate */
+            applyEq();
+            /* previous one goes away with `pConv`, after unlocking */
+            if (pConv) pConv = m_chain.setConvolver(std::move(pConv));
+
+            m_limiter.setup(m_pw.channels, deviceRate, sink::maxQuantum);
+            m_bLimiting = false;
+            m_limitDelay.assign(m_limiter.latency() * m_pw.channels * m_pw.sampleSize, 0);
+            m_limitScratch.resize(m_limiter.latency() * m_pw.channels * sizeof(f32));
+            m_dither.reset();
+
+            m_resampler.setup(m_pw.channels, sink::maxQuantum);
+            if (filter.nTaps > 0) m_resampler.setFilter(&filter);
+            m_resampler.setRatio(ratio);
+            m_resampler.reset();
+            /* pitch can get toggled mid track, stretch has to keep up with the resampler at any ratio */
+            m_stretch.setup(m_pw.channels, sampleRate, m_resampler.capacity());
+            m_stretch.setTempo(tempo);
+            m_bStretching = tempo != 1.0;
+            m_bResampling = m_bStretching || ratio != 1.0;
+            m_history.resize(std::max(m_stretch.hop(), resample::maxHistory) * m_pw.channels * sizeof(f32));
+            m_nHistory = 0;
+            m_resampleIn.resize(std::max(m_resampler.capacity(), m_stretch.capacity()) * m_pw.channels * sizeof(f32));
+            m_resampleOut.resize(sink::maxQuantum * m_pw.channels);
+            m_stretchIn.resize(m_stretch.capacity() * m_pw.channels);
+            m_stretchOut.resize(m_stretch.maxOut() * m_pw.channels);
+
+            m_pcmPos = 0;
+            m_clock.set(timing::nowNs(), 0.0, 0.0, true);
+
+            if (!m_pSink->started())
+            {
+                m_pSink->start(outputFormat(), !m_bPaused, play::render, this);
+            }
+            else
+            {
+                /* don't feed new format until the sink agrees on it */
+                if (bNewFormat)
+                    m_pSink->reconfigure(outputFormat(), !m_bPaused);
 
-        if (!m_ready)
-            refresh(); /* refresh before first getch update */
-        m_ready = true;
+                m_pSink->unlock();
+            }
 
-        /* TODO: there is probably a better way to update params than just to reset the whole thing */
-updateParams:
-        if (m_bChangeParams)
-        {
-            m_bChangeParams = false;
-            setupPlayer(m_pw.eformat, m_pw.sampleRate, m_pw.channels);
-            m_term.resizeWindows();
-            m_term.drawUI();
+            /* seeking can decode or open the file again, `m_decodeIdx` and `m_pSeekTable` are still the fading track's */
+            if (m_fade.len > 0)
+                seekHandle(&m_fade.hSnd, fadeFrom);
+
+            m_decodeIdx = m_currSongIdx;
+            m_decodePos = bPreloaded ? m_next.nPrerolled : 0;
+            useSeekTable();
+            m_pcmSize = m_decodeLen * m_pw.channels;
+
+            /* already decoded first buffers go out right away, mixing in the fade decodes too, so not under the lock */
+            if (bPreloaded)
+                pushDecoded(m_next.vPreroll.data(), m_next.nPrerolled);
         }
 
-        pw_main_loop_run(m_pw.pLoop);
+        if (bSpliced || bPreloaded)
+            m_next.idx = -1;
 
-        /* in this order */
-        pw_stream_destroy(m_pw.pStream);
-        pw_main_loop_destroy(m_pw.pLoop);
+        publishState();
 
-        if (m_bPaused)
+        if (m_bHeadless)
+        {
+            COUT("{}/{}: {}\n", m_currSongIdx + 1, m_songs.size(), currSongName());
+        }
+        else
         {
-            /* let input thread wake up cndPause */
-            m_mtxPauseSwitch.unlock();
+            m_term.updateAll();
+            m_term.drawUI();
 
-            std::unique_lock lock(m_mtxPause);
-            m_cndPause.wait(lock);
-            m_bChangeParams = true;
+            if (!m_ready)
+                refresh(); /* refresh before first getch update */
         }
+        m_ready = true;
 
-        if (m_bChangeParams)
-            goto updateParams;
+        /* audio runs on the loop thread now, so this thread does the decoding */
+        decode();
     }
     else
     {
         m_bNext = true;
     }
 
+    bool bManual = m_bNewSongSelected || m_bNext || m_bPrev;
+
+    /* manual switch fades out what is playing instead of cutting it, `playCurrent()` drops it if the next one can't mix */
+    if (bManual && !m_bSpliced && playable(m_hSnd) && defaults::skipFadeMs > 0 && m_pw.eformat == SPA_AUDIO_FORMAT_F32)
+        startFade(defaults::skipFadeMs * (long)m_pw.origSampleRate / 1000);
+
+    /* manual switch cancels a splice that didn't become audible yet */
+    if (bManual && m_bSpliced)
+    {
+        m_bSpliced = false;
+        m_next.idx = -1;
+    }
+
     if (m_bNewSongSelected)
     {
         m_bNewSongSelected = false;
-        m_currSongIdx = m_term.m_selected;
+        m_currSongIdx = m_newSongIdx;
     }
     else if (m_bNext)
     {
@@ -655,16 +1085,379 @@ updateParams:
     }
     else
     {
-        if (m_eRepeat != repeatMethod::track) m_currSongIdx++;
+        long next = nextAutoIdx();
+        if (next < 0) m_bFinished = true;
+        else m_currSongIdx = next;
     }
+}
+
+long
+PipeWirePlayer::nextAutoIdx() const
+{
+    long idx = m_currSongIdx;
+    if (m_eRepeat != repeatMethod::track) idx++;
+
+    if (idx > (long)m_songs.size() - 1)
+        idx = m_eRepeat == repeatMethod::playlist ? 0 : -1;
 
-    if (m_currSongIdx > (long)m_songs.size() - 1)
+    return idx;
+}
+
+std::vector<long>
+PipeWirePlayer::upcoming() const
+{
+    /* NOTE: player thread only, what plays after the current track if nobody touches anything */
+    std::vector<long> v;
+    if (m_eRepeat == repeatMethod::track) return v;
+
+    long n = m_songs.size();
+    for (long i = 1; i < n; i++)
     {
-        if (m_eRepeat == repeatMethod::playlist)
-            m_currSongIdx = 0;
-        else
-            m_bFinished = true;
+        long idx = m_currSongIdx + i;
+        if (idx >= n && m_eRepeat != repeatMethod::playlist) break;
+        v.push_back(idx % n);
     }
+
+    return v;
+}
+
+void
+PipeWirePlayer::startPreload(long idx)
+{
+    joinPreload();
+
+    m_next.idx = idx;
+    m_next.nPrerolled = 0;
+    m_next.thrd = std::thread([this, idx] {
+        m_next.hSnd = vio::open(m_songs[idx], m_eIo);
+        if (!playable(m_next.hSnd)) return;
+
+        m_next.info = song::Info(m_songs[idx], m_next.hSnd);
+
+        const char* notBitPerfect;
+        channels::Layout inLayout = channels::fileLayout(m_next.hSnd);
+        m_next.eformat = pickFormat(m_next.hSnd, inLayout, channels::outputLayout(inLayout), &notBitPerfect);
+
+        /* repeated or recently played track doesn't need decoding, `m_next.hSnd` stays at 0 then */
+        m_next.vPreroll.resize(decodeFrames * inLayout.nChannels * sizeof(f32));
+        u8* pPreroll = m_next.vPreroll.data();
+        long nRead = m_pcmCache.read(m_songs[idx], 0, m_next.eformat, inLayout.nChannels, pPreroll, decodeFrames);
+        if (nRead == 0)
+        {
+            long want = std::min(decodeFrames, cache::blockFrames);
+            nRead = std::max(readFrames(m_next.hSnd, m_next.eformat, pPreroll, want), (sf_count_t)0);
+            m_pcmCache.store(m_songs[idx], 0, m_next.eformat, inLayout.nChannels, pPreroll, nRead, nRead < want);
+        }
+        m_next.nPrerolled = nRead;
+    });
+}
+
+bool
+PipeWirePlayer::spliceNext(long fadeFrames)
+{
+    /* NOTE: decoder only, at the end of the file, or `fadeFrames` before it to crossfade */
+    if ((!m_bGapless && fadeFrames == 0) || m_next.idx < 0)
+        return false;
+
+    /* only ever mixing f32 */
+    if (fadeFrames > 0 && m_pw.eformat != SPA_AUDIO_FORMAT_F32)
+        return false;
+
+    joinPreload();
+
+    /* repeat method could have changed since preloading */
+    if (m_next.idx != nextAutoIdx() || !playable(m_next.hSnd))
+        return false;
+
+    /* different format has to wait for the ring to drain and renegotiate in `playCurrent()`,
+     * different file layout is fine as long as it mixes into the same output */
+    channels::Layout inLayout = channels::fileLayout(m_next.hSnd);
+    if (m_next.hSnd.samplerate() != (int)m_pw.origSampleRate ||
+        !(channels::outputLayout(inLayout) == m_pw.layout) ||
+        m_next.eformat != m_pw.eformat)
+    {
+        return false;
+    }
+
+    const char* notBitPerfect;
+    pickFormat(m_next.hSnd, inLayout, m_pw.layout, &notBitPerfect);
+    m_notBitPerfect = notBitPerfect;
+
+    /* current track goes on under the next one, faded out by the time the next one is halfway through */
+    if (fadeFrames > 0)
+        startFade(std::min(fadeFrames, (long)m_next.hSnd.frames() / 2));
+
+    m_mix.build(inLayout, m_pw.layout);
+    m_decodeBuff.resize(decodeFrames * inLayout.nChannels * sizeof(f32));
+
+    /* decoder only reads when there is room for `decodeFrames`, so the whole preroll fits */
+    m_trackMark = m_ring.writePos();
+    pushDecoded(m_next.vPreroll.data(), m_next.nPrerolled);
+
+    m_hSnd = m_next.hSnd;
+    m_next.hSnd = {};
+    m_decodeIdx = m_next.idx;
+    m_decodePos = m_next.nPrerolled;
+    useSeekTable();
+    m_bSpliced = true;
+
+    return true;
+}
+
+void
+PipeWirePlayer::decode()
+{
+    const long frameSize = m_pw.channels * m_pw.sampleSize;
+
+    for (;;)
+    {
+        /* input and mpris only post commands, they take effect here */
+        drainCommands();
+        applySeek();
+
+        if (m_bFinished || m_bNext || m_bPrev || m_bNewSongSelected)
+            break;
+
+        /* indexer finished something, exact length shows up as soon as it's this track's */
+        if (!m_pSeekTable && m_seekIndex.generation() != m_seekGeneration)
+        {
+            useSeekTable();
+            if (m_pSeekTable && !m_bSpliced)
+            {
+                m_pcmSize = m_decodeLen * m_pw.channels;
+                publishState();
+            }
+        }
+
+        /* track is over once everything decoded got played */
+        if (m_bEof && m_ring.empty())
+            break;
+
+        /* or once spliced track became audible */
+        if (m_bSpliced && m_trackMark == m_noMark)
+            break;
+
+        /* keep `defaults::ringBufferMs` of audio ahead at current speed, but leave room for one full read */
+        const long target = std::min((long)std::max(m_pw.sampleRate, m_pw.origSampleRate) * frameSize * defaults::ringBufferMs / 1000,
+                                     (long)m_ring.capacity() - decodeFrames*frameSize);
+
+        if (m_bEof || (long)m_ring.size() >= target)
+        {
+            /* offline render sink drains the ring way faster than in realtime */
+            if (m_bHeadless) std::this_thread::yield();
+            else std::this_thread::sleep_for(std::chrono::milliseconds(defaults::decoderSleep));
+            continue;
+        }
+
+        /* short tracks get half of themselves at most */
+        const long fadeFrames = std::min(std::lround(m_crossfadeSec * m_pw.origSampleRate), (long)m_decodeLen / 2);
+        const long fadeAt = m_decodeLen - fadeFrames;
+        const long preloadAt = fadeAt - m_pw.origSampleRate * defaults::gaplessPreloadSec;
+
+        /* next track was opened and prerolled well before this, so the fade doesn't wait on it */
+        if (fadeFrames > 0 && !m_bSpliced && m_fade.len == 0 && m_decodePos >= fadeAt &&
+            spliceNext(m_decodeLen - m_decodePos))
+        {
+            continue;
+        }
+
+        /* silence after the last track, what the convolver and limiter hold back comes out on it */
+        if (m_tailLeft > 0)
+        {
+            long n = std::min(m_tailLeft, decodeFrames);
+            std::fill(m_mixBuff.begin(), m_mixBuff.end(), 0.0f);
+            m_ring.push((const u8*)m_mixBuff.data(), n * frameSize);
+            m_tailLeft -= n;
+            m_bEof = m_tailLeft == 0;
+            continue;
+        }
+
+        sf_count_t nRead = readDecoded(m_decodeBuff.data(), decodeFrames);
+        if (nRead > 0)
+        {
+            pushDecoded(m_decodeBuff.data(), nRead);
+
+            if ((m_bGapless || fadeFrames > 0) && !m_bSpliced && m_decodePos >= preloadAt)
+            {
+                long next = nextAutoIdx();
+                if (next >= 0 && next != m_next.idx)
+                    startPreload(next);
+            }
+        }
+        else if (!spliceNext())
+        {
+            /* in source frames, with room for the resampler's delay */
+            const convolve::Convolver* pConv = m_chain.convolver();
+            long held = (defaults::bLimiter ? m_limiter.latency() : 0) +
+                        (pConv && m_chain.convolve() ? pConv->latency() + pConv->nTaps() : 0);
+            if (held > 0 && nextAutoIdx() < 0)
+                m_tailLeft = std::ceil((f64)held * m_pw.sampleRate / m_pw.deviceRate) + resample::maxHistory;
+
+            m_bEof = m_tailLeft == 0;
+        }
+    }
+}
+
+sf_count_t
+PipeWirePlayer::readDecoded(u8* pDst, long nFrames)
+{
+    /* NOTE: decoder only, from `m_decodePos`, `m_hSnd` gets seeked there only when the cache doesn't have it */
+    const std::string_view path = m_songs[m_decodeIdx];
+    const long ch = m_hSnd.channels();
+
+    long nRead = m_pcmCache.read(path, m_decodePos, m_pw.eformat, ch, pDst, nFrames);
+    if (nRead == 0)
+    {
+        /* stop at the block edge, so reads from there on are whole blocks to keep */
+        long want = std::min((s64)nFrames, cache::blockFrames - m_decodePos % cache::blockFrames);
+        seekHandle(&m_hSnd, m_decodePos);
+
+        nRead = std::max(readFrames(m_hSnd, m_pw.eformat, pDst, want), (sf_count_t)0);
+        m_pcmCache.store(path, m_decodePos, m_pw.eformat, ch, pDst, nRead, nRead < want);
+    }
+    m_decodePos += nRead;
+
+    return nRead;
+}
+
+void
+PipeWirePlayer::useSeekTable()
+{
+    /* NOTE: decoder only, whenever `m_decodeIdx` changes or the indexer got something done */
+    m_seekGeneration = m_seekIndex.generation();
+    m_pSeekTable = defaults::bSeekIndex ? m_seekIndex.get(m_songs[m_decodeIdx]) : nullptr;
+
+    /* not what libsndfile decodes, file changed under it */
+    if (m_pSeekTable && (m_pSeekTable->nChannels != m_hSnd.channels() || m_pSeekTable->sampleRate != (u32)m_hSnd.samplerate()))
+        m_pSeekTable = nullptr;
+
+    m_decodeLen = m_pSeekTable ? m_pSeekTable->nFrames : m_hSnd.base() + m_hSnd.frames();
+}
+
+void
+PipeWirePlayer::seekHandle(vio::Handle* pH, s64 pos)
+{
+    /* NOTE: decoder only, `pH` is `m_decodeIdx`'s. libsndfile decodes its way to wherever an mp3 seeks,
+     * with a seek point past where `pH` is it opens again from there, which is also the only way back before its base */
+    s64 at = pH->base() + pH->seek(0, SEEK_CUR);
+    if (at == pos) return;
+
+    const seek::Point* pPoint = m_pSeekTable ? m_pSeekTable->before(pos) : nullptr;
+    if (pos < pH->base() || (pPoint && pPoint->frame > at))
+    {
+        const std::string_view path = m_songs[m_decodeIdx];
+        vio::Handle h = pPoint ? vio::open(path, m_eIo, pPoint->offset, pPoint->frame) : vio::Handle {};
+
+        /* libsndfile didn't take it for an mp3 starting there, whole file is still right, only slower */
+        if (h.error() != 0 || h.channels() != pH->channels() || h.samplerate() != pH->samplerate())
+            h = pos < pH->base() ? vio::open(path, m_eIo) : vio::Handle {};
+
+        if (h.error() == 0) *pH = h;
+    }
+
+    pH->seek(pos - pH->base(), SEEK_SET);
+}
+
+bool
+PipeWirePlayer::applySeek()
+{
+    /* NOTE: decoder only, between reads, so nothing stale gets pushed after the flush */
+    s64 to = m_seekTo.exchange(m_noSeek, std::memory_order_acq_rel);
+    if (to == m_noSeek) return false;
+
+    /* `m_hSnd` itself only moves once the cache doesn't have it */
+    m_decodePos = std::min(to, m_decodeLen);
+    flushDecoded();
+
+    return true;
+}
+
+void
+PipeWirePlayer::flushDecoded()
+{
+    /* NOTE: decoder only, after moving `m_decodePos` */
+    m_flushPos = m_decodePos * m_pw.channels;
+    m_ring.flush();
+    m_trackMark = m_noMark; /* seeking during a splice lands in the spliced track */
+    m_bEof = false;
+    m_tailLeft = 0;
+    stopFade();
+
+    /* show the new position right away, even paused, `play::render()` re-anchors it with latency once it runs */
+    m_pSink->lock();
+    m_clock.set(timing::nowNs(), m_flushPos / m_pw.channels, 0.0, true);
+    m_pSink->unlock();
+}
+
+void
+PipeWirePlayer::pushDecoded(const u8* pSrc, long nFrames)
+{
+    /* NOTE: decoder side, `pSrc` is in file's layout */
+    const long nBytes = nFrames * m_pw.channels * m_pw.sampleSize;
+
+    if (m_fade.len > 0)
+    {
+        /* only ever fading f32 */
+        if (m_mix.isIdentity()) memcpy(m_mixBuff.data(), pSrc, nBytes);
+        else m_mix.apply(m_mixBuff.data(), (const f32*)pSrc, nFrames);
+
+        crossfade(m_mixBuff.data(), nFrames);
+        m_ring.push((const u8*)m_mixBuff.data(), nBytes);
+    }
+    else if (m_mix.isIdentity())
+    {
+        m_ring.push(pSrc, nBytes);
+    }
+    else
+    {
+        /* only ever mixing f32 */
+        m_mix.apply(m_mixBuff.data(), (const f32*)pSrc, nFrames);
+        m_ring.push((const u8*)m_mixBuff.data(), nBytes);
+    }
+}
+
+void
+PipeWirePlayer::startFade(long nFrames)
+{
+    /* NOTE: decoder only, `m_hSnd` and `m_mix` are still the track that fades out */
+    m_fade.hSnd = m_hSnd;
+    seekHandle(&m_fade.hSnd, m_decodePos);
+    m_fade.mix = m_mix;
+    m_fade.vDecode.resize(decodeFrames * m_hSnd.channels() * sizeof(f32));
+    m_fade.vMixed.resize(decodeFrames * m_pw.channels);
+    m_fade.pos = 0;
+    m_fade.len = nFrames;
+}
+
+void
+PipeWirePlayer::crossfade(f32* pData, long nFrames)
+{
+    /* NOTE: decoder only, `pData` is the incoming track in output layout */
+    const long ch = m_pw.channels;
+    const long n = std::min(nFrames, m_fade.len - m_fade.pos);
+
+    sf_count_t nRead = std::max(m_fade.hSnd.readf((float*)m_fade.vDecode.data(), n), (sf_count_t)0);
+    const f32* pOld = (const f32*)m_fade.vDecode.data();
+    if (!m_fade.mix.isIdentity())
+    {
+        m_fade.mix.apply(m_fade.vMixed.data(), pOld, nRead);
+        pOld = m_fade.vMixed.data();
+    }
+
+    for (long i = 0; i < n; i++)
+    {
+        /* equal power, `sin^2 + cos^2` stays 1 for uncorrelated tracks */
+        f64 t = (f64)(m_fade.pos + i) + 0.5;
+        f64 angle = t / (f64)m_fade.len * std::numbers::pi / 2.0;
+        f32 gIn = std::sin(angle);
+        f32 gOut = i < nRead ? std::cos(angle) : 0.0f;
+
+        for (long c = 0; c < ch; c++)
+            pData[i*ch + c] = pData[i*ch + c] * gIn + (gOut != 0.0f ? pOld[i*ch + c] * gOut : 0.0f);
+    }
+
+    m_fade.pos += n;
+    if (m_fade.pos >= m_fade.len) stopFade();
 }
 
 bool
@@ -686,6 +1479,8 @@ PipeWirePlayer::subStringSearch(enum search::dir direction)
     {
         m_foundIndices = search::getIndexList(m_songs, m_searchingNow, direction);
         m_currFoundIdx = 0;
+        /* `n` goes there next */
+        if (m_foundIndices.size() > 1) m_prefetch.hint(m_foundIndices[1]);
 
         return true;
     }
@@ -706,6 +1501,8 @@ PipeWirePlayer::jumpToFound(enum search::dir direction)
         else if (m_currFoundIdx < 0)
             m_currFoundIdx = m_foundIndices.size() - 1;
 
+        /* the one after it is where the same key goes next, the selected one stays ahead of it */
+        m_prefetch.hint(m_foundIndices[(m_currFoundIdx + next + m_foundIndices.size()) % m_foundIndices.size()]);
         m_term.m_selected = m_foundIndices[m_currFoundIdx];
         centerOn(m_term.m_selected);
     }
@@ -718,16 +1515,15 @@ PipeWirePlayer::centerOn(size_t i)
     m_term.m_firstInList = (m_term.m_selected - (m_term.playListMaxY() - 3) / 2);
 }
 
-void
-PipeWirePlayer::setSeek(f64 value)
+f64
+PipeWirePlayer::getCurrTimeInSec() const
 {
-    std::lock_guard lock(m_pw.mtx);
-
-    value = std::clamp(value, 0.0, getMaxTimeInSec());
+    /* pending seek target shows up right away */
+    s64 pending = m_seekTo.load(std::memory_order_relaxed);
+    f64 frame = pending != m_noSeek ? (f64)pending : m_clock.frame();
 
-    value *= m_pw.sampleRate;
-    m_hSnd.seek(value, SEEK_SET);
-    m_pcmPos = m_hSnd.seek(0, SEEK_CUR) * m_pw.channels;
+    /* frames of the file, speed only changes how fast they go by */
+    return frame / (f64)state().origSampleRate;
 }
 
 void
@@ -745,80 +1541,70 @@ PipeWirePlayer::jumpTo()
         long num = wcstol((wchar_t*)wb, &end, std::size(wb));
         num = std::clamp((long)num, 1L, (long)m_songs.size());
         m_term.m_selected = num - 1;
+        m_prefetch.hint(num - 1);
     }
 }
 
 void
-PipeWirePlayer::pause()
+PipeWirePlayer::setPaused(bool bPause)
 {
-    std::lock_guard lock(m_mtxPauseSwitch);
-    m_bPaused = true;
-}
+    m_bPaused = bPause;
 
-void
-PipeWirePlayer::resume()
-{
-    std::lock_guard lock(m_mtxPauseSwitch);
-    m_bPaused = false;
-    m_cndPause.notify_one();
-}
+    if (!m_pSink->started()) return;
 
-void
-PipeWirePlayer::togglePause()
-{
-    std::lock_guard lock(m_mtxPauseSwitch);
-    m_bPaused = !m_bPaused;
-    if (!m_bPaused) m_cndPause.notify_one();
+    /* ring and decode position are kept, resume continues from the very next sample */
+    m_pSink->lock();
+    if (bPause) m_clock.stop();
+    m_pSink->setActive(!bPause);
+    m_pSink->unlock();
 }
 
 void
-PipeWirePlayer::cycleRepeatMethods(int i)
+PipeWirePlayer::updateGain()
 {
-    assert((i == -1 || i == 1) && "wrong i");
-
-    auto m = (int)m_eRepeat + i;
-    if (m >= (int)repeatMethod::size)
-        m = 0;
-    else if (m < 0)
-        m = (int)repeatMethod::size - 1;
-
-    setRepeatMethod((enum repeatMethod)m);
+    /* non linear nicer ramping, replaygain rides along for free */
+    m_gain = m_bMuted ? 0.0 : std::pow(m_volume, defaults::volumePower) * m_replayGain;
 }
 
 void
-PipeWirePlayer::setVolume(f64 vol)
+PipeWirePlayer::setSampleRate(long rate)
 {
-    m_volume = std::clamp(vol, defaults::minVolume, defaults::maxVolume);
+    m_pw.sampleRate = clampRate(rate, m_pw.origSampleRate, m_pw.deviceRate, m_bPreservePitch);
+    m_speedMul = (f64)m_pw.sampleRate / (f64)m_pw.origSampleRate;
+    applySampleRate();
 }
 
 void
-PipeWirePlayer::addSampleRate(long val)
+PipeWirePlayer::applySampleRate()
 {
-    long nSr = (f64)m_pw.sampleRate + val;
-    nSr = std::clamp(nSr, defaults::minSampleRate, defaults::maxSampleRate);
-
-    m_pw.sampleRate = nSr;
-    m_speedMul = (f64)m_pw.sampleRate / (f64)m_pw.origSampleRate;
-    m_bChangeParams = true;
+    /* stream keeps its rate, same samples in the ring go through the resampler at the new ratio,
+     * or through the time-stretch at the new tempo with the resampler only converting to device rate */
+    f64 tempo = m_bPreservePitch ? m_speedMul : 1.0;
+    u32 rate = m_bPreservePitch ? m_pw.origSampleRate : m_pw.sampleRate;
+    f64 ratio = (f64)rate / (f64)m_pw.deviceRate;
+
+    resample::Filter filter {};
+    if (m_resampler.needsFilter(ratio))
+        filter = resample::Filter(resampleQuality(), ratio);
+
+    m_pSink->lock();
+    if (filter.nTaps > 0) m_resampler.setFilter(&filter);
+    m_resampler.setRatio(ratio);
+    m_stretch.setTempo(tempo);
+    m_pSink->unlock();
 }
 
 void
-PipeWirePlayer::restoreOrigSampleRate()
+PipeWirePlayer::applyEq()
 {
-    m_pw.sampleRate = m_pw.origSampleRate;
-    m_speedMul = 1.0;
-    m_bChangeParams = true;
+    /* `play::render()` picks new coefficients up on its next buffer */
+    m_chain.m_eq.set(eq::design(defaults::eqPresets[m_eqPreset], m_pw.deviceRate));
 }
 
 void
 PipeWirePlayer::finish()
 {
     m_bFinished = true;
-    if (m_bPaused)
-    {
-        m_bPaused = false;
-        m_cndPause.notify_all();
-    }
 }
 
 void
@@ -837,13 +1623,180 @@ PipeWirePlayer::select(long pos, bool bWrap)
         else pos = 0;
     }
     m_term.m_selected = m_selected = pos;
+    m_prefetch.hint(pos);
 }
 
 void
 PipeWirePlayer::playSelected()
 {
-    m_currSongIdx = m_term.m_selected;
-    m_bNewSongSelected = true;
+    post({cmd::play, m_term.m_selected});
+}
+
+void
+PipeWirePlayer::drainCommands()
+{
+    /* NOTE: player thread only, once per decoder cycle */
+    Command c;
+    bool bAny = false;
+
+    while (m_commands.pop(&c))
+    {
+        handle(c);
+        bAny = true;
+    }
+
+    if (bAny)
+    {
+        publishState();
+        m_term.updateStatus();
+        m_term.drawUI();
+    }
+}
+
+void
+PipeWirePlayer::publishState()
+{
+    /* NOTE: player thread only, it's the single writer */
+    m_state.store({
+        .nFrames = (s64)m_pcmSize / m_pw.channels,
+        .sampleRate = m_pw.sampleRate,
+        .origSampleRate = m_pw.origSampleRate,
+        .speedMul = m_speedMul,
+        .minSpeed = (f64)clampRate(0, m_pw.origSampleRate, m_pw.deviceRate, m_bPreservePitch) / (f64)m_pw.origSampleRate,
+        .maxSpeed = (f64)clampRate(defaults::maxSampleRate, m_pw.origSampleRate, m_pw.deviceRate, m_bPreservePitch) / (f64)m_pw.origSampleRate,
+        .volume = m_volume,
+        .replayGain = m_replayGain,
+        .eqPreset = m_eqPreset,
+        .convolverTaps = m_chain.convolve() && m_chain.convolver() ? m_chain.convolver()->nTaps() : 0,
+        .convolverBlock = m_chain.convolver() ? m_chain.convolver()->block() : 0,
+        .currSongIdx = m_currSongIdx,
+        .eRepeat = m_eRepeat,
+        .bPaused = m_bPaused,
+        .bMuted = m_bMuted,
+        .bPreservePitch = m_bPreservePitch,
+    });
+}
+
+void
+PipeWirePlayer::handle(const Command& c)
+{
+    switch (c.eCmd)
+    {
+        case cmd::next:
+            m_bNext = true;
+            break;
+
+        case cmd::prev:
+            m_bPrev = true;
+            break;
+
+        case cmd::play:
+            m_newSongIdx = c.i;
+            m_bNewSongSelected = true;
+            break;
+
+        case cmd::seekTo:
+            m_seekTo = std::clamp(c.f, 0.0, getMaxTimeInSec()) * m_pw.origSampleRate;
+            break;
+
+        case cmd::seekBy:
+        {
+            /* relative to the one still pending, so held key or burst of mpris calls add up */
+            s64 pending = m_seekTo;
+            s64 from = pending != m_noSeek ? pending : (s64)m_clock.frame();
+            m_seekTo = std::max(from + secToPcm(c.f), (s64)0);
+        }
+        break;
+
+        case cmd::volume:
+            m_volume = std::clamp(c.f, defaults::minVolume, defaults::maxVolume);
+            updateGain();
+            break;
+
+        case cmd::volumeBy:
+            m_volume = std::clamp(m_volume + c.f, defaults::minVolume, defaults::maxVolume);
+            updateGain();
+            break;
+
+        case cmd::toggleMute:
+            m_bMuted = !m_bMuted;
+            updateGain();
+            break;
+
+        case cmd::addSampleRate:
+            setSampleRate((long)m_pw.sampleRate + (long)c.i);
+            break;
+
+        case cmd::restoreSampleRate:
+            setSampleRate(m_pw.origSampleRate);
+            break;
+
+        case cmd::speed:
+            /* mpris says 0 means pause */
+            if (c.f <= 0.0) setPaused(true);
+            else setSampleRate(std::lround(m_pw.origSampleRate * c.f));
+            break;
+
+        case cmd::togglePreservePitch:
+            /* same speed if the other mode can do it */
+            m_bPreservePitch = !m_bPreservePitch;
+            setSampleRate(m_pw.sampleRate);
+            break;
+
+        case cmd::eqPreset:
+            m_eqPreset = std::clamp(c.i, (s64)0, (s64)std::size(defaults::eqPresets) - 1);
+            applyEq();
+            break;
+
+        case cmd::cycleEqPreset:
+        {
+            const long n = std::size(defaults::eqPresets);
+            m_eqPreset = (m_eqPreset + c.i + n) % n;
+            applyEq();
+        }
+        break;
+
+        case cmd::toggleConvolve:
+            if (m_response.nFrames > 0)
+            {
+                m_pSink->lock();
+                m_chain.setConvolve(!m_chain.convolve());
+                m_pSink->unlock();
+            }
+            break;
+
+        case cmd::repeat:
+            m_eRepeat = (enum repeatMethod)std::clamp(c.i, (s64)0, (s64)repeatMethod::size - 1);
+            m_prefetch.plan(upcoming());
+            break;
+
+        case cmd::cycleRepeat:
+        {
+            assert((c.i == -1 || c.i == 1) && "wrong i");
+
+            long m = (long)m_eRepeat + c.i;
+            if (m >= (long)repeatMethod::size)
+                m = 0;
+            else if (m < 0)
+                m = (long)repeatMethod::size - 1;
+
+            m_eRepeat = (enum repeatMethod)m;
+            m_prefetch.plan(upcoming());
+        }
+        break;
+
+        case cmd::pause:
+            setPaused(true);
+            break;
+
+        case cmd::resume:
+            setPaused(false);
+            break;
+
+        case cmd::togglePause:
+            setPaused(!m_bPaused);
+            break;
+    }
 }
 
 } /* namespace app */
@@ -2,10 +2,26 @@
 #include "search.hh"
 #include "song.hh"
 #include "defaults.hh"
+#include "ring.hh"
+#include "chain.hh"
+#include "channels.hh"
+#include "dither.hh"
+#include "resample.hh"
+#include "stretch.hh"
+#include "timing.hh"
+#include "limit.hh"
+#include "lockfree.hh"
+#include "loudness.hh"
+#include "prefetch.hh"
+#include "cache.hh"
+#include "seek.hh"
+#include "sink.hh"
+#include "vio.hh"
 
 #include <atomic>
-#include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <pipewire/pipewire.h>
 #include <sndfile.hh>
 #include <ncurses.h>
@@ -19,21 +35,20 @@ constexpr wchar_t blockIcon1[3] = L"▮";
 constexpr wchar_t blockIcon2[3] = L"▯";
 constexpr wchar_t blockIconST0[3] = L"░";
 constexpr wchar_t botBarIcon0[3] = L"▁";
-constexpr size_t chunkSize = 0x4000; /* big enough */
+constexpr size_t ringSize = 1 << 21; /* bytes, enough for 'defaults::ringBufferMs' of 8 channel 192kHz 32 bit */
+constexpr long decodeFrames = 1024*4; /* frames decoded in one read */
 
 struct PipeWireData
 {
-    pw_core* pCore {};
-    pw_context* pCtx {};
-    pw_main_loop* pLoop {};
-    pw_stream* pStream {};
-    static const pw_stream_events streamEvents;
-    enum spa_audio_format eformat = SPA_AUDIO_FORMAT_S16;
-    u32 sampleRate = 48000;
+    enum spa_audio_format eformat = SPA_AUDIO_FORMAT_F32; /* decoded, in the ring and through `play::render()` */
+    u32 sampleSize = sizeof(f32); /* bytes, of `eformat` */
+    enum spa_audio_format sinkFormat = SPA_AUDIO_FORMAT_F32; /* what goes out, `eformat` or requantized from f32 */
+    u32 sampleRate = 48000; /* source frames per second, with speed multiplier */
     u32 origSampleRate = sampleRate;
-    u32 channels = 2;
+    u32 deviceRate = sampleRate; /* what the sink runs at, `m_resampler` makes up the difference */
+    u32 channels = 2; /* output channels, same as `layout.nChannels` */
+    channels::Layout layout {};
     int lastNFrames = 0;
-    static std::mutex mtx;
 };
 
 class PipeWirePlayer;
@@ -68,10 +83,13 @@ public:
     const long m_visualizerYSize = defaults::visualizerHeight;
     std::mutex m_mtx {};
     std::atomic<bool> m_bDrawVisualizer = defaults::bDrawVisualizer;
+    bool m_bInit = false; /* ncurses is up, nothing gets drawn otherwise */
 
-    CursesUI();
+    CursesUI() = default;
     ~CursesUI();
 
+    void init();
+
     size_t playListMaxY() const { return getmaxy(m_pl.pBor); }
     void updatePlayList() { m_update.bPlayList = true; }
     void updateBottomLine() { m_update.bBottomLine = true; }
@@ -87,6 +105,7 @@ private:
     void drawVisualizer();
     void drawTime();
     enum color::curses drawVolume();
+    void drawBufferFill();
     void drawPlayListCounter();
     void drawTitle();
     void drawPlayList();
@@ -108,73 +127,242 @@ constexpr std::string_view repeatMethodStrings[] {
     "None", "Track", "Playlist"
 };
 
+/* consistent view of the player for ui and mpris, published by `PipeWirePlayer::publishState()` */
+struct PlayerState
+{
+    s64 nFrames = 0; /* current track length */
+    u32 sampleRate = 48000; /* with speed multiplier */
+    u32 origSampleRate = 48000;
+    f64 speedMul = 1.0;
+    f64 minSpeed = 1.0; /* what `speedMul` can go to in the current pitch mode */
+    f64 maxSpeed = 1.0;
+    f64 volume = defaults::volume;
+    f32 replayGain = 1.0f;
+    long eqPreset = defaults::eqPreset;
+    long convolverTaps = 0; /* 0 when convolution is off */
+    long convolverBlock = 0;
+    long currSongIdx = 0;
+    enum repeatMethod eRepeat = repeatMethod::none;
+    bool bPaused = false;
+    bool bMuted = false;
+    bool bPreservePitch = defaults::bPreservePitch;
+};
+
+enum class cmd : u8
+{
+    next,
+    prev,
+    play, /* `i` song index */
+    seekTo, /* `f` seconds */
+    seekBy, /* `f` seconds */
+    volume, /* `f` */
+    volumeBy, /* `f` */
+    toggleMute,
+    addSampleRate, /* `i` Hz */
+    restoreSampleRate,
+    speed, /* `f` multiplier, 0 pauses */
+    togglePreservePitch,
+    eqPreset, /* `i` index into `defaults::eqPresets` */
+    cycleEqPreset, /* `i` 1 or -1 */
+    toggleConvolve,
+    repeat, /* `i` repeatMethod */
+    cycleRepeat, /* `i` 1 or -1 */
+    pause,
+    resume,
+    togglePause
+};
+
+/* control intent from input or mpris thread, takes effect on the player thread */
+struct Command
+{
+    enum cmd eCmd;
+    s64 i = 0;
+    f64 f = 0.0;
+};
+
+/* next track opened and pre-decoded in the background, for gapless transitions */
+struct Preload
+{
+    vio::Handle hSnd {};
+    song::Info info {};
+    long idx = -1;
+    enum spa_audio_format eformat = SPA_AUDIO_FORMAT_F32; /* what preroll got decoded as */
+    std::vector<u8> vPreroll {};
+    long nPrerolled = 0; /* frames, in file's channel layout */
+    std::thread thrd {};
+};
+
+/* previous track still going under the current one, decoder only */
+struct Fade
+{
+    vio::Handle hSnd {};
+    channels::Matrix mix {}; /* its file -> output channels */
+    std::vector<u8> vDecode {}; /* `decodeFrames` in its file's layout, f32 */
+    std::vector<f32> vMixed {}; /* `decodeFrames` in output layout */
+    long pos = 0; /* frames into the fade */
+    long len = 0; /* 0 when nothing is fading */
+};
+
 class PipeWirePlayer
 {
 public:
     static constexpr std::string_view m_supportedFormats[] {".flac", ".opus", ".mp3", ".ogg", ".wav", ".caf", ".aif"};
-    std::mutex m_mtxPause {};
-    std::mutex m_mtxPauseSwitch {};
+    static constexpr size_t m_noMark = ~0UL;
+    static constexpr s64 m_noSeek = -1;
     std::atomic<bool> m_ready = false;
-    std::condition_variable m_cndPause {};
     PipeWireData m_pw {};
-    SndfileHandle m_hSnd {};
-    song::Info m_info {};
+    std::unique_ptr<sink::AudioSink> m_pSink {}; /* where `play::render()` output goes, see `--sink` */
+    vio::Handle m_hSnd {};
+    enum vio::backend m_eIo = defaults::ioBackend; /* how `m_hSnd` and `m_next.hSnd` get read, see `--io` */
+    song::Info m_info {}; /* player thread only, readers use `info()` */
+    std::atomic<std::shared_ptr<const song::Info>> m_pInfo = std::make_shared<const song::Info>();
+    lockfree::SeqLock<PlayerState> m_state {};
     CursesUI m_term {};
     long m_selected = 0;
     std::vector<std::string> m_songs {};
     std::vector<int> m_foundIndices {};
     std::wstring m_searchingNow {};
-    static f32 m_chunk[chunkSize];
+    std::vector<u8> m_chunk {}; /* `sink::maxQuantum` output frames, only grows, resized under sink lock and `m_term.m_mtx` */
+    ring::SPSC<u8> m_ring {ringSize}; /* decoder thread -> `play::render()`, samples in `m_pw.eformat` */
+    std::vector<u8> m_decodeBuff {}; /* `decodeFrames` in file's channel layout and `m_pw.eformat` */
+    std::vector<f32> m_mixBuff {}; /* `decodeFrames` in output channel layout */
+    cache::Pcm m_pcmCache {defaults::pcmCacheMiB << 20}; /* decoded blocks of recent tracks, decoder and preload */
+    long m_decodeIdx = 0; /* song `m_hSnd` is, runs ahead of `m_currSongIdx` after a splice, decoder only */
+    s64 m_decodePos = 0; /* frames into it the decoder is, decoder only */
+    s64 m_decodeLen = 0; /* frames in it, exact once `m_pSeekTable` is there, decoder only */
+    long m_tailLeft = 0; /* frames of silence still to push after the last track, decoder only */
+    seek::Indexer m_seekIndex {}; /* exact length and seek points of mp3s libsndfile can only estimate */
+    std::shared_ptr<const seek::Table> m_pSeekTable {}; /* of `m_decodeIdx`, null until it's indexed or when it can't be */
+    u64 m_seekGeneration = 0; /* `m_seekIndex.generation()` when `m_pSeekTable` was last asked for */
+    channels::Matrix m_mix {}; /* file -> output channels */
+    resample::Resampler m_resampler {}; /* source -> device rate, `play::render()` only, set up under sink lock */
+    bool m_bResampling = false; /* `play::render()` goes through `m_resampler`, off only at exactly 1:1 */
+    stretch::Wsola m_stretch {}; /* tempo before `m_resampler` when pitch is preserved, same rules */
+    bool m_bStretching = false; /* `play::render()` goes through `m_stretch`, stays on at tempo 1 until the next flush */
+    std::vector<u8> m_history {}; /* last source frames popped in `play::render()`, to prime either stage with */
+    long m_nHistory = 0;
+    std::vector<u8> m_resampleIn {}; /* popped for `m_resampler` or `m_stretch`, in `m_pw.eformat` */
+    std::vector<f32> m_stretchIn {}; /* same, converted to float */
+    std::vector<f32> m_stretchOut {}; /* `m_stretch` -> `m_resampler` */
+    chain::Chain m_chain {}; /* runs in `play::render()`, configured from the player thread */
+    long m_eqPreset = defaults::eqPreset; /* index into `defaults::eqPresets` */
+    limit::Limiter m_limiter {}; /* after volume, `play::render()` only, set up under sink lock */
+    bool m_bLimiting = false; /* `play::render()` goes through `m_limiter`, stays on until the next flush */
+    std::vector<u8> m_limitDelay {}; /* `m_limiter.latency()` frames in `m_pw.eformat`, what's out gets delayed as much */
+    std::vector<u8> m_limitScratch {}; /* same frames as f32, `m_limitDelay` rotates through it too */
+    dither::Ditherer m_dither {}; /* every float to integer step in `play::render()` */
+    convolve::Response m_response {}; /* for `m_chain`'s convolver, empty without one */
+    std::vector<f32> m_resampleOut {}; /* `sink::maxQuantum` output frames, before conversion to `m_pw.eformat` */
+    std::atomic<bool> m_bEof = false; /* decoder reached the end of the file */
+    std::atomic<long> m_flushPos = 0; /* `m_pcmPos` to set after ring flush */
+    std::atomic<long> m_minFill = 0; /* lowest ring fill level (in bytes) since track start */
+    std::atomic<const char*> m_notBitPerfect = nullptr; /* why file's own format isn't what goes out */
+    std::atomic<long> m_nUnderruns = 0;
+    std::atomic<f64> m_playedSec = 0.0; /* output rendered since startup, `play::render()` only writes it, for io rates */
+    Preload m_next {};
+    Fade m_fade {};
+    f64 m_crossfadeSec = defaults::crossfadeSec;
+    std::atomic<size_t> m_trackMark = m_noMark; /* ring position where spliced track starts */
+    bool m_bSpliced = false; /* next track is already in the ring */
+    std::atomic<bool> m_bGapless = defaults::bGapless;
     long m_currSongIdx = 0;
     long m_currFoundIdx = 0;
     size_t m_pcmSize = 0;
-    long m_pcmPos = 0;
+    long m_pcmPos = 0; /* samples handed to the sink, `play::render()` only */
+    timing::Clock m_clock {}; /* frames actually heard, everyone else reads this */
+    std::atomic<s64> m_seekTo = m_noSeek; /* frame for the decoder to seek to, newer requests overwrite older */
+    lockfree::MPSC<Command> m_commands {256}; /* input, mpris -> player thread */
     f64 m_volume = defaults::volume;
+    loudness::Scanner m_loudness {};
+    prefetch::Prefetcher m_prefetch {}; /* follows `upcoming()`, `select()` and search hits */
+    enum loudness::mode m_eReplayGain = defaults::replayGain;
+    f32 m_replayGain = 1.0f; /* linear, for the current track */
+    std::atomic<f32> m_gain = 0.0f; /* what `m_volume`, `m_replayGain` and `m_bMuted` amount to */
+    f32 m_lastGain = 0.0f; /* last gain applied in `play::render()`, ramp from it to `m_gain` */
     bool m_bMuted = false;
-    bool m_bPaused = false;
+    std::atomic<bool> m_bPaused = false;
     bool m_bNext = false;
     bool m_bPrev = false;
     bool m_bNewSongSelected = false;
+    long m_newSongIdx = 0;
     enum repeatMethod m_eRepeat = repeatMethod::none;
     bool m_bWrapSelection = defaults::bWrapSelection;
     std::atomic<bool> m_bFinished = false;
-    bool m_bChangeParams = false;
+    bool m_bHeadless = false; /* `--render`, no ui, input or mpris */
     f64 m_speedMul = 1.0;
+    bool m_bPreservePitch = defaults::bPreservePitch; /* speed changes tempo through `m_stretch` instead of resampling */
 
     PipeWirePlayer(int argc, char** argv);
-    ~PipeWirePlayer();
+    ~PipeWirePlayer() = default;
 
-    void setupPlayer(enum spa_audio_format format, u32 sampleRate, u32 channels);
+    sink::Format outputFormat() const { return {m_pw.sinkFormat, m_pw.deviceRate, m_pw.layout}; }
     void playAll();
     void playCurrent();
+    void decode();
+    /* any thread, dropped if the queue is somehow full */
+    void post(const Command& c) { m_commands.push(c); }
+    void drainCommands();
+    void publishState();
+    /* any thread, never blocks the player */
+    PlayerState state() const { return m_state.load(); }
+    std::shared_ptr<const song::Info> info() const { return m_pInfo.load(std::memory_order_acquire); }
+    void handle(const Command& c);
+    sf_count_t readDecoded(u8* pDst, long nFrames);
+    void useSeekTable();
+    void seekHandle(vio::Handle* pH, s64 pos);
+    bool applySeek();
+    void flushDecoded();
+    void pushDecoded(const u8* pSrc, long nFrames);
+    long nextAutoIdx() const;
+    void startPreload(long idx);
+    std::vector<long> upcoming() const;
+    void joinPreload() { if (m_next.thrd.joinable()) m_next.thrd.join(); }
+    bool spliceNext(long fadeFrames = 0);
+    void startFade(long nFrames);
+    void stopFade() { m_fade.hSnd = {}; m_fade.len = 0; }
+    void crossfade(f32* pData, long nFrames);
     const std::string_view currSongName() const { return m_songs[m_currSongIdx]; }
     bool subStringSearch(enum search::dir direction);
     void jumpToFound(enum search::dir direction);
     void centerOn(size_t i);
-    void setSeek(f64 value);
+    void setSeek(f64 sec) { post({cmd::seekTo, 0, sec}); }
+    void seekBy(f64 sec) { post({cmd::seekBy, 0, sec}); }
     void jumpTo();
-    void pause();
-    void resume();
-    void togglePause();
-    void toggleMute() { m_bMuted = !m_bMuted; }
-    void cycleRepeatMethods(int i = 1);
-    void setVolume(f64 vol);
-    void addSampleRate(long val);
-    void restoreOrigSampleRate();
+    void setPaused(bool bPause);
+    void pause() { post({cmd::pause}); }
+    void resume() { post({cmd::resume}); }
+    void togglePause() { post({cmd::togglePause}); }
+    void toggleMute() { post({cmd::toggleMute}); }
+    void toggleGapless() { m_bGapless = !m_bGapless; }
+    void cycleRepeatMethods(int i = 1) { post({cmd::cycleRepeat, i}); }
+    void setVolume(f64 vol) { post({cmd::volume, 0, vol}); }
+    void addVolume(f64 step) { post({cmd::volumeBy, 0, step}); }
+    void updateGain();
+    void addSampleRate(long val) { post({cmd::addSampleRate, val}); }
+    void restoreOrigSampleRate() { post({cmd::restoreSampleRate}); }
+    void setSpeed(f64 mul) { post({cmd::speed, 0, mul}); }
+    void togglePreservePitch() { post({cmd::togglePreservePitch}); }
+    void setEqPreset(long idx) { post({cmd::eqPreset, idx}); }
+    void cycleEqPreset(int i = 1) { post({cmd::cycleEqPreset, i}); }
+    void applyEq();
+    void toggleConvolve() { post({cmd::toggleConvolve}); }
+    void setSampleRate(long rate);
+    void applySampleRate();
     void finish();
-    void next() { m_bNext = true; }
-    void prev() { m_bPrev = true; }
+    void next() { post({cmd::next}); }
+    void prev() { post({cmd::prev}); }
     void select(long pos, bool bWrap = defaults::bWrapSelection);
     void selectNext() { select(m_selected + 1); }
     void selectPrev() { select(m_selected - 1); }
     void selectFirst() { select(0); }
     void selectLast() { select(m_songs.size() - 1); }
     void playSelected();
-    std::string_view getRepeatMethod() const { return repeatMethodStrings[(int)m_eRepeat]; }
-    void setRepeatMethod(enum repeatMethod eM) { m_eRepeat = eM; }
-    f64 getCurrTimeInSec() const { return ((f64)m_pcmPos/(f64)m_pw.channels) / (f64)m_pw.sampleRate; };
-    f64 getMaxTimeInSec() const { return ((f64)m_pcmSize/(f64)m_pw.channels) / (f64)m_pw.sampleRate; };
-    s64 secToPcm(f64 sec) const { return sec*(f64)m_pw.sampleRate; }
+    std::string_view getRepeatMethod() const { return repeatMethodStrings[(int)state().eRepeat]; }
+    void setRepeatMethod(enum repeatMethod eM) { post({cmd::repeat, (s64)eM}); }
+    f64 getCurrTimeInSec() const;
+    f64 getMaxTimeInSec() const { PlayerState s = state(); return (f64)s.nFrames / (f64)s.origSampleRate; };
+    s64 secToPcm(f64 sec) const { return sec*(f64)m_pw.origSampleRate; } /* seconds into the file, not of playback */
+    f64 bytesToMs(long n) const { return ((f64)n/(f64)(m_pw.channels * m_pw.sampleSize)) / ((f64)state().sampleRate / 1000.0); }
 };
 
 } /* namespace app */
@@ -0,0 +1,109 @@
+#include "bench.hh"
+#include "defaults.hh"
+#include "dither.hh"
+#include "dsp.hh"
+#include "eq.hh"
+#include "limit.hh"
+#include "timing.hh"
+#include "utils.hh"
+
+#include <cmath>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+namespace bench
+{
+
+constexpr long nFrames = 4096; /* `sink::maxQuantum` */
+constexpr long nChannels = 2;
+constexpr u32 sampleRate = 48000;
+constexpr f64 minSec = 0.25; /* each kernel runs at least this long */
+
+/* ns per frame, `fn(i)` does `nFrames` */
+template<typename FN>
+static f64
+time(FN fn)
+{
+    fn(0); /* caches, dispatch */
+
+    long n = 0;
+    s64 t0 = timing::nowNs();
+    s64 t1;
+    do
+    {
+        fn(++n);
+        t1 = timing::nowNs();
+    } while (t1 - t0 < minSec * 1e9);
+
+    return (f64)(t1 - t0) / ((f64)n * nFrames);
+}
+
+static void
+report(std::string_view name, f64 nsPerFrame)
+{
+    COUT("{:<16} {:8.3f} ns/sample {:8.3f} frames/ns {:7.3f}% of a core\n",
+         name, nsPerFrame / nChannels, 1.0 / nsPerFrame, nsPerFrame * sampleRate / 1e7);
+}
+
+int
+run()
+{
+    const long n = nFrames * nChannels;
+    std::vector<f32> vSrc(n), vDst(n);
+    std::vector<s16> vSrc16(n), vDst16(n);
+    std::vector<s32> vDst32(n);
+
+    /* music-ish: a few partials and some noise, peaks around -1 dBFS */
+    u32 rng = 1;
+    for (long i = 0; i < nFrames; i++)
+    {
+        for (long c = 0; c < nChannels; c++)
+        {
+            rng ^= rng << 13, rng ^= rng >> 17, rng ^= rng << 5;
+            f64 t = (f64)i / sampleRate;
+            f64 s = 0.4*std::sin(2*M_PI*110*t + c) + 0.3*std::sin(2*M_PI*1375*t) + 0.1*std::sin(2*M_PI*7040*t);
+            vSrc[i*nChannels + c] = s + 0.05 * ((f64)rng / 4294967296.0 - 0.5);
+        }
+    }
+    dsp::convert(vSrc16.data(), vSrc.data(), n);
+
+    COUT("{} frames of {} channels at {}Hz per call, gain dispatches to {}\n", nFrames, nChannels, sampleRate, dsp::gainIsa());
+
+    report("gain flat", time([&](long) { dsp::gain(vDst.data(), vSrc.data(), nFrames, nChannels, 0.5f, 0.5f); }));
+    report("gain ramp", time([&](long i) {
+        dsp::gain(vDst.data(), vSrc.data(), nFrames, nChannels, i & 1 ? 0.5f : 0.6f, i & 1 ? 0.6f : 0.5f);
+    }));
+    report("gain ramp s16", time([&](long i) {
+        dsp::gain(vDst16.data(), vSrc16.data(), nFrames, nChannels, i & 1 ? 0.5f : 0.6f, i & 1 ? 0.6f : 0.5f);
+    }));
+
+    /* every `process()` below is in place, the copy back in is part of what gets timed */
+    f64 copy = time([&](long) { memcpy(vDst.data(), vSrc.data(), n * sizeof(f32)); });
+    report("copy", copy);
+
+    eq::Equalizer eq;
+    eq.set(eq::design(defaults::eqPresets[std::size(defaults::eqPresets) - 1], sampleRate));
+    report("eq", time([&](long) {
+        memcpy(vDst.data(), vSrc.data(), n * sizeof(f32));
+        eq.process(vDst.data(), nFrames, nChannels);
+    }) - copy);
+
+    /* 6 dB over, so it actually limits */
+    limit::Limiter limiter;
+    limiter.setup(nChannels, sampleRate, nFrames);
+    report("limiter", time([&](long) {
+        dsp::gain(vDst.data(), vSrc.data(), nFrames, nChannels, 2.0f, 2.0f);
+        limiter.process(vDst.data(), nFrames);
+    }) - time([&](long) { dsp::gain(vDst.data(), vSrc.data(), nFrames, nChannels, 2.0f, 2.0f); }));
+
+    dither::Ditherer d;
+    report("s16 round", time([&](long) { d.quantize(vDst16.data(), vSrc.data(), nFrames, nChannels, dither::mode::off); }));
+    report("s16 tpdf", time([&](long) { d.quantize(vDst16.data(), vSrc.data(), nFrames, nChannels, dither::mode::tpdf); }));
+    report("s16 shaped", time([&](long) { d.quantize(vDst16.data(), vSrc.data(), nFrames, nChannels, dither::mode::shaped); }));
+    report("s24 tpdf", time([&](long) { d.quantize(vDst32.data(), vSrc.data(), nFrames, nChannels, dither::mode::tpdf, 24); }));
+
+    return 0;
+}
+
+} /* namespace bench */
@@ -0,0 +1,9 @@
+#pragma once
+
+namespace bench
+{
+
+/* `kmp --bench`, times the render path's kernels on quantum-sized synthetic buffers, no files or pipewire */
+int run();
+
+} /* namespace bench */
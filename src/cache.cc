@@ -0,0 +1,255 @@
+#include "cache.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+namespace cache
+{
+
+constexpr f32 f32Scale = 1 << 23; /* F32 as 24 bit fixed point */
+constexpr long headSize = 3; /* `Block::vHead` entries per channel */
+
+static void
+toInts(s32* pDst, const u8* pSrc, enum spa_audio_format eformat, long nSamples)
+{
+    switch (eformat)
+    {
+        case SPA_AUDIO_FORMAT_S16:
+            for (long i = 0; i < nSamples; i++)
+                pDst[i] = ((const s16*)pSrc)[i];
+            break;
+
+        case SPA_AUDIO_FORMAT_F32:
+            /* way past full scale, decoders overshoot a little at most */
+            for (long i = 0; i < nSamples; i++)
+                pDst[i] = std::lrintf(std::clamp(((const f32*)pSrc)[i] * f32Scale, -2147483648.0f, 2147483520.0f));
+            break;
+
+        default:
+            memcpy(pDst, pSrc, nSamples * sizeof(s32));
+            break;
+    }
+}
+
+static void
+fromInts(u8* pDst, const s32* pSrc, enum spa_audio_format eformat, long nSamples)
+{
+    switch (eformat)
+    {
+        case SPA_AUDIO_FORMAT_S16:
+            for (long i = 0; i < nSamples; i++)
+                ((s16*)pDst)[i] = pSrc[i];
+            break;
+
+        case SPA_AUDIO_FORMAT_F32:
+            for (long i = 0; i < nSamples; i++)
+                ((f32*)pDst)[i] = (f32)pSrc[i] * (1.0f / f32Scale);
+            break;
+
+        default:
+            memcpy(pDst, pSrc, nSamples * sizeof(s32));
+            break;
+    }
+}
+
+static inline u64
+zigzag(s64 r)
+{
+    return ((u64)r << 1) ^ (u64)(r >> 63);
+}
+
+static inline s64
+unzigzag(u64 z)
+{
+    return (s64)(z >> 1) ^ -(s64)(z & 1);
+}
+
+/* x[i] - 2x[i-1] + x[i-2], at most 35 bits after zigzag even for full range s32 */
+static inline s64
+residual(const s32* pX, long i, long stride)
+{
+    return (s64)pX[i*stride] - 2*(s64)pX[(i - 1)*stride] + (s64)pX[(i - 2)*stride];
+}
+
+static void
+pack(Block* pBlock, const s32* pSrc, long nFrames, long nChannels)
+{
+    pBlock->nFrames = nFrames;
+    pBlock->vHead.assign(nChannels * headSize, 0);
+    pBlock->vBits.clear();
+
+    u64 acc = 0;
+    int nAcc = 0;
+    auto put = [&](u64 v, int width) {
+        acc |= v << nAcc;
+        nAcc += width;
+        if (nAcc >= 64)
+        {
+            pBlock->vBits.push_back(acc);
+            nAcc -= 64;
+            acc = nAcc > 0 ? v >> (width - nAcc) : 0;
+        }
+    };
+
+    for (long c = 0; c < nChannels; c++)
+    {
+        const s32* pX = pSrc + c;
+        s32* pHead = &pBlock->vHead[c * headSize];
+        pHead[1] = nFrames > 0 ? pX[0] : 0;
+        pHead[2] = nFrames > 1 ? pX[nChannels] : 0;
+
+        u64 bits = 0;
+        for (long i = 2; i < nFrames; i++)
+            bits |= zigzag(residual(pX, i, nChannels));
+
+        const int width = std::bit_width(bits);
+        pHead[0] = width;
+        if (width == 0) continue; /* silence or a straight line */
+
+        for (long i = 2; i < nFrames; i++)
+            put(zigzag(residual(pX, i, nChannels)), width);
+    }
+
+    if (nAcc > 0) pBlock->vBits.push_back(acc);
+    pBlock->vBits.shrink_to_fit();
+}
+
+static void
+unpack(s32* pDst, const Block& block, long nChannels)
+{
+    const u64* pBits = block.vBits.data();
+    u64 bit = 0;
+    auto get = [&](int width) -> u64 {
+        u64 word = bit >> 6, off = bit & 63;
+        u64 v = pBits[word] >> off;
+        if (off + width > 64) v |= pBits[word + 1] << (64 - off);
+        bit += width;
+        return v & ((1ULL << width) - 1);
+    };
+
+    for (long c = 0; c < nChannels; c++)
+    {
+        const s32* pHead = &block.vHead[c * headSize];
+        const int width = pHead[0];
+        s64 x2 = pHead[1], x1 = pHead[2];
+
+        s32* pX = pDst + c;
+        if (block.nFrames > 0) pX[0] = x2;
+        if (block.nFrames > 1) pX[nChannels] = x1;
+
+        for (long i = 2; i < block.nFrames; i++)
+        {
+            s64 x = (width > 0 ? unzigzag(get(width)) : 0) + 2*x1 - x2;
+            pX[i * nChannels] = x;
+            x2 = x1;
+            x1 = x;
+        }
+    }
+}
+
+static size_t
+blockBytes(const Block& block)
+{
+    return sizeof(Block) + block.vBits.size() * sizeof(u64) + block.vHead.size() * sizeof(s32);
+}
+
+long
+Pcm::read(std::string_view path, s64 pos, enum spa_audio_format eformat, long nChannels, u8* pDst, long nFrames)
+{
+    if (m_capBytes == 0 || nFrames <= 0) return 0;
+
+    std::vector<s32> vInts;
+    std::lock_guard lock(m_mtx);
+
+    auto it = m_tracks.find(std::string(path));
+    const Block* pBlock = nullptr;
+    if (it != m_tracks.end() && it->second.eformat == eformat && it->second.nChannels == nChannels)
+    {
+        auto bit = it->second.blocks.find(pos / blockFrames);
+        if (bit != it->second.blocks.end() && pos % blockFrames < bit->second.nFrames)
+            pBlock = &bit->second;
+    }
+
+    if (!pBlock)
+    {
+        m_nMisses++;
+        return 0;
+    }
+
+    m_nHits++;
+    it->second.lastUse = ++m_useCount;
+
+    const long off = pos % blockFrames;
+    const long n = std::min(nFrames, pBlock->nFrames - off);
+    vInts.resize(pBlock->nFrames * nChannels);
+    unpack(vInts.data(), *pBlock, nChannels);
+    fromInts(pDst, &vInts[off * nChannels], eformat, n * nChannels);
+
+    return n;
+}
+
+void
+Pcm::store(std::string_view path, s64 pos, enum spa_audio_format eformat, long nChannels, const u8* pSrc, long nFrames, bool bLast)
+{
+    if (m_capBytes == 0 || nFrames <= 0 || pos % blockFrames != 0 || (nFrames != blockFrames && !bLast))
+        return;
+
+    /* packing is the slow part, outside the lock */
+    std::vector<s32> vInts(nFrames * nChannels);
+    toInts(vInts.data(), pSrc, eformat, nFrames * nChannels);
+    Block block;
+    pack(&block, vInts.data(), nFrames, nChannels);
+    const size_t size = blockBytes(block);
+
+    std::lock_guard lock(m_mtx);
+
+    Track& t = m_tracks[std::string(path)];
+    if (t.eformat != eformat || t.nChannels != nChannels)
+    {
+        m_nBytes -= t.nBytes;
+        t = {};
+        t.eformat = eformat;
+        t.nChannels = nChannels;
+    }
+    t.lastUse = ++m_useCount;
+
+    if (t.blocks.contains(pos / blockFrames) || !makeRoom(size, &t))
+        return;
+
+    t.blocks.emplace(pos / blockFrames, std::move(block));
+    t.nBytes += size;
+    m_nBytes += size;
+}
+
+bool
+Pcm::makeRoom(size_t nBytes, const Track* pKeep)
+{
+    while (m_nBytes + nBytes > m_capBytes)
+    {
+        auto lru = m_tracks.end();
+        for (auto it = m_tracks.begin(); it != m_tracks.end(); ++it)
+        {
+            if (&it->second != pKeep && (lru == m_tracks.end() || it->second.lastUse < lru->second.lastUse))
+                lru = it;
+        }
+
+        /* the track being played alone is over the cap, the rest of it doesn't get cached */
+        if (lru == m_tracks.end()) return false;
+
+        m_nBytes -= lru->second.nBytes;
+        m_tracks.erase(lru);
+    }
+
+    return true;
+}
+
+Stats
+Pcm::stats() const
+{
+    std::lock_guard lock(m_mtx);
+    return {m_nHits, m_nMisses, m_nBytes, m_capBytes};
+}
+
+} /* namespace cache */
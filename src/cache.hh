@@ -0,0 +1,70 @@
+#pragma once
+#include "ultratypes.h"
+
+#include <mutex>
+#include <spa/param/audio/format-utils.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace cache
+{
+
+constexpr long blockFrames = 4096; /* decoder reads stop at multiples of this, so every aligned one is a whole block */
+
+struct Stats
+{
+    u64 nHits = 0; /* reads served from memory */
+    u64 nMisses = 0;
+    size_t nBytes = 0;
+    size_t capBytes = 0;
+};
+
+/* `blockFrames` or fewer at the end of a file, packed */
+struct Block
+{
+    std::vector<u64> vBits {};
+    std::vector<s32> vHead {}; /* per channel: residual width, then the first two samples as they are */
+    long nFrames = 0;
+};
+
+/* Decoded pcm of recently played tracks, so previous track, repeat and seeking back skip the decoder.
+ * Blocks are packed losslessly: second order fixed prediction like flac's, residual bit-packed per channel.
+ * F32 goes in as 24 bit fixed point with headroom, exact for anything decoded from integer pcm,
+ * off by less than -140 dBFS for lossy decoders' output.
+ * Least recently used tracks go first once over `capBytes`.
+ * NOTE: decoder and preload threads, one lock. */
+class Pcm
+{
+    struct Track
+    {
+        enum spa_audio_format eformat = SPA_AUDIO_FORMAT_UNKNOWN;
+        long nChannels = 0;
+        std::unordered_map<s64, Block> blocks {}; /* by position / `blockFrames` */
+        size_t nBytes = 0;
+        u64 lastUse = 0;
+    };
+
+    std::unordered_map<std::string, Track> m_tracks {};
+    size_t m_capBytes = 0;
+    size_t m_nBytes = 0;
+    u64 m_useCount = 0;
+    u64 m_nHits = 0;
+    u64 m_nMisses = 0;
+    mutable std::mutex m_mtx {}; /* everything above */
+
+    /* NOTE: call locked, everything but `keep` goes until `nBytes` more fit */
+    bool makeRoom(size_t nBytes, const Track* pKeep);
+
+public:
+    Pcm(size_t capBytes) : m_capBytes(capBytes) {}
+
+    /* up to `nFrames` from `pos` in `eformat` samples, not past the end of its block, 0 if it isn't in */
+    long read(std::string_view path, s64 pos, enum spa_audio_format eformat, long nChannels, u8* pDst, long nFrames);
+    /* kept when it's a whole block, `bLast` if it runs to the end of the file */
+    void store(std::string_view path, s64 pos, enum spa_audio_format eformat, long nChannels, const u8* pSrc, long nFrames, bool bLast);
+    Stats stats() const;
+};
+
+} /* namespace cache */
@@ -0,0 +1,40 @@
+#include "chain.hh"
+#include "timing.hh"
+
+namespace chain
+{
+
+std::unique_ptr<convolve::Convolver>
+Chain::setConvolver(std::unique_ptr<convolve::Convolver> pConv)
+{
+    std::swap(m_pConv, pConv);
+    m_bConvolving = false;
+    return pConv;
+}
+
+void
+Chain::process(f32* pData, long nFrames, long nChannels, u32 sampleRate)
+{
+    m_eq.process(pData, nFrames, nChannels);
+
+    if (m_pConv && m_bConvolve && m_pConv->nChannels() == nChannels)
+    {
+        if (!m_bConvolving) m_pConv->reset();
+        m_bConvolving = true;
+
+        s64 start = timing::nowNs();
+        m_pConv->process(pData, nFrames);
+        f64 played = (f64)nFrames * 1e9 / (f64)sampleRate;
+        f32 load = (f64)(timing::nowNs() - start) / played / (f64)nChannels;
+        m_convLoad.store(m_convLoad.load(std::memory_order_relaxed) * 0.95f + load * 0.05f, std::memory_order_relaxed);
+    }
+}
+
+void
+Chain::reset()
+{
+    m_eq.reset();
+    if (m_pConv) m_pConv->reset();
+}
+
+} /* namespace chain */
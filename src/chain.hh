@@ -0,0 +1,44 @@
+#pragma once
+#include "convolve.hh"
+#include "eq.hh"
+
+#include <atomic>
+#include <memory>
+
+namespace chain
+{
+
+/* Float stages between decoded (and resampled) audio and the sink format, in the order they run.
+ * `play::render()` only converts integer formats to float and back while something here is on. */
+class Chain
+{
+    std::unique_ptr<convolve::Convolver> m_pConv {};
+    bool m_bConvolve = false;
+    bool m_bConvolving = false; /* convolver has state from the last buffer, otherwise it starts from silence */
+    std::atomic<f32> m_convLoad = 0.0f; /* fraction of a core per channel, smoothed */
+
+public:
+    eq::Equalizer m_eq {};
+
+    /* NOTE: audio thread only */
+    bool active() const { return m_eq.active() || (m_pConv && m_bConvolve); }
+    /* NOTE: audio thread only, output frames that haven't come out for what went in */
+    long latency() const { return m_bConvolving ? m_pConv->latency() : 0; }
+
+    /* NOTE: sink has to be locked, returns the previous one to free after unlocking */
+    std::unique_ptr<convolve::Convolver> setConvolver(std::unique_ptr<convolve::Convolver> pConv);
+    /* NOTE: sink has to be locked */
+    void setConvolve(bool bOn) { m_bConvolve = bOn; m_bConvolving = false; }
+    /* NOTE: player thread only */
+    const convolve::Convolver* convolver() const { return m_pConv.get(); }
+    bool convolve() const { return m_bConvolve; }
+    /* any thread */
+    f32 convolverLoad() const { return m_convLoad.load(std::memory_order_relaxed); }
+
+    /* NOTE: audio thread only */
+    void process(f32* pData, long nFrames, long nChannels, u32 sampleRate);
+    /* NOTE: audio thread only, after a flush there is nothing to ring on from */
+    void reset();
+};
+
+} /* namespace chain */
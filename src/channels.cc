@@ -0,0 +1,289 @@
+#include "channels.hh"
+#include "defaults.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace channels
+{
+
+constexpr f32 minus3dB = 0.70710678f;
+
+bool
+Layout::operator==(const Layout& other) const
+{
+    return nChannels == other.nChannels &&
+        std::equal(aPositions, aPositions + nChannels, other.aPositions);
+}
+
+static u32
+sfToSpa(int sfPos)
+{
+    switch (sfPos)
+    {
+        case SF_CHANNEL_MAP_MONO: return SPA_AUDIO_CHANNEL_MONO;
+        case SF_CHANNEL_MAP_LEFT:
+        case SF_CHANNEL_MAP_FRONT_LEFT: return SPA_AUDIO_CHANNEL_FL;
+        case SF_CHANNEL_MAP_RIGHT:
+        case SF_CHANNEL_MAP_FRONT_RIGHT: return SPA_AUDIO_CHANNEL_FR;
+        case SF_CHANNEL_MAP_CENTER:
+        case SF_CHANNEL_MAP_FRONT_CENTER: return SPA_AUDIO_CHANNEL_FC;
+        case SF_CHANNEL_MAP_REAR_CENTER: return SPA_AUDIO_CHANNEL_RC;
+        case SF_CHANNEL_MAP_REAR_LEFT: return SPA_AUDIO_CHANNEL_RL;
+        case SF_CHANNEL_MAP_REAR_RIGHT: return SPA_AUDIO_CHANNEL_RR;
+        case SF_CHANNEL_MAP_LFE: return SPA_AUDIO_CHANNEL_LFE;
+        case SF_CHANNEL_MAP_FRONT_LEFT_OF_CENTER: return SPA_AUDIO_CHANNEL_FLC;
+        case SF_CHANNEL_MAP_FRONT_RIGHT_OF_CENTER: return SPA_AUDIO_CHANNEL_FRC;
+        case SF_CHANNEL_MAP_SIDE_LEFT: return SPA_AUDIO_CHANNEL_SL;
+        case SF_CHANNEL_MAP_SIDE_RIGHT: return SPA_AUDIO_CHANNEL_SR;
+        case SF_CHANNEL_MAP_TOP_CENTER: return SPA_AUDIO_CHANNEL_TC;
+        case SF_CHANNEL_MAP_TOP_FRONT_LEFT: return SPA_AUDIO_CHANNEL_TFL;
+        case SF_CHANNEL_MAP_TOP_FRONT_RIGHT: return SPA_AUDIO_CHANNEL_TFR;
+        case SF_CHANNEL_MAP_TOP_FRONT_CENTER: return SPA_AUDIO_CHANNEL_TFC;
+        case SF_CHANNEL_MAP_TOP_REAR_LEFT: return SPA_AUDIO_CHANNEL_TRL;
+        case SF_CHANNEL_MAP_TOP_REAR_RIGHT: return SPA_AUDIO_CHANNEL_TRR;
+        case SF_CHANNEL_MAP_TOP_REAR_CENTER: return SPA_AUDIO_CHANNEL_TRC;
+        default: return SPA_AUDIO_CHANNEL_UNKNOWN;
+    }
+}
+
+/* https://xiph.org/vorbis/doc/Vorbis_I_spec.html#x1-810004.3.9 */
+static void
+vorbisOrder(Layout* l)
+{
+    constexpr u32 FL = SPA_AUDIO_CHANNEL_FL, FR = SPA_AUDIO_CHANNEL_FR, FC = SPA_AUDIO_CHANNEL_FC,
+              LFE = SPA_AUDIO_CHANNEL_LFE, SL = SPA_AUDIO_CHANNEL_SL, SR = SPA_AUDIO_CHANNEL_SR,
+              RL = SPA_AUDIO_CHANNEL_RL, RR = SPA_AUDIO_CHANNEL_RR, RC = SPA_AUDIO_CHANNEL_RC;
+
+    static const std::vector<u32> orders[] {
+        {},
+        {SPA_AUDIO_CHANNEL_MONO},
+        {FL, FR},
+        {FL, FC, FR},
+        {FL, FR, RL, RR},
+        {FL, FC, FR, RL, RR},
+        {FL, FC, FR, RL, RR, LFE},
+        {FL, FC, FR, SL, SR, RC, LFE},
+        {FL, FC, FR, SL, SR, RL, RR, LFE},
+    };
+
+    if (l->nChannels < std::size(orders))
+        std::copy(orders[l->nChannels].begin(), orders[l->nChannels].end(), l->aPositions);
+}
+
+/* WAVEFORMATEXTENSIBLE default mask order, also used by flac */
+static void
+waveOrder(Layout* l)
+{
+    constexpr u32 FL = SPA_AUDIO_CHANNEL_FL, FR = SPA_AUDIO_CHANNEL_FR, FC = SPA_AUDIO_CHANNEL_FC,
+              LFE = SPA_AUDIO_CHANNEL_LFE, SL = SPA_AUDIO_CHANNEL_SL, SR = SPA_AUDIO_CHANNEL_SR,
+              RL = SPA_AUDIO_CHANNEL_RL, RR = SPA_AUDIO_CHANNEL_RR, RC = SPA_AUDIO_CHANNEL_RC;
+
+    static const std::vector<u32> orders[] {
+        {},
+        {SPA_AUDIO_CHANNEL_MONO},
+        {FL, FR},
+        {FL, FR, FC},
+        {FL, FR, RL, RR},
+        {FL, FR, FC, RL, RR},
+        {FL, FR, FC, LFE, RL, RR},
+        {FL, FR, FC, LFE, RC, SL, SR},
+        {FL, FR, FC, LFE, RL, RR, SL, SR},
+    };
+
+    if (l->nChannels < std::size(orders))
+        std::copy(orders[l->nChannels].begin(), orders[l->nChannels].end(), l->aPositions);
+}
+
+Layout
+fileLayout(SndfileHandle& h)
+{
+    Layout l {};
+    l.nChannels = std::min((u32)h.channels(), SPA_AUDIO_MAX_CHANNELS);
+
+    int aMap[SPA_AUDIO_MAX_CHANNELS] {};
+    if (h.command(SFC_GET_CHANNEL_MAP_INFO, aMap, l.nChannels * sizeof(*aMap)) == SF_TRUE)
+    {
+        for (u32 i = 0; i < l.nChannels; i++)
+            l.aPositions[i] = sfToSpa(aMap[i]);
+    }
+    else
+    {
+        int sub = h.format() & SF_FORMAT_SUBMASK;
+        if (sub == SF_FORMAT_VORBIS || sub == SF_FORMAT_OPUS)
+            vorbisOrder(&l);
+        else
+            waveOrder(&l);
+    }
+
+    return l;
+}
+
+Layout
+outputLayout(const Layout& in)
+{
+    if (defaults::outputChannels == 0)
+        return in;
+
+    /* no standard order for more than 8, those stay unpositioned */
+    Layout out {};
+    out.nChannels = std::min(defaults::outputChannels, SPA_AUDIO_MAX_CHANNELS);
+    waveOrder(&out);
+
+    return out;
+}
+
+static long
+find(const Layout& l, u32 pos)
+{
+    for (u32 i = 0; i < l.nChannels; i++)
+        if (l.aPositions[i] == pos) return i;
+
+    return -1;
+}
+
+void
+Matrix::build(const Layout& in, const Layout& out)
+{
+    m_nIn = in.nChannels;
+    m_nOut = out.nChannels;
+    m_bIdentity = in == out;
+    m_aCoeffs.assign(m_nIn * m_nOut, 0.0f);
+
+    if (m_bIdentity) return;
+
+    auto add = [&](u32 outPos, long i, f32 c) -> bool {
+        long o = find(out, outPos);
+        if (o < 0) return false;
+        m_aCoeffs[o*m_nIn + i] += c;
+        return true;
+    };
+
+    /* only if there are both */
+    auto addPair = [&](u32 l, u32 r, long i, f32 c) -> bool {
+        if (find(out, l) < 0 || find(out, r) < 0) return false;
+        return add(l, i, c) && add(r, i, c);
+    };
+
+    /* left or right, falling back to center or mono */
+    auto addSide = [&](u32 pos, bool bLeft, long i, f32 c) -> bool {
+        u32 front = bLeft ? SPA_AUDIO_CHANNEL_FL : SPA_AUDIO_CHANNEL_FR;
+        return add(pos, i, c) || add(front, i, c) ||
+            add(SPA_AUDIO_CHANNEL_FC, i, c*minus3dB) || add(SPA_AUDIO_CHANNEL_MONO, i, c*minus3dB);
+    };
+
+    for (long i = 0; i < m_nIn; i++)
+    {
+        u32 p = in.aPositions[i];
+
+        if (p != SPA_AUDIO_CHANNEL_UNKNOWN && add(p, i, 1.0f))
+            continue;
+
+        switch (p)
+        {
+            /* upmix */
+            case SPA_AUDIO_CHANNEL_MONO:
+                addPair(SPA_AUDIO_CHANNEL_FL, SPA_AUDIO_CHANNEL_FR, i, 1.0f) || add(SPA_AUDIO_CHANNEL_FC, i, 1.0f);
+                break;
+
+            /* ITU-R BS.775 downmix */
+            case SPA_AUDIO_CHANNEL_FL:
+            case SPA_AUDIO_CHANNEL_FLC:
+                addSide(SPA_AUDIO_CHANNEL_FL, true, i, 1.0f);
+                break;
+
+            case SPA_AUDIO_CHANNEL_FR:
+            case SPA_AUDIO_CHANNEL_FRC:
+                addSide(SPA_AUDIO_CHANNEL_FR, false, i, 1.0f);
+                break;
+
+            case SPA_AUDIO_CHANNEL_FC:
+            case SPA_AUDIO_CHANNEL_TC:
+            case SPA_AUDIO_CHANNEL_TFC:
+                addPair(SPA_AUDIO_CHANNEL_FL, SPA_AUDIO_CHANNEL_FR, i, minus3dB) || add(SPA_AUDIO_CHANNEL_MONO, i, 1.0f);
+                break;
+
+            case SPA_AUDIO_CHANNEL_SL:
+                add(SPA_AUDIO_CHANNEL_RL, i, 1.0f) || addSide(SPA_AUDIO_CHANNEL_FL, true, i, minus3dB);
+                break;
+
+            case SPA_AUDIO_CHANNEL_SR:
+                add(SPA_AUDIO_CHANNEL_RR, i, 1.0f) || addSide(SPA_AUDIO_CHANNEL_FR, false, i, minus3dB);
+                break;
+
+            case SPA_AUDIO_CHANNEL_RL:
+            case SPA_AUDIO_CHANNEL_TFL:
+            case SPA_AUDIO_CHANNEL_TRL:
+                add(SPA_AUDIO_CHANNEL_SL, i, 1.0f) || addSide(SPA_AUDIO_CHANNEL_FL, true, i, minus3dB);
+                break;
+
+            case SPA_AUDIO_CHANNEL_RR:
+            case SPA_AUDIO_CHANNEL_TFR:
+            case SPA_AUDIO_CHANNEL_TRR:
+                add(SPA_AUDIO_CHANNEL_SR, i, 1.0f) || addSide(SPA_AUDIO_CHANNEL_FR, false, i, minus3dB);
+                break;
+
+            case SPA_AUDIO_CHANNEL_RC:
+            case SPA_AUDIO_CHANNEL_TRC:
+                addPair(SPA_AUDIO_CHANNEL_RL, SPA_AUDIO_CHANNEL_RR, i, minus3dB) ||
+                    addPair(SPA_AUDIO_CHANNEL_SL, SPA_AUDIO_CHANNEL_SR, i, minus3dB) ||
+                    addPair(SPA_AUDIO_CHANNEL_FL, SPA_AUDIO_CHANNEL_FR, i, 0.5f) ||
+                    add(SPA_AUDIO_CHANNEL_FC, i, minus3dB) || add(SPA_AUDIO_CHANNEL_MONO, i, minus3dB);
+                break;
+
+            case SPA_AUDIO_CHANNEL_LFE:
+                addPair(SPA_AUDIO_CHANNEL_FL, SPA_AUDIO_CHANNEL_FR, i, defaults::lfeDownmix) ||
+                    add(SPA_AUDIO_CHANNEL_MONO, i, defaults::lfeDownmix);
+                break;
+
+            /* unpositioned, keep it at the same index */
+            default:
+                if (i < m_nOut) m_aCoeffs[i*m_nIn + i] = 1.0f;
+                break;
+        }
+    }
+
+    if (defaults::bNormalizeDownmix)
+    {
+        /* loudest output can't go over the loudest input */
+        f32 maxSum = 0.0f;
+        for (long o = 0; o < m_nOut; o++)
+        {
+            f32 sum = 0.0f;
+            for (long i = 0; i < m_nIn; i++)
+                sum += std::fabs(m_aCoeffs[o*m_nIn + i]);
+            maxSum = std::max(maxSum, sum);
+        }
+
+        if (maxSum > 1.0f)
+            for (auto& c : m_aCoeffs) c /= maxSum;
+    }
+}
+
+void
+Matrix::apply(f32* pDst, const f32* pSrc, long nFrames) const
+{
+    if (m_bIdentity)
+    {
+        memcpy(pDst, pSrc, nFrames * m_nIn * sizeof(f32));
+        return;
+    }
+
+    for (long f = 0; f < nFrames; f++)
+    {
+        const f32* in = pSrc + f*m_nIn;
+        f32* out = pDst + f*m_nOut;
+
+        for (long o = 0; o < m_nOut; o++)
+        {
+            const f32* row = &m_aCoeffs[o*m_nIn];
+            f32 acc = 0.0f;
+            for (long i = 0; i < m_nIn; i++)
+                acc += row[i] * in[i];
+            out[o] = acc;
+        }
+    }
+}
+
+} /* namespace channels */
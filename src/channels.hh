@@ -0,0 +1,40 @@
+#pragma once
+#include "ultratypes.h"
+
+#include <sndfile.hh>
+#include <spa/param/audio/format-utils.h>
+#include <vector>
+
+namespace channels
+{
+
+struct Layout
+{
+    u32 nChannels = 0;
+    u32 aPositions[SPA_AUDIO_MAX_CHANNELS] {}; /* SPA_AUDIO_CHANNEL_* */
+
+    bool operator==(const Layout& other) const;
+};
+
+/* channel positions of the opened file, from its channel map if it has one */
+Layout fileLayout(SndfileHandle& h);
+/* what gets negotiated with pipewire for `in`, see `defaults::outputChannels` */
+Layout outputLayout(const Layout& in);
+
+/* downmix/upmix matrix from one layout to another */
+class Matrix
+{
+    std::vector<f32> m_aCoeffs {}; /* `m_nOut` rows by `m_nIn` columns */
+    long m_nIn = 0;
+    long m_nOut = 0;
+    bool m_bIdentity = true;
+
+public:
+    void build(const Layout& in, const Layout& out);
+    /* same layouts, `apply()` would be a plain copy */
+    bool isIdentity() const { return m_bIdentity; }
+    /* `pDst` has room for `nFrames` in output layout */
+    void apply(f32* pDst, const f32* pSrc, long nFrames) const;
+};
+
+} /* namespace channels */
@@ -0,0 +1,187 @@
+#include "convolve.hh"
+#include "dsp.hh"
+#include "resample.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sndfile.hh>
+
+namespace convolve
+{
+
+constexpr long resampleChunk = 4096; /* frames per `Resampler::process()` when converting the response */
+
+bool
+load(std::string_view path, Response* pResponse)
+{
+    SndfileHandle h(std::string(path).data(), SFM_READ);
+    if (h.error() || h.channels() <= 0 || h.frames() <= 0) return false;
+
+    pResponse->path = path;
+    pResponse->nChannels = h.channels();
+    pResponse->sampleRate = h.samplerate();
+    pResponse->vData.resize(h.frames() * h.channels());
+    pResponse->nFrames = h.readf(pResponse->vData.data(), h.frames());
+    pResponse->vData.resize(pResponse->nFrames * pResponse->nChannels);
+
+    return pResponse->nFrames > 0;
+}
+
+/* response at `sampleRate`, interleaved */
+static std::vector<f32>
+atRate(const Response& r, u32 sampleRate)
+{
+    if (r.sampleRate == sampleRate) return r.vData;
+
+    const f64 ratio = (f64)r.sampleRate / (f64)sampleRate;
+    const long ch = r.nChannels;
+    const long nOut = std::ceil(r.nFrames / ratio);
+
+    resample::Resampler rs;
+    rs.setup(ch, resampleChunk);
+    resample::Filter filter(resample::quality::best, ratio);
+    rs.setFilter(&filter);
+    rs.setRatio(ratio);
+    rs.reset();
+
+    std::vector<f32> vOut(nOut * ch);
+    std::vector<f32> vZeros(rs.capacity() * ch);
+    long made = 0, fed = 0;
+
+    while (made < nOut)
+    {
+        long want = std::min(resampleChunk, nOut - made);
+        long need = std::min(rs.inputNeeded(want), rs.room());
+        long nReal = std::clamp(r.nFrames - fed, 0L, need);
+
+        /* silence after the end lets the filter run out */
+        rs.push(&r.vData[fed * ch], nReal);
+        rs.push(vZeros.data(), need - nReal);
+        fed += nReal;
+
+        long got = rs.process(&vOut[made * ch], want);
+        if (got == 0) break;
+        made += got;
+    }
+
+    /* fewer samples per second each carry more of the response's area */
+    for (f32& s : vOut)
+        s *= ratio;
+
+    return vOut;
+}
+
+Convolver::Convolver(const Response& r, u32 deviceRate, long nChannels, long block)
+    : m_block(block), m_nChannels(nChannels), m_sampleRate(deviceRate)
+{
+    std::vector<f32> vIr = atRate(r, deviceRate);
+    m_nTaps = vIr.size() / r.nChannels;
+    m_nPartitions = std::max((m_nTaps + m_block - 1) / m_block, 1L);
+
+    m_fft.setup(2 * m_block);
+    m_nBins = m_fft.nBins();
+
+    const long nSpectra = m_nChannels * m_nPartitions * m_nBins;
+    m_vHRe.assign(nSpectra, 0.0f);
+    m_vHIm.assign(nSpectra, 0.0f);
+    m_vFdlRe.assign(nSpectra, 0.0f);
+    m_vFdlIm.assign(nSpectra, 0.0f);
+    m_vIn.assign(m_nChannels * 2 * m_block, 0.0f);
+    m_vOut.assign(m_nChannels * m_block, 0.0f);
+    m_vAccRe.resize(m_nBins);
+    m_vAccIm.resize(m_nBins);
+    m_vTime.resize(2 * m_block);
+
+    /* unscaled inverse comes out `m_block` times too loud */
+    const f32 scale = 1.0f / (f32)m_block;
+
+    for (long c = 0; c < m_nChannels; c++)
+    {
+        const long rc = c % r.nChannels;
+        for (long p = 0; p < m_nPartitions; p++)
+        {
+            /* partition in the first half, zeros in the second */
+            std::fill(m_vTime.begin(), m_vTime.end(), 0.0f);
+            for (long i = 0; i < m_block && p*m_block + i < m_nTaps; i++)
+                m_vTime[i] = vIr[(p*m_block + i) * r.nChannels + rc] * scale;
+
+            const long off = (c*m_nPartitions + p) * m_nBins;
+            m_fft.forward(m_vTime.data(), &m_vHRe[off], &m_vHIm[off]);
+        }
+    }
+}
+
+void
+Convolver::runBlock()
+{
+    for (long c = 0; c < m_nChannels; c++)
+    {
+        f32* pIn = &m_vIn[c * 2 * m_block];
+        const long base = c * m_nPartitions * m_nBins;
+
+        m_fft.forward(pIn, &m_vFdlRe[base + m_fdlPos*m_nBins], &m_vFdlIm[base + m_fdlPos*m_nBins]);
+
+        /* newest input against the first partition, older ones against later ones */
+        std::fill(m_vAccRe.begin(), m_vAccRe.end(), 0.0f);
+        std::fill(m_vAccIm.begin(), m_vAccIm.end(), 0.0f);
+        for (long p = 0; p < m_nPartitions; p++)
+        {
+            const long slot = (m_fdlPos - p + m_nPartitions) % m_nPartitions;
+            dsp::cmac(m_vAccRe.data(), m_vAccIm.data(),
+                      &m_vFdlRe[base + slot*m_nBins], &m_vFdlIm[base + slot*m_nBins],
+                      &m_vHRe[base + p*m_nBins], &m_vHIm[base + p*m_nBins], m_nBins);
+        }
+
+        /* first half wrapped around, second half is this block */
+        m_fft.inverse(m_vAccRe.data(), m_vAccIm.data(), m_vTime.data());
+        memcpy(&m_vOut[c * m_block], &m_vTime[m_block], m_block * sizeof(f32));
+        memcpy(pIn, pIn + m_block, m_block * sizeof(f32));
+    }
+
+    m_fdlPos = (m_fdlPos + 1) % m_nPartitions;
+}
+
+void
+Convolver::process(f32* pData, long nFrames)
+{
+    const long ch = m_nChannels;
+
+    long i = 0;
+    while (i < nFrames)
+    {
+        /* block in, previous block's result out */
+        long n = std::min(nFrames - i, m_block - m_fill);
+        for (long c = 0; c < ch; c++)
+        {
+            f32* pIn = &m_vIn[c * 2 * m_block + m_block + m_fill];
+            const f32* pOut = &m_vOut[c * m_block + m_fill];
+            for (long k = 0; k < n; k++)
+            {
+                pIn[k] = pData[(i + k)*ch + c];
+                pData[(i + k)*ch + c] = pOut[k];
+            }
+        }
+
+        m_fill += n;
+        i += n;
+
+        if (m_fill == m_block)
+        {
+            runBlock();
+            m_fill = 0;
+        }
+    }
+}
+
+void
+Convolver::reset()
+{
+    std::fill(m_vFdlRe.begin(), m_vFdlRe.end(), 0.0f);
+    std::fill(m_vFdlIm.begin(), m_vFdlIm.end(), 0.0f);
+    std::fill(m_vIn.begin(), m_vIn.end(), 0.0f);
+    std::fill(m_vOut.begin(), m_vOut.end(), 0.0f);
+    m_fill = 0;
+}
+
+} /* namespace convolve */
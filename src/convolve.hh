@@ -0,0 +1,65 @@
+#pragma once
+#include "fft.hh"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace convolve
+{
+
+/* impulse response as loaded, interleaved */
+struct Response
+{
+    std::string path {};
+    std::vector<f32> vData {};
+    long nChannels = 0;
+    long nFrames = 0;
+    u32 sampleRate = 0;
+};
+
+/* whole file through libsndfile, false if it can't be read */
+bool load(std::string_view path, Response* pResponse);
+
+/* Uniformly partitioned overlap-save convolution, one partition per `block` frames of latency.
+ * Built off the audio thread for one device rate and channel count, the response gets resampled to it.
+ * Response channels go round-robin over output channels, so a mono one applies to all of them. */
+class Convolver
+{
+    fft::Real m_fft {};
+    long m_block = 0;
+    long m_nChannels = 0;
+    u32 m_sampleRate = 0;
+    long m_nPartitions = 0;
+    long m_nBins = 0;
+    long m_nTaps = 0; /* at device rate */
+    std::vector<f32> m_vHRe {}; /* channel, partition, bin; scaled so the inverse comes out right */
+    std::vector<f32> m_vHIm {};
+    std::vector<f32> m_vFdlRe {}; /* same layout, input spectra, `m_fdlPos` is the newest */
+    std::vector<f32> m_vFdlIm {};
+    long m_fdlPos = 0;
+    std::vector<f32> m_vIn {}; /* channel, last two blocks of input */
+    std::vector<f32> m_vOut {}; /* channel, last block of output */
+    long m_fill = 0; /* frames into the current block */
+    std::vector<f32> m_vAccRe {};
+    std::vector<f32> m_vAccIm {};
+    std::vector<f32> m_vTime {};
+
+    void runBlock();
+
+public:
+    Convolver(const Response& r, u32 deviceRate, long nChannels, long block);
+
+    long nTaps() const { return m_nTaps; }
+    long block() const { return m_block; }
+    long nChannels() const { return m_nChannels; }
+    u32 sampleRate() const { return m_sampleRate; }
+    /* output frames come this much after their input */
+    long latency() const { return m_block; }
+
+    /* NOTE: audio thread only, `nChannels` has to match */
+    void process(f32* pData, long nFrames);
+    void reset();
+};
+
+} /* namespace convolve */
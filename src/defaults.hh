@@ -1,6 +1,10 @@
 #pragma once
 #include "color.hh"
+#include "dither.hh"
+#include "eq.hh"
+#include "loudness.hh"
 #include "ultratypes.h"
+#include "vio.hh"
 
 namespace defaults
 {
@@ -10,14 +14,103 @@ constexpr f64 minVolume   = 0.0;
 constexpr f32 volume      = 0.15; /* volume at startup */
 constexpr f64 volumePower = 3.0; /* affects volume curve aka 'std::pow(volume, volumePower)' */
 
-constexpr long maxSampleRate = 666666; /* can be stupid big */
+constexpr bool bLimiter          = true; /* look-ahead true peak limiter after volume, so going over 100% doesn't clip */
+constexpr f32 limiterCeilingDb   = -1.0f; /* dBTP */
+constexpr f32 limiterReleaseMs   = 100.0f;
+constexpr f32 limiterLookaheadMs = 2.0f; /* adds this much latency */
+
+constexpr loudness::mode replayGain = loudness::mode::off; /* off, track or album (same directory), see `--replaygain`, anything but off scans the whole playlist */
+constexpr f32 replayGainPreamp      = 0.0f; /* dB on top of replaygain */
+constexpr bool bReplayGainNoClip    = true; /* lower the gain so the peak stays under full scale */
+constexpr long loudnessScanThreads  = 0; /* files scanned at once for loudness, 0 uses every core */
+
+constexpr long maxSampleRate = 666666; /* can be stupid big, resampler caps it at 8x the output rate anyway */
 constexpr long minSampleRate = 1000; /* should be > 0 */
+constexpr u32 outputSampleRate = 0; /* resample everything to this, 0 follows the file and renegotiates on track change */
+constexpr int resampleQuality = 1; /* 0 fast, 1 medium or 2 best, 16, 32 or 64 taps */
+constexpr bool bPreservePitch = false; /* change speed with time-stretch instead of resampling, toggled with 'p' */
+constexpr long stretchWindowMs = 30; /* time-stretch segment length, shorter suits speech, longer suits music */
+constexpr long stretchSearchMs = 8; /* how far a segment can move to line up with the previous one */
 
 constexpr f64 step            = 5.0; /* seek step (in seconds) */
 constexpr u32 updateRate      = 200; /* time (ms) between input polls (affects visualizer updates for now) */
 constexpr u32 timeOut         = 5000; /* time (ms) to cancel input */
 constexpr bool bWrapSelection = true; /* jump to first after scrolling past the last element in the list */
 
+constexpr long ringBufferMs = 300; /* how much decoded audio to keep ahead of playback */
+constexpr u32 decoderSleep  = 5; /* time (ms) decoder thread sleeps when ring buffer is full enough */
+
+constexpr vio::backend ioBackend = vio::backend::read; /* read, mmap (local disks) or uring (network filesystems), see `--io` */
+constexpr long ioBlockKiB        = 256; /* size of each uring read, mmap hints the same span */
+constexpr long ioQueueDepth      = 8; /* blocks kept in flight (uring) or hinted (mmap) ahead of decoding */
+
+constexpr size_t pcmCacheMiB = 256; /* decoded recent tracks for prev, repeat and seeking back, 0 turns it off */
+
+constexpr bool bSeekIndex = true; /* scan mp3s without a xing header once, for exact length and seek points */
+constexpr long seekPointFrames = 32; /* mp3 frames between seek points, about 0.8s at 44.1kHz */
+
+constexpr bool bPrefetch            = true; /* warm the page cache for the next tracks, selection and search hits */
+constexpr long prefetchTracks       = 3; /* upcoming tracks that get their first `prefetchHeadKiB` read ahead */
+constexpr long prefetchHeadKiB      = 1024;
+constexpr long prefetchBudgetMiB    = 64; /* page cache all of it may take up, whole files in playback order after the heads */
+constexpr long prefetchMaxBudgetMiB = 512;
+constexpr f64 prefetchLatencyMs     = 4.0; /* cold reads slower than this scale tracks and budget up with them, NFS is often 10x */
+constexpr long prefetchSettleMs     = 300; /* selection has to stay put this long before it gets read */
+
+constexpr u32 outputChannels     = 0; /* 0 keeps the file's layout, otherwise downmix/upmix everything to this many, 2 for stereo only sinks */
+constexpr bool bNormalizeDownmix = true; /* scale downmix so it can't clip */
+constexpr f32 lfeDownmix         = 0.0f; /* how much of LFE goes to front left/right when there is no LFE channel */
+
+/* any number of bands up to `eq::maxBands`, cycled with 'e' / 'E' or picked with `--eq=name` */
+constexpr eq::Band eqBass[] {
+    {eq::type::lowShelf, 105.0f, 6.0f, 0.7f},
+};
+constexpr eq::Band eqTreble[] {
+    {eq::type::highShelf, 8000.0f, 5.0f, 0.7f},
+};
+constexpr eq::Band eqVocal[] {
+    {eq::type::highPass, 80.0f, 0.0f, 0.7f},
+    {eq::type::peaking, 250.0f, -2.0f, 1.0f},
+    {eq::type::peaking, 3000.0f, 3.0f, 1.0f},
+};
+constexpr eq::Band eqSmiley[] {
+    {eq::type::peaking, 31.0f, 4.0f, 1.41f},
+    {eq::type::peaking, 62.0f, 3.0f, 1.41f},
+    {eq::type::peaking, 125.0f, 1.0f, 1.41f},
+    {eq::type::peaking, 250.0f, 0.0f, 1.41f},
+    {eq::type::peaking, 500.0f, -1.0f, 1.41f},
+    {eq::type::peaking, 1000.0f, -1.0f, 1.41f},
+    {eq::type::peaking, 2000.0f, 0.0f, 1.41f},
+    {eq::type::peaking, 4000.0f, 1.0f, 1.41f},
+    {eq::type::peaking, 8000.0f, 3.0f, 1.41f},
+    {eq::type::peaking, 16000.0f, 4.0f, 1.41f},
+};
+constexpr eq::Preset eqPresets[] {
+    {"Off", 0.0f, {}},
+    {"Bass", -6.0f, eqBass},
+    {"Treble", -5.0f, eqTreble},
+    {"Vocal", -3.0f, eqVocal},
+    {"Smiley", -4.0f, eqSmiley},
+};
+constexpr long eqPreset = 0; /* index into `eqPresets` at startup */
+
+constexpr const char* convolutionResponse = ""; /* impulse response wav for room correction, see `--convolve` */
+constexpr long convolutionBlock = 1024; /* partition size and latency in frames until the sink reports its quantum, then that */
+constexpr bool bConvolve = true; /* start with the response applied, toggled with 'c' */
+
+constexpr bool bBitPerfect = false; /* send s16/s24/s32 pcm untouched at 100% volume, needs outputChannels = 0 for multichannel */
+constexpr spa_audio_format outputFormat = SPA_AUDIO_FORMAT_F32; /* otherwise F32, S16 (half the bandwidth), S24_32 or S32 */
+constexpr dither::mode ditherS16 = dither::mode::tpdf; /* off, tpdf or shaped, whenever float gets requantized to S16 */
+constexpr dither::mode ditherS24 = dither::mode::tpdf;
+
+constexpr long nullSinkQuantum  = 1024; /* frames the null and wav sinks pull at once, see `--sink` */
+constexpr bool bNullSinkRealtime = true; /* pace null and wav sinks to the sample rate, otherwise run as fast as decoding goes */
+
+constexpr bool bGapless          = true; /* splice the next track right after the end of the current one */
+constexpr long gaplessPreloadSec = 5; /* open and pre-decode the next track this long before the end */
+constexpr f64 crossfadeSec       = 0.0; /* up to 12, fade automatic track changes into each other, see `--crossfade` */
+constexpr long skipFadeMs        = 250; /* same on next/prev/select instead of a hard cut, 0 cuts */
+
 constexpr bool bDrawVisualizer        = false;
 constexpr f32 visualizerScalar        = 9.0; /* scale the height of each bar */
 constexpr wchar_t visualizerSymbol[2] = L":";
@@ -0,0 +1,312 @@
+#include "dither.hh"
+#include "defaults.hh"
+#include "dsp.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define DITHER_X86
+    #include <immintrin.h>
+#endif
+
+namespace dither
+{
+
+/* Wannamaker's 3 tap F-weighted error filter, made for 44.1/48kHz */
+constexpr f32 aShape[3] {1.623f, -0.982f, 0.109f};
+
+mode
+forFormat(enum spa_audio_format eformat)
+{
+    switch (eformat)
+    {
+        case SPA_AUDIO_FORMAT_S16: return defaults::ditherS16;
+        case SPA_AUDIO_FORMAT_S24_32: return defaults::ditherS24;
+        default: return mode::off;
+    }
+}
+
+Ditherer::Ditherer()
+{
+    /* any nonzero seeds, different per lane */
+    m_aState[0] = 0x9e3779b9;
+    m_aState[1] = 0x7f4a7c15;
+    m_aState[2] = 0x85ebca6b;
+    m_aState[3] = 0xc2b2ae35;
+    m_aState[4] = 0x27d4eb2f;
+    m_aState[5] = 0x165667b1;
+    m_aState[6] = 0xd3a2646c;
+    m_aState[7] = 0xfd7046c5;
+    for (int i = 8; i < 16; i++)
+        m_aState[i] = m_aState[i - 8] ^ 0x5bd1e995;
+}
+
+void
+Ditherer::reset()
+{
+    memset(m_aErr, 0, sizeof(m_aErr));
+}
+
+static inline u32
+xorshift(u32* pState)
+{
+    u32 s = *pState;
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    return *pState = s;
+}
+
+/* two 16 bit uniforms summed, -1 to 1 LSB */
+static inline f32
+tpdf(u32 r)
+{
+    return (f32)((r & 0xffff) + (r >> 16)) * (1.0f / 65536.0f) - 1.0f;
+}
+
+/* to nearest, without going through libm */
+static inline s32
+toNearest(f32 x)
+{
+#ifdef DITHER_X86
+    return _mm_cvtss_si32(_mm_set_ss(x));
+#else
+    return std::lrint(x);
+#endif
+}
+
+/* error feedback runs along each channel, so this one stays scalar, a channel at a time with the errors in registers */
+template<typename T>
+static void
+shaped(T* pDst, const f32* pSrc, long nFrames, long nChannels, int nBits, f32 (*pErr)[3], u32* pState)
+{
+    const f32 scale = (f32)(1LL << (nBits - 1));
+    const f32 max = scale - 1.0f;
+    const f32 min = -scale;
+
+    for (long c = 0; c < nChannels; c++)
+    {
+        f32 e0 = pErr[c][0], e1 = pErr[c][1], e2 = pErr[c][2];
+        u32* pLane = &pState[c & 7];
+
+        for (long i = 0; i < nFrames; i++)
+        {
+            const f32 x = pSrc[i*nChannels + c];
+            if (x == 0.0f)
+            {
+                pDst[i*nChannels + c] = 0;
+                continue;
+            }
+
+            f32 v = x*scale - (aShape[0]*e0 + aShape[1]*e1 + aShape[2]*e2);
+            f32 q = std::clamp((f32)toNearest(v + tpdf(xorshift(pLane))), min, max);
+
+            /* clipped samples would wind the filter up */
+            e2 = e1;
+            e1 = e0;
+            e0 = std::clamp(q - v, -2.0f, 2.0f);
+
+            pDst[i*nChannels + c] = (T)q;
+        }
+
+        pErr[c][0] = e0;
+        pErr[c][1] = e1;
+        pErr[c][2] = e2;
+    }
+}
+
+template<typename T>
+static void
+flatScalar(T* pDst, const f32* pSrc, long n, int nBits, u32* pState)
+{
+    const f32 scale = (f32)(1LL << (nBits - 1));
+    const f32 max = scale - 1.0f;
+    const f32 min = -scale;
+
+    for (long i = 0; i < n; i++)
+    {
+        f32 q = std::clamp((f32)toNearest(pSrc[i]*scale + tpdf(xorshift(&pState[i & 7]))), min, max);
+        pDst[i] = pSrc[i] == 0.0f ? 0 : (T)q;
+    }
+}
+
+template<typename T>
+using FlatFn = void (*)(T* pDst, const f32* pSrc, long n, int nBits, u32* pState);
+
+struct FlatKernels
+{
+    FlatFn<s16> toS16;
+    FlatFn<s32> toS32;
+};
+
+#ifdef DITHER_X86
+
+template<typename T>
+static void
+flatSSE2(T* pDst, const f32* pSrc, long n, int nBits, u32* pState)
+{
+    const f32 scale = (f32)(1LL << (nBits - 1));
+    const __m128 vScale = _mm_set1_ps(scale);
+    const __m128 vMax = _mm_set1_ps(scale - 1.0f);
+    const __m128 vMin = _mm_set1_ps(-scale);
+    const __m128 vZero = _mm_setzero_ps();
+    const __m128i vLow = _mm_set1_epi32(0xffff);
+    const __m128 vUnit = _mm_set1_ps(1.0f / 65536.0f);
+    const __m128 vOne = _mm_set1_ps(1.0f);
+    /* two independent generators, so one's shifts don't wait on the other's */
+    __m128i aS[2] {_mm_loadu_si128((const __m128i*)pState), _mm_loadu_si128((const __m128i*)(pState + 4))};
+
+    long i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i aQ[2];
+        #pragma GCC unroll 2
+        for (int h = 0; h < 2; h++)
+        {
+            __m128i s = aS[h];
+            s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+            s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+            s = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+            aS[h] = s;
+            __m128i sum = _mm_add_epi32(_mm_and_si128(s, vLow), _mm_srli_epi32(s, 16));
+            __m128 d = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), vUnit), vOne);
+
+            __m128 x = _mm_loadu_ps(pSrc + i + h*4);
+            __m128 v = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(x, vScale), d), vMin), vMax);
+            /* rounds to nearest, same as `toNearest()` */
+            __m128i q = _mm_cvtps_epi32(v);
+            aQ[h] = _mm_andnot_si128(_mm_castps_si128(_mm_cmpeq_ps(x, vZero)), q);
+        }
+
+        if constexpr (sizeof(T) == sizeof(s16))
+        {
+            _mm_storeu_si128((__m128i*)(pDst + i), _mm_packs_epi32(aQ[0], aQ[1]));
+        }
+        else
+        {
+            _mm_storeu_si128((__m128i*)(pDst + i), aQ[0]);
+            _mm_storeu_si128((__m128i*)(pDst + i + 4), aQ[1]);
+        }
+    }
+
+    _mm_storeu_si128((__m128i*)pState, aS[0]);
+    _mm_storeu_si128((__m128i*)(pState + 4), aS[1]);
+    flatScalar(pDst + i, pSrc + i, n - i, nBits, pState);
+}
+
+/* same with all sixteen generators, two vectors of eight */
+template<typename T>
+__attribute__((target("avx2"))) static void
+flatAVX2(T* pDst, const f32* pSrc, long n, int nBits, u32* pState)
+{
+    const f32 scale = (f32)(1LL << (nBits - 1));
+    const __m256 vScale = _mm256_set1_ps(scale);
+    const __m256 vMax = _mm256_set1_ps(scale - 1.0f);
+    const __m256 vMin = _mm256_set1_ps(-scale);
+    const __m256 vZero = _mm256_setzero_ps();
+    const __m256i vLow = _mm256_set1_epi32(0xffff);
+    const __m256 vUnit = _mm256_set1_ps(1.0f / 65536.0f);
+    const __m256 vOne = _mm256_set1_ps(1.0f);
+    __m256i aS[2] {_mm256_loadu_si256((const __m256i*)pState), _mm256_loadu_si256((const __m256i*)(pState + 8))};
+
+    long i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i aQ[2];
+        #pragma GCC unroll 2
+        for (int h = 0; h < 2; h++)
+        {
+            __m256i s = aS[h];
+            s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 13));
+            s = _mm256_xor_si256(s, _mm256_srli_epi32(s, 17));
+            s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 5));
+            aS[h] = s;
+            __m256i sum = _mm256_add_epi32(_mm256_and_si256(s, vLow), _mm256_srli_epi32(s, 16));
+            __m256 d = _mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(sum), vUnit), vOne);
+
+            __m256 x = _mm256_loadu_ps(pSrc + i + h*8);
+            __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(x, vScale), d), vMin), vMax);
+            __m256i q = _mm256_cvtps_epi32(v);
+            aQ[h] = _mm256_andnot_si256(_mm256_castps_si256(_mm256_cmp_ps(x, vZero, _CMP_EQ_OQ)), q);
+        }
+
+        if constexpr (sizeof(T) == sizeof(s16))
+        {
+            /* `packs` works within 128 bit halves, put the quarters back in order */
+            _mm256_storeu_si256((__m256i*)(pDst + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(aQ[0], aQ[1]), 0xd8));
+        }
+        else
+        {
+            _mm256_storeu_si256((__m256i*)(pDst + i), aQ[0]);
+            _mm256_storeu_si256((__m256i*)(pDst + i + 8), aQ[1]);
+        }
+    }
+
+    _mm256_storeu_si256((__m256i*)pState, aS[0]);
+    _mm256_storeu_si256((__m256i*)(pState + 8), aS[1]);
+    flatScalar(pDst + i, pSrc + i, n - i, nBits, pState);
+}
+
+#endif /* DITHER_X86 */
+
+static FlatKernels
+pickFlatKernels()
+{
+#ifdef DITHER_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return {flatAVX2<s16>, flatAVX2<s32>};
+
+    if (__builtin_cpu_supports("sse2"))
+        return {flatSSE2<s16>, flatSSE2<s32>};
+#endif
+
+    return {flatScalar<s16>, flatScalar<s32>};
+}
+
+static const FlatKernels f_flat = pickFlatKernels();
+
+void
+Ditherer::quantize(s16* pDst, const f32* pSrc, long nFrames, long nChannels, mode eMode)
+{
+    switch (eMode)
+    {
+        case mode::off:
+            dsp::convert(pDst, pSrc, nFrames * nChannels);
+            break;
+
+        case mode::tpdf:
+            f_flat.toS16(pDst, pSrc, nFrames * nChannels, 16, m_aState);
+            break;
+
+        case mode::shaped:
+            shaped(pDst, pSrc, nFrames, nChannels, 16, m_aErr, m_aState);
+            break;
+    }
+}
+
+void
+Ditherer::quantize(s32* pDst, const f32* pSrc, long nFrames, long nChannels, mode eMode, int nBits)
+{
+    if (nBits > 24) eMode = mode::off;
+
+    switch (eMode)
+    {
+        case mode::off:
+            dsp::convert(pDst, pSrc, nFrames * nChannels, nBits);
+            break;
+
+        case mode::tpdf:
+            f_flat.toS32(pDst, pSrc, nFrames * nChannels, nBits, m_aState);
+            break;
+
+        case mode::shaped:
+            shaped(pDst, pSrc, nFrames, nChannels, nBits, m_aErr, m_aState);
+            break;
+    }
+}
+
+} /* namespace dither */
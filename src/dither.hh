@@ -0,0 +1,38 @@
+#pragma once
+#include "ultratypes.h"
+
+#include <spa/param/audio/format-utils.h>
+
+namespace dither
+{
+
+enum class mode : u8
+{
+    off, /* round to nearest */
+    tpdf, /* triangular noise of +-1 LSB, error becomes steady hiss instead of distortion */
+    shaped /* same, with the hiss pushed up where hearing is least sensitive */
+};
+
+/* `defaults::ditherS16` or `defaults::ditherS24`, off for formats that don't lose anything from float */
+mode forFormat(enum spa_audio_format eformat);
+
+/* Final float to integer requantization, SSE2/AVX2 picked at runtime like `dsp::gain()`.
+ * Random numbers come from sixteen xorshift32 generators side by side, two AVX2 vectors (SSE2 uses the first eight),
+ * instead of `utils::rngGet()`.
+ * Exact zeros stay zero, so digital silence doesn't turn into hiss. */
+class Ditherer
+{
+    u32 m_aState[16] {};
+    f32 m_aErr[SPA_AUDIO_MAX_CHANNELS][3] {}; /* noise shaping, last errors of each channel */
+
+public:
+    Ditherer();
+
+    void reset();
+    /* NOTE: audio thread only, interleaved */
+    void quantize(s16* pDst, const f32* pSrc, long nFrames, long nChannels, mode eMode);
+    /* right-justified `nBits` in s32, 32 bits only ever rounds since float can't fill them */
+    void quantize(s32* pDst, const f32* pSrc, long nFrames, long nChannels, mode eMode, int nBits);
+};
+
+} /* namespace dither */
@@ -0,0 +1,639 @@
+#include "dsp.hh"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define DSP_X86
+    #include <immintrin.h>
+#endif
+
+namespace dsp
+{
+
+using FlatFn = void (*)(f32* pDst, const f32* pSrc, long nSamples, f32 g);
+using RampFn = void (*)(f32* pDst, const f32* pSrc, long nFrames, long nChannels, f32 g0, f32 step);
+
+struct GainKernels
+{
+    FlatFn flat;
+    RampFn mono;
+    RampFn stereo;
+    RampFn any;
+    const char* name;
+};
+
+/* gain of frame `i` is `g0 + step*(i + 1)`, `CH == 0` means any channel count */
+template<int CH>
+static inline void
+rampTail(f32* pDst, const f32* pSrc, long from, long nFrames, long nChannels, f32 g0, f32 step)
+{
+    const long nCh = CH > 0 ? CH : nChannels;
+
+    for (long i = from; i < nFrames; i++)
+    {
+        const f32 g = g0 + step * (f32)(i + 1);
+        for (long c = 0; c < nCh; c++)
+            pDst[i*nCh + c] = pSrc[i*nCh + c] * g;
+    }
+}
+
+static void
+flatScalar(f32* pDst, const f32* pSrc, long nSamples, f32 g)
+{
+    for (long i = 0; i < nSamples; i++)
+        pDst[i] = pSrc[i] * g;
+}
+
+template<int CH>
+static void
+rampScalar(f32* pDst, const f32* pSrc, long nFrames, long nChannels, f32 g0, f32 step)
+{
+    rampTail<CH>(pDst, pSrc, 0, nFrames, nChannels, g0, step);
+}
+
+#ifdef DSP_X86
+
+static void
+flatSSE2(f32* pDst, const f32* pSrc, long nSamples, f32 g)
+{
+    const __m128 vg = _mm_set1_ps(g);
+
+    long i = 0;
+    for (; i + 4 <= nSamples; i += 4)
+        _mm_storeu_ps(pDst + i, _mm_mul_ps(_mm_loadu_ps(pSrc + i), vg));
+
+    for (; i < nSamples; i++)
+        pDst[i] = pSrc[i] * g;
+}
+
+template<int CH>
+static void
+rampSSE2(f32* pDst, const f32* pSrc, long nFrames, long nChannels, f32 g0, f32 step)
+{
+    const __m128 vg0 = _mm_set1_ps(g0);
+    const __m128 vStep = _mm_set1_ps(step);
+    long i = 0;
+
+    if constexpr (CH == 1)
+    {
+        /* 4 frames per vector */
+        __m128 vIdx = _mm_setr_ps(1, 2, 3, 4);
+        const __m128 vInc = _mm_set1_ps(4);
+
+        for (; i + 4 <= nFrames; i += 4)
+        {
+            __m128 vg = _mm_add_ps(vg0, _mm_mul_ps(vStep, vIdx));
+            _mm_storeu_ps(pDst + i, _mm_mul_ps(_mm_loadu_ps(pSrc + i), vg));
+            vIdx = _mm_add_ps(vIdx, vInc);
+        }
+    }
+    else if constexpr (CH == 2)
+    {
+        /* 2 frames per vector, gain is duplicated for left and right */
+        __m128 vIdx = _mm_setr_ps(1, 1, 2, 2);
+        const __m128 vInc = _mm_set1_ps(2);
+
+        for (; i + 2 <= nFrames; i += 2)
+        {
+            __m128 vg = _mm_add_ps(vg0, _mm_mul_ps(vStep, vIdx));
+            _mm_storeu_ps(pDst + i*2, _mm_mul_ps(_mm_loadu_ps(pSrc + i*2), vg));
+            vIdx = _mm_add_ps(vIdx, vInc);
+        }
+    }
+    else
+    {
+        /* one frame at a time, gain is broadcast over channels */
+        for (; i < nFrames; i++)
+        {
+            const f32 g = g0 + step * (f32)(i + 1);
+            const __m128 vg = _mm_set1_ps(g);
+            const f32* s = pSrc + i*nChannels;
+            f32* d = pDst + i*nChannels;
+
+            long c = 0;
+            for (; c + 4 <= nChannels; c += 4)
+                _mm_storeu_ps(d + c, _mm_mul_ps(_mm_loadu_ps(s + c), vg));
+            for (; c < nChannels; c++)
+                d[c] = s[c] * g;
+        }
+    }
+
+    rampTail<CH>(pDst, pSrc, i, nFrames, nChannels, g0, step);
+}
+
+__attribute__((target("avx2"))) static void
+flatAVX2(f32* pDst, const f32* pSrc, long nSamples, f32 g)
+{
+    const __m256 vg = _mm256_set1_ps(g);
+
+    long i = 0;
+    for (; i + 16 <= nSamples; i += 16)
+    {
+        _mm256_storeu_ps(pDst + i, _mm256_mul_ps(_mm256_loadu_ps(pSrc + i), vg));
+        _mm256_storeu_ps(pDst + i + 8, _mm256_mul_ps(_mm256_loadu_ps(pSrc + i + 8), vg));
+    }
+    for (; i + 8 <= nSamples; i += 8)
+        _mm256_storeu_ps(pDst + i, _mm256_mul_ps(_mm256_loadu_ps(pSrc + i), vg));
+
+    for (; i < nSamples; i++)
+        pDst[i] = pSrc[i] * g;
+}
+
+template<int CH>
+__attribute__((target("avx2"))) static void
+rampAVX2(f32* pDst, const f32* pSrc, long nFrames, long nChannels, f32 g0, f32 step)
+{
+    const __m256 vg0 = _mm256_set1_ps(g0);
+    const __m256 vStep = _mm256_set1_ps(step);
+    long i = 0;
+
+    if constexpr (CH == 1)
+    {
+        /* 8 frames per vector */
+        __m256 vIdx = _mm256_setr_ps(1, 2, 3, 4, 5, 6, 7, 8);
+        const __m256 vInc = _mm256_set1_ps(8);
+
+        for (; i + 8 <= nFrames; i += 8)
+        {
+            __m256 vg = _mm256_add_ps(vg0, _mm256_mul_ps(vStep, vIdx));
+            _mm256_storeu_ps(pDst + i, _mm256_mul_ps(_mm256_loadu_ps(pSrc + i), vg));
+            vIdx = _mm256_add_ps(vIdx, vInc);
+        }
+    }
+    else if constexpr (CH == 2)
+    {
+        /* 4 frames per vector, gain is duplicated for left and right */
+        __m256 vIdx = _mm256_setr_ps(1, 1, 2, 2, 3, 3, 4, 4);
+        const __m256 vInc = _mm256_set1_ps(4);
+
+        for (; i + 4 <= nFrames; i += 4)
+        {
+            __m256 vg = _mm256_add_ps(vg0, _mm256_mul_ps(vStep, vIdx));
+            _mm256_storeu_ps(pDst + i*2, _mm256_mul_ps(_mm256_loadu_ps(pSrc + i*2), vg));
+            vIdx = _mm256_add_ps(vIdx, vInc);
+        }
+    }
+    else
+    {
+        /* one frame at a time, gain is broadcast over channels */
+        for (; i < nFrames; i++)
+        {
+            const f32 g = g0 + step * (f32)(i + 1);
+            const __m256 vg = _mm256_set1_ps(g);
+            const f32* s = pSrc + i*nChannels;
+            f32* d = pDst + i*nChannels;
+
+            long c = 0;
+            for (; c + 8 <= nChannels; c += 8)
+                _mm256_storeu_ps(d + c, _mm256_mul_ps(_mm256_loadu_ps(s + c), vg));
+            for (; c < nChannels; c++)
+                d[c] = s[c] * g;
+        }
+    }
+
+    rampTail<CH>(pDst, pSrc, i, nFrames, nChannels, g0, step);
+}
+
+#endif /* DSP_X86 */
+
+static GainKernels
+pickGainKernels()
+{
+#ifdef DSP_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return {flatAVX2, rampAVX2<1>, rampAVX2<2>, rampAVX2<0>, "avx2"};
+
+    /* always there on x86_64 */
+    if (__builtin_cpu_supports("sse2"))
+        return {flatSSE2, rampSSE2<1>, rampSSE2<2>, rampSSE2<0>, "sse2"};
+#endif
+
+    return {flatScalar, rampScalar<1>, rampScalar<2>, rampScalar<0>, "scalar"};
+}
+
+static const GainKernels f_gain = pickGainKernels();
+
+void
+gain(f32* pDst, const f32* pSrc, long nFrames, long nChannels, f32 g0, f32 g1)
+{
+    if (nFrames <= 0) return;
+
+    if (g0 == g1)
+    {
+        f_gain.flat(pDst, pSrc, nFrames * nChannels, g1);
+        return;
+    }
+
+    const f32 step = (g1 - g0) / (f32)nFrames;
+
+    switch (nChannels)
+    {
+        case 1:
+            f_gain.mono(pDst, pSrc, nFrames, 1, g0, step);
+            break;
+
+        case 2:
+            f_gain.stereo(pDst, pSrc, nFrames, 2, g0, step);
+            break;
+
+        default:
+            f_gain.any(pDst, pSrc, nFrames, nChannels, g0, step);
+            break;
+    }
+}
+
+/* f64 so 32 bit samples keep their precision */
+template<typename T>
+static void
+gainInt(T* pDst, const T* pSrc, long nFrames, long nChannels, f32 g0, f32 g1, int nBits)
+{
+    if (nFrames <= 0) return;
+
+    const f64 max = (f64)((1LL << (nBits - 1)) - 1);
+    const f64 min = -max - 1.0;
+    const f64 step = ((f64)g1 - (f64)g0) / (f64)nFrames;
+
+    for (long i = 0; i < nFrames; i++)
+    {
+        const f64 g = (f64)g0 + step * (f64)(i + 1);
+        for (long c = 0; c < nChannels; c++)
+        {
+            f64 v = std::round((f64)pSrc[i*nChannels + c] * g);
+            pDst[i*nChannels + c] = (T)std::clamp(v, min, max);
+        }
+    }
+}
+
+void
+gain(s16* pDst, const s16* pSrc, long nFrames, long nChannels, f32 g0, f32 g1)
+{
+    gainInt(pDst, pSrc, nFrames, nChannels, g0, g1, 16);
+}
+
+void
+gain(s32* pDst, const s32* pSrc, long nFrames, long nChannels, f32 g0, f32 g1, int nBits)
+{
+    gainInt(pDst, pSrc, nFrames, nChannels, g0, g1, nBits);
+}
+
+const char*
+gainIsa()
+{
+    return f_gain.name;
+}
+
+using DotFn = f32 (*)(const f32* pA, const f32* pB, long n);
+using LerpFn = void (*)(f32* pDst, const f32* pA, const f32* pB, f32 t, long n);
+using CmacFn = void (*)(f32* pAccRe, f32* pAccIm, const f32* pARe, const f32* pAIm, const f32* pBRe, const f32* pBIm, long n);
+
+struct FirKernels
+{
+    DotFn dot;
+    LerpFn lerp;
+    CmacFn cmac;
+};
+
+static f32
+dotScalar(const f32* pA, const f32* pB, long n)
+{
+    f32 sum = 0.0f;
+    for (long i = 0; i < n; i++)
+        sum += pA[i] * pB[i];
+
+    return sum;
+}
+
+static void
+lerpScalar(f32* pDst, const f32* pA, const f32* pB, f32 t, long n)
+{
+    for (long i = 0; i < n; i++)
+        pDst[i] = pA[i] + t * (pB[i] - pA[i]);
+}
+
+static void
+cmacScalar(f32* pAccRe, f32* pAccIm, const f32* pARe, const f32* pAIm, const f32* pBRe, const f32* pBIm, long n)
+{
+    for (long i = 0; i < n; i++)
+    {
+        pAccRe[i] += pARe[i] * pBRe[i] - pAIm[i] * pBIm[i];
+        pAccIm[i] += pARe[i] * pBIm[i] + pAIm[i] * pBRe[i];
+    }
+}
+
+#ifdef DSP_X86
+
+static f32
+dotSSE2(const f32* pA, const f32* pB, long n)
+{
+    __m128 vSum0 = _mm_setzero_ps();
+    __m128 vSum1 = _mm_setzero_ps();
+
+    long i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        vSum0 = _mm_add_ps(vSum0, _mm_mul_ps(_mm_loadu_ps(pA + i), _mm_loadu_ps(pB + i)));
+        vSum1 = _mm_add_ps(vSum1, _mm_mul_ps(_mm_loadu_ps(pA + i + 4), _mm_loadu_ps(pB + i + 4)));
+    }
+
+    alignas(16) f32 aSum[4];
+    _mm_store_ps(aSum, _mm_add_ps(vSum0, vSum1));
+    f32 sum = aSum[0] + aSum[1] + aSum[2] + aSum[3];
+
+    for (; i < n; i++)
+        sum += pA[i] * pB[i];
+
+    return sum;
+}
+
+static void
+lerpSSE2(f32* pDst, const f32* pA, const f32* pB, f32 t, long n)
+{
+    const __m128 vt = _mm_set1_ps(t);
+
+    long i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 va = _mm_loadu_ps(pA + i);
+        _mm_storeu_ps(pDst + i, _mm_add_ps(va, _mm_mul_ps(vt, _mm_sub_ps(_mm_loadu_ps(pB + i), va))));
+    }
+
+    for (; i < n; i++)
+        pDst[i] = pA[i] + t * (pB[i] - pA[i]);
+}
+
+static void
+cmacSSE2(f32* pAccRe, f32* pAccIm, const f32* pARe, const f32* pAIm, const f32* pBRe, const f32* pBIm, long n)
+{
+    long i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 ar = _mm_loadu_ps(pARe + i), ai = _mm_loadu_ps(pAIm + i);
+        __m128 br = _mm_loadu_ps(pBRe + i), bi = _mm_loadu_ps(pBIm + i);
+        __m128 re = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+        __m128 im = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+        _mm_storeu_ps(pAccRe + i, _mm_add_ps(_mm_loadu_ps(pAccRe + i), re));
+        _mm_storeu_ps(pAccIm + i, _mm_add_ps(_mm_loadu_ps(pAccIm + i), im));
+    }
+
+    cmacScalar(pAccRe + i, pAccIm + i, pARe + i, pAIm + i, pBRe + i, pBIm + i, n - i);
+}
+
+__attribute__((target("avx2"))) static f32
+dotAVX2(const f32* pA, const f32* pB, long n)
+{
+    __m256 vSum0 = _mm256_setzero_ps();
+    __m256 vSum1 = _mm256_setzero_ps();
+
+    long i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        vSum0 = _mm256_add_ps(vSum0, _mm256_mul_ps(_mm256_loadu_ps(pA + i), _mm256_loadu_ps(pB + i)));
+        vSum1 = _mm256_add_ps(vSum1, _mm256_mul_ps(_mm256_loadu_ps(pA + i + 8), _mm256_loadu_ps(pB + i + 8)));
+    }
+    for (; i + 8 <= n; i += 8)
+        vSum0 = _mm256_add_ps(vSum0, _mm256_mul_ps(_mm256_loadu_ps(pA + i), _mm256_loadu_ps(pB + i)));
+
+    __m256 vSum = _mm256_add_ps(vSum0, vSum1);
+    __m128 vHalf = _mm_add_ps(_mm256_castps256_ps128(vSum), _mm256_extractf128_ps(vSum, 1));
+    alignas(16) f32 aSum[4];
+    _mm_store_ps(aSum, vHalf);
+    f32 sum = aSum[0] + aSum[1] + aSum[2] + aSum[3];
+
+    for (; i < n; i++)
+        sum += pA[i] * pB[i];
+
+    return sum;
+}
+
+__attribute__((target("avx2"))) static void
+lerpAVX2(f32* pDst, const f32* pA, const f32* pB, f32 t, long n)
+{
+    const __m256 vt = _mm256_set1_ps(t);
+
+    long i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 va = _mm256_loadu_ps(pA + i);
+        _mm256_storeu_ps(pDst + i, _mm256_add_ps(va, _mm256_mul_ps(vt, _mm256_sub_ps(_mm256_loadu_ps(pB + i), va))));
+    }
+
+    for (; i < n; i++)
+        pDst[i] = pA[i] + t * (pB[i] - pA[i]);
+}
+
+__attribute__((target("avx2,fma"))) static void
+cmacAVX2(f32* pAccRe, f32* pAccIm, const f32* pARe, const f32* pAIm, const f32* pBRe, const f32* pBIm, long n)
+{
+    long i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 ar = _mm256_loadu_ps(pARe + i), ai = _mm256_loadu_ps(pAIm + i);
+        __m256 br = _mm256_loadu_ps(pBRe + i), bi = _mm256_loadu_ps(pBIm + i);
+        __m256 re = _mm256_fmadd_ps(ar, br, _mm256_loadu_ps(pAccRe + i));
+        __m256 im = _mm256_fmadd_ps(ar, bi, _mm256_loadu_ps(pAccIm + i));
+        _mm256_storeu_ps(pAccRe + i, _mm256_fnmadd_ps(ai, bi, re));
+        _mm256_storeu_ps(pAccIm + i, _mm256_fmadd_ps(ai, br, im));
+    }
+
+    cmacScalar(pAccRe + i, pAccIm + i, pARe + i, pAIm + i, pBRe + i, pBIm + i, n - i);
+}
+
+#endif /* DSP_X86 */
+
+static FirKernels
+pickFirKernels()
+{
+#ifdef DSP_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return {dotAVX2, lerpAVX2, cmacAVX2};
+
+    if (__builtin_cpu_supports("sse2"))
+        return {dotSSE2, lerpSSE2, cmacSSE2};
+#endif
+
+    return {dotScalar, lerpScalar, cmacScalar};
+}
+
+static const FirKernels f_fir = pickFirKernels();
+
+f32
+dot(const f32* pA, const f32* pB, long n)
+{
+    return f_fir.dot(pA, pB, n);
+}
+
+void
+lerp(f32* pDst, const f32* pA, const f32* pB, f32 t, long n)
+{
+    f_fir.lerp(pDst, pA, pB, t, n);
+}
+
+void
+cmac(f32* pAccRe, f32* pAccIm, const f32* pARe, const f32* pAIm, const f32* pBRe, const f32* pBIm, long n)
+{
+    f_fir.cmac(pAccRe, pAccIm, pARe, pAIm, pBRe, pBIm, n);
+}
+
+using ConvertS16Fn = void (*)(s16* pDst, const f32* pSrc, long n);
+using ConvertS32Fn = void (*)(s32* pDst, const f32* pSrc, long n, int nBits);
+
+struct ConvertKernels
+{
+    ConvertS16Fn toS16;
+    ConvertS32Fn toS32; /* up to 24 bits, where scaled float is still exact */
+};
+
+/* to nearest even like the vector ones, f64 so 32 bits keep their precision */
+template<typename T>
+static void
+convertScalar(T* pDst, const f32* pSrc, long n, int nBits)
+{
+    const f64 scale = (f64)(1LL << (nBits - 1));
+    const f64 max = scale - 1.0;
+    const f64 min = -scale;
+
+    for (long i = 0; i < n; i++)
+        pDst[i] = (T)std::clamp(std::nearbyint((f64)pSrc[i] * scale), min, max);
+}
+
+static void
+convertS16Scalar(s16* pDst, const f32* pSrc, long n)
+{
+    convertScalar(pDst, pSrc, n, 16);
+}
+
+#ifdef DSP_X86
+
+/* `cvtps` turns anything past int range into INT_MIN, so the top gets clamped first, `packs` saturates the rest */
+static void
+convertS16SSE2(s16* pDst, const f32* pSrc, long n)
+{
+    const __m128 vScale = _mm_set1_ps(32768.0f);
+    const __m128 vMax = _mm_set1_ps(32767.0f);
+
+    long i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i a = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(pSrc + i), vScale), vMax));
+        __m128i b = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(pSrc + i + 4), vScale), vMax));
+        _mm_storeu_si128((__m128i*)(pDst + i), _mm_packs_epi32(a, b));
+    }
+
+    convertScalar(pDst + i, pSrc + i, n - i, 16);
+}
+
+static void
+convertS32SSE2(s32* pDst, const f32* pSrc, long n, int nBits)
+{
+    const f32 scale = (f32)(1LL << (nBits - 1));
+    const __m128 vScale = _mm_set1_ps(scale);
+    const __m128 vMax = _mm_set1_ps(scale - 1.0f);
+    const __m128 vMin = _mm_set1_ps(-scale);
+
+    long i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(pSrc + i), vScale);
+        _mm_storeu_si128((__m128i*)(pDst + i), _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, vMin), vMax)));
+    }
+
+    convertScalar(pDst + i, pSrc + i, n - i, nBits);
+}
+
+__attribute__((target("avx2"))) static void
+convertS16AVX2(s16* pDst, const f32* pSrc, long n)
+{
+    const __m256 vScale = _mm256_set1_ps(32768.0f);
+    const __m256 vMax = _mm256_set1_ps(32767.0f);
+
+    long i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i a = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(pSrc + i), vScale), vMax));
+        __m256i b = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(pSrc + i + 8), vScale), vMax));
+        /* `packs` works within 128 bit halves, put the quarters back in order */
+        _mm256_storeu_si256((__m256i*)(pDst + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8));
+    }
+
+    convertScalar(pDst + i, pSrc + i, n - i, 16);
+}
+
+__attribute__((target("avx2"))) static void
+convertS32AVX2(s32* pDst, const f32* pSrc, long n, int nBits)
+{
+    const f32 scale = (f32)(1LL << (nBits - 1));
+    const __m256 vScale = _mm256_set1_ps(scale);
+    const __m256 vMax = _mm256_set1_ps(scale - 1.0f);
+    const __m256 vMin = _mm256_set1_ps(-scale);
+
+    long i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(pSrc + i), vScale);
+        _mm256_storeu_si256((__m256i*)(pDst + i), _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(v, vMin), vMax)));
+    }
+
+    convertScalar(pDst + i, pSrc + i, n - i, nBits);
+}
+
+#endif /* DSP_X86 */
+
+static ConvertKernels
+pickConvertKernels()
+{
+#ifdef DSP_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return {convertS16AVX2, convertS32AVX2};
+
+    if (__builtin_cpu_supports("sse2"))
+        return {convertS16SSE2, convertS32SSE2};
+#endif
+
+    return {convertS16Scalar, convertScalar<s32>};
+}
+
+static const ConvertKernels f_convert = pickConvertKernels();
+
+void
+convert(s16* pDst, const f32* pSrc, long n)
+{
+    f_convert.toS16(pDst, pSrc, n);
+}
+
+void
+convert(s32* pDst, const f32* pSrc, long n, int nBits)
+{
+    if (nBits > 24) convertScalar(pDst, pSrc, n, nBits);
+    else f_convert.toS32(pDst, pSrc, n, nBits);
+}
+
+template<typename T>
+static void
+convertFloat(f32* pDst, const T* pSrc, long n, int nBits)
+{
+    const f32 scale = 1.0f / (f32)(1LL << (nBits - 1));
+
+    for (long i = 0; i < n; i++)
+        pDst[i] = (f32)pSrc[i] * scale;
+}
+
+void
+convert(f32* pDst, const s16* pSrc, long n)
+{
+    convertFloat(pDst, pSrc, n, 16);
+}
+
+void
+convert(f32* pDst, const s32* pSrc, long n, int nBits)
+{
+    convertFloat(pDst, pSrc, n, nBits);
+}
+
+} /* namespace dsp */
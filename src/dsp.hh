@@ -0,0 +1,35 @@
+#pragma once
+#include "ultratypes.h"
+
+namespace dsp
+{
+
+/* Multiply interleaved `pSrc` into `pDst` (may alias) with gain ramped linearly from `g0` towards `g1`,
+ * ramp ends at `g1` on the last frame, so the next call starting from `g1` continues without a step.
+ * Picks SSE2/AVX2 kernel at runtime, specialized for mono, stereo and any other channel count. */
+void gain(f32* pDst, const f32* pSrc, long nFrames, long nChannels, f32 g0, f32 g1);
+
+/* Same for integer samples (scalar, bit-perfect output only needs it off 100% volume),
+ * rounds and saturates to `nBits`, which is 24 for S24_32. */
+void gain(s16* pDst, const s16* pSrc, long nFrames, long nChannels, f32 g0, f32 g1);
+void gain(s32* pDst, const s32* pSrc, long nFrames, long nChannels, f32 g0, f32 g1, int nBits = 32);
+
+/* name of the instruction set `gain()` dispatched to */
+const char* gainIsa();
+
+/* sum of `pA[i]*pB[i]`, SSE2/AVX2 picked at runtime like `gain()` */
+f32 dot(const f32* pA, const f32* pB, long n);
+/* `pDst[i] = pA[i] + t*(pB[i] - pA[i])`, same dispatch */
+void lerp(f32* pDst, const f32* pA, const f32* pB, f32 t, long n);
+/* `pAcc += pA * pB` on split complex arrays, same dispatch */
+void cmac(f32* pAccRe, f32* pAccIm, const f32* pARe, const f32* pAIm, const f32* pBRe, const f32* pBIm, long n);
+
+/* float [-1, 1] to integer samples, rounds to nearest even and saturates to `nBits`,
+ * SSE2/AVX2 picked at runtime like `gain()`, 32 bits stay scalar in f64 */
+void convert(s16* pDst, const f32* pSrc, long n);
+void convert(s32* pDst, const f32* pSrc, long n, int nBits = 32);
+/* and back, `nBits` is where the integer's full scale is */
+void convert(f32* pDst, const s16* pSrc, long n);
+void convert(f32* pDst, const s32* pSrc, long n, int nBits = 32);
+
+} /* namespace dsp */
@@ -0,0 +1,228 @@
+#include "eq.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define EQ_X86
+    #include <immintrin.h>
+#endif
+
+namespace eq
+{
+
+/* https://www.w3.org/TR/audio-eq-cookbook/ */
+static Coeffs
+designBand(const Band& band, f64 sampleRate)
+{
+    const f64 freq = std::clamp((f64)band.freq, 1.0, sampleRate * 0.49);
+    const f64 w0 = 2.0 * std::numbers::pi * freq / sampleRate;
+    const f64 cosW = std::cos(w0);
+    const f64 alpha = std::sin(w0) / (2.0 * std::max((f64)band.q, 0.01));
+    const f64 a = std::pow(10.0, band.gainDb / 40.0);
+    const f64 sqA2alpha = 2.0 * std::sqrt(a) * alpha;
+
+    f64 b0, b1, b2, a0, a1, a2;
+    switch (band.eType)
+    {
+        case type::peaking:
+            b0 = 1.0 + alpha*a;
+            b1 = -2.0 * cosW;
+            b2 = 1.0 - alpha*a;
+            a0 = 1.0 + alpha/a;
+            a1 = -2.0 * cosW;
+            a2 = 1.0 - alpha/a;
+            break;
+
+        case type::lowShelf:
+            b0 = a * ((a + 1.0) - (a - 1.0)*cosW + sqA2alpha);
+            b1 = 2.0 * a * ((a - 1.0) - (a + 1.0)*cosW);
+            b2 = a * ((a + 1.0) - (a - 1.0)*cosW - sqA2alpha);
+            a0 = (a + 1.0) + (a - 1.0)*cosW + sqA2alpha;
+            a1 = -2.0 * ((a - 1.0) + (a + 1.0)*cosW);
+            a2 = (a + 1.0) + (a - 1.0)*cosW - sqA2alpha;
+            break;
+
+        case type::highShelf:
+            b0 = a * ((a + 1.0) + (a - 1.0)*cosW + sqA2alpha);
+            b1 = -2.0 * a * ((a - 1.0) + (a + 1.0)*cosW);
+            b2 = a * ((a + 1.0) + (a - 1.0)*cosW - sqA2alpha);
+            a0 = (a + 1.0) - (a - 1.0)*cosW + sqA2alpha;
+            a1 = 2.0 * ((a - 1.0) - (a + 1.0)*cosW);
+            a2 = (a + 1.0) - (a - 1.0)*cosW - sqA2alpha;
+            break;
+
+        case type::lowPass:
+            b0 = (1.0 - cosW) / 2.0;
+            b1 = 1.0 - cosW;
+            b2 = (1.0 - cosW) / 2.0;
+            a0 = 1.0 + alpha;
+            a1 = -2.0 * cosW;
+            a2 = 1.0 - alpha;
+            break;
+
+        case type::highPass:
+        default:
+            b0 = (1.0 + cosW) / 2.0;
+            b1 = -(1.0 + cosW);
+            b2 = (1.0 + cosW) / 2.0;
+            a0 = 1.0 + alpha;
+            a1 = -2.0 * cosW;
+            a2 = 1.0 - alpha;
+            break;
+    }
+
+    return {b0/a0, b1/a0, b2/a0, a1/a0, a2/a0};
+}
+
+Setup
+design(const Preset& preset, f64 sampleRate)
+{
+    Setup s {};
+    s.nBands = std::min((long)preset.bands.size(), maxBands);
+
+    for (long i = 0; i < s.nBands; i++)
+        s.aCoeffs[i] = designBand(preset.bands[i], sampleRate);
+
+    if (s.nBands > 0)
+    {
+        const f64 g = std::pow(10.0, preset.preampDb / 20.0);
+        s.aCoeffs[0].b0 *= g;
+        s.aCoeffs[0].b1 *= g;
+        s.aCoeffs[0].b2 *= g;
+    }
+
+    return s;
+}
+
+void
+Equalizer::set(const Setup& setup)
+{
+    m_pending.store(setup);
+    if (setup.nBands == 0) m_nOff.fetch_add(1, std::memory_order_relaxed);
+    m_version.fetch_add(1, std::memory_order_release);
+    m_bOn.store(setup.nBands > 0, std::memory_order_relaxed);
+}
+
+void
+Equalizer::reset()
+{
+    memset(m_aZ, 0, sizeof(m_aZ));
+}
+
+/* one channel, lane 0 of its pair's state */
+static void
+runSingle(f32* pData, long nFrames, long nChannels, const Setup& s, f64 (*pZ)[2][2])
+{
+    for (long i = 0; i < nFrames; i++)
+    {
+        f64 x = pData[i * nChannels];
+        for (long b = 0; b < s.nBands; b++)
+        {
+            const Coeffs& k = s.aCoeffs[b];
+            f64 y = k.b0*x + pZ[b][0][0];
+            pZ[b][0][0] = k.b1*x - k.a1*y + pZ[b][1][0];
+            pZ[b][1][0] = k.b2*x - k.a2*y;
+            x = y;
+        }
+        pData[i * nChannels] = (f32)x;
+    }
+}
+
+#ifdef EQ_X86
+
+/* two adjacent channels at once */
+static void
+runPair(f32* pData, long nFrames, long nChannels, const Setup& s, f64 (*pZ)[2][2])
+{
+    __m128d aK[maxBands][5];
+    for (long b = 0; b < s.nBands; b++)
+    {
+        const Coeffs& k = s.aCoeffs[b];
+        aK[b][0] = _mm_set1_pd(k.b0);
+        aK[b][1] = _mm_set1_pd(k.b1);
+        aK[b][2] = _mm_set1_pd(k.b2);
+        aK[b][3] = _mm_set1_pd(k.a1);
+        aK[b][4] = _mm_set1_pd(k.a2);
+    }
+
+    for (long i = 0; i < nFrames; i++)
+    {
+        f32* p = pData + i * nChannels;
+        __m128d x = _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((const f64*)p)));
+
+        for (long b = 0; b < s.nBands; b++)
+        {
+            __m128d z1 = _mm_load_pd(pZ[b][0]);
+            __m128d z2 = _mm_load_pd(pZ[b][1]);
+            __m128d y = _mm_add_pd(_mm_mul_pd(aK[b][0], x), z1);
+
+            z1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(aK[b][1], x), _mm_mul_pd(aK[b][3], y)), z2);
+            z2 = _mm_sub_pd(_mm_mul_pd(aK[b][2], x), _mm_mul_pd(aK[b][4], y));
+            _mm_store_pd(pZ[b][0], z1);
+            _mm_store_pd(pZ[b][1], z2);
+            x = y;
+        }
+
+        _mm_store_sd((f64*)p, _mm_castps_pd(_mm_cvtpd_ps(x)));
+    }
+}
+
+#else
+
+static void
+runPair(f32* pData, long nFrames, long nChannels, const Setup& s, f64 (*pZ)[2][2])
+{
+    for (long i = 0; i < nFrames; i++)
+    {
+        f64 x[2] {pData[i * nChannels], pData[i * nChannels + 1]};
+        for (long b = 0; b < s.nBands; b++)
+        {
+            const Coeffs& k = s.aCoeffs[b];
+            for (int l = 0; l < 2; l++)
+            {
+                f64 y = k.b0*x[l] + pZ[b][0][l];
+                pZ[b][0][l] = k.b1*x[l] - k.a1*y + pZ[b][1][l];
+                pZ[b][1][l] = k.b2*x[l] - k.a2*y;
+                x[l] = y;
+            }
+        }
+        pData[i * nChannels] = (f32)x[0];
+        pData[i * nChannels + 1] = (f32)x[1];
+    }
+}
+
+#endif
+
+void
+Equalizer::process(f32* pData, long nFrames, long nChannels)
+{
+    u32 version = m_version.load(std::memory_order_acquire);
+    Setup s;
+    if (version != m_seen && m_pending.tryLoad(&s))
+    {
+        /* bands that weren't running have stale state, all of them after being switched off */
+        u32 nOff = m_nOff.load(std::memory_order_relaxed);
+        long from = nOff != m_offSeen ? 0 : m_setup.nBands;
+        for (long p = 0; p < SPA_AUDIO_MAX_CHANNELS / 2; p++)
+            for (long b = from; b < s.nBands; b++)
+                memset(m_aZ[p][b], 0, sizeof(m_aZ[p][b]));
+
+        m_setup = s;
+        m_seen = version;
+        m_offSeen = nOff;
+    }
+
+    if (m_setup.nBands == 0) return;
+
+    nChannels = std::min(nChannels, (long)SPA_AUDIO_MAX_CHANNELS);
+    long c = 0;
+    for (; c + 2 <= nChannels; c += 2)
+        runPair(pData + c, nFrames, nChannels, m_setup, m_aZ[c / 2]);
+    if (c < nChannels)
+        runSingle(pData + c, nFrames, nChannels, m_setup, m_aZ[c / 2]);
+}
+
+} /* namespace eq */
@@ -0,0 +1,81 @@
+#pragma once
+#include "lockfree.hh"
+#include "ultratypes.h"
+
+#include <atomic>
+#include <span>
+#include <spa/param/audio/format-utils.h>
+#include <string_view>
+
+namespace eq
+{
+
+constexpr long maxBands = 16;
+
+enum class type : u8
+{
+    peaking,
+    lowShelf,
+    highShelf,
+    lowPass, /* `gainDb` unused */
+    highPass
+};
+
+struct Band
+{
+    enum type eType = type::peaking;
+    f32 freq = 1000.0f; /* Hz, center or corner */
+    f32 gainDb = 0.0f;
+    f32 q = 0.70710678f;
+};
+
+struct Preset
+{
+    std::string_view name {};
+    f32 preampDb = 0.0f; /* make room for boosts, folded into the first band */
+    std::span<const Band> bands {};
+};
+
+/* biquad normalized by a0, f64 so low bands at 192kHz don't lose their poles to rounding */
+struct Coeffs
+{
+    f64 b0, b1, b2, a1, a2;
+};
+
+struct Setup
+{
+    Coeffs aCoeffs[maxBands] {};
+    long nBands = 0; /* 0 is off */
+};
+
+/* RBJ cookbook filters for `sampleRate`, bands past `maxBands` are dropped */
+Setup design(const Preset& preset, f64 sampleRate);
+
+/* Cascade of transposed direct form II biquads.
+ * Channels go in pairs through SSE2 lanes, each band's state stays next to the other lane's.
+ * `set()` publishes through a seqlock, `process()` tries to pick it up once per call and keeps the old
+ * coefficients for that quantum if a store is in progress, so it never spins. */
+class Equalizer
+{
+    lockfree::SeqLock<Setup> m_pending {};
+    std::atomic<u32> m_version = 0;
+    std::atomic<u32> m_nOff = 0; /* times it got switched off, `process()` may not run at all meanwhile */
+    std::atomic<bool> m_bOn = false;
+
+    /* `process()` only */
+    Setup m_setup {};
+    u32 m_seen = 0;
+    u32 m_offSeen = 0;
+    alignas(16) f64 m_aZ[SPA_AUDIO_MAX_CHANNELS / 2][maxBands][2][2] {}; /* pair, band, z1/z2, lane */
+
+public:
+    /* NOTE: one thread at a time */
+    void set(const Setup& setup);
+    bool active() const { return m_bOn.load(std::memory_order_relaxed); }
+
+    /* NOTE: audio thread only */
+    void process(f32* pData, long nFrames, long nChannels);
+    void reset();
+};
+
+} /* namespace eq */
@@ -0,0 +1,141 @@
+#include "fft.hh"
+
+#include <bit>
+#include <cmath>
+#include <numbers>
+
+namespace fft
+{
+
+void
+Real::setup(long n)
+{
+    m_n = n;
+    m_half = n / 2;
+    const int nBits = std::countr_zero((u64)m_half);
+
+    m_vBitRev.resize(m_half);
+    for (long i = 0; i < m_half; i++)
+    {
+        u32 r = 0;
+        for (int b = 0; b < nBits; b++)
+            if (i & (1L << b)) r |= 1u << (nBits - 1 - b);
+        m_vBitRev[i] = r;
+    }
+
+    /* stage with `len` point butterflies uses `len/2` twiddles, starting at `len/2 - 1` */
+    m_vTwRe.resize(std::max(m_half - 1, 1L));
+    m_vTwIm.resize(std::max(m_half - 1, 1L));
+    for (long len = 2; len <= m_half; len *= 2)
+    {
+        for (long j = 0; j < len / 2; j++)
+        {
+            f64 a = -2.0 * std::numbers::pi * (f64)j / (f64)len;
+            m_vTwRe[len/2 - 1 + j] = std::cos(a);
+            m_vTwIm[len/2 - 1 + j] = std::sin(a);
+        }
+    }
+
+    m_vSplitRe.resize(m_half);
+    m_vSplitIm.resize(m_half);
+    for (long k = 0; k < m_half; k++)
+    {
+        f64 a = -2.0 * std::numbers::pi * (f64)k / (f64)m_n;
+        m_vSplitRe[k] = std::cos(a);
+        m_vSplitIm[k] = std::sin(a);
+    }
+
+    m_vRe.resize(m_half);
+    m_vIm.resize(m_half);
+}
+
+void
+Real::transform(f32* pRe, f32* pIm) const
+{
+    /* input is already in bit reversed order */
+    for (long len = 2; len <= m_half; len *= 2)
+    {
+        const long h = len / 2;
+        const f32* pWr = &m_vTwRe[h - 1];
+        const f32* pWi = &m_vTwIm[h - 1];
+
+        for (long s = 0; s < m_half; s += len)
+        {
+            f32* pAr = pRe + s;
+            f32* pAi = pIm + s;
+            f32* pBr = pRe + s + h;
+            f32* pBi = pIm + s + h;
+
+            /* contiguous in `j`, so it vectorizes */
+            for (long j = 0; j < h; j++)
+            {
+                f32 tr = pBr[j] * pWr[j] - pBi[j] * pWi[j];
+                f32 ti = pBr[j] * pWi[j] + pBi[j] * pWr[j];
+                pBr[j] = pAr[j] - tr;
+                pBi[j] = pAi[j] - ti;
+                pAr[j] += tr;
+                pAi[j] += ti;
+            }
+        }
+    }
+}
+
+void
+Real::forward(const f32* pIn, f32* pRe, f32* pIm)
+{
+    /* even samples real, odd imaginary */
+    for (long i = 0; i < m_half; i++)
+    {
+        m_vRe[m_vBitRev[i]] = pIn[2*i];
+        m_vIm[m_vBitRev[i]] = pIn[2*i + 1];
+    }
+    transform(m_vRe.data(), m_vIm.data());
+
+    pRe[0] = m_vRe[0] + m_vIm[0];
+    pIm[0] = 0.0f;
+    pRe[m_half] = m_vRe[0] - m_vIm[0];
+    pIm[m_half] = 0.0f;
+
+    for (long k = 1; k < m_half; k++)
+    {
+        const long m = m_half - k;
+        /* spectra of the even and odd halves */
+        f32 er = 0.5f * (m_vRe[k] + m_vRe[m]);
+        f32 ei = 0.5f * (m_vIm[k] - m_vIm[m]);
+        f32 or_ = 0.5f * (m_vIm[k] + m_vIm[m]);
+        f32 oi = -0.5f * (m_vRe[k] - m_vRe[m]);
+
+        pRe[k] = er + or_ * m_vSplitRe[k] - oi * m_vSplitIm[k];
+        pIm[k] = ei + or_ * m_vSplitIm[k] + oi * m_vSplitRe[k];
+    }
+}
+
+void
+Real::inverse(const f32* pRe, const f32* pIm, f32* pOut)
+{
+    for (long k = 0; k < m_half; k++)
+    {
+        const long m = m_half - k;
+        f32 er = 0.5f * (pRe[k] + pRe[m]);
+        f32 ei = 0.5f * (pIm[k] - pIm[m]);
+        /* (X[k] - conj(X[m])) / 2 / W^k */
+        f32 dr = 0.5f * (pRe[k] - pRe[m]);
+        f32 di = 0.5f * (pIm[k] + pIm[m]);
+        f32 or_ = dr * m_vSplitRe[k] + di * m_vSplitIm[k];
+        f32 oi = di * m_vSplitRe[k] - dr * m_vSplitIm[k];
+
+        /* `e + i*o`, conjugated for the inverse through the forward transform */
+        long r = m_vBitRev[k];
+        m_vRe[r] = er - oi;
+        m_vIm[r] = -(ei + or_);
+    }
+    transform(m_vRe.data(), m_vIm.data());
+
+    for (long i = 0; i < m_half; i++)
+    {
+        pOut[2*i] = m_vRe[i];
+        pOut[2*i + 1] = -m_vIm[i];
+    }
+}
+
+} /* namespace fft */
@@ -0,0 +1,37 @@
+#pragma once
+#include "ultratypes.h"
+
+#include <vector>
+
+namespace fft
+{
+
+/* Real FFT of power of two size `n`, as an `n/2` complex one plus a split step.
+ * Iterative radix-2 on split re/im arrays with every table made up front, so a transform doesn't allocate.
+ * Spectra are `n/2 + 1` bins, split as well. Nothing is scaled, `inverse(forward(x))` is `n/2 * x`. */
+class Real
+{
+    long m_n = 0;
+    long m_half = 0;
+    std::vector<u32> m_vBitRev {}; /* `m_half` */
+    std::vector<f32> m_vTwRe {}; /* butterfly twiddles, every stage back to back */
+    std::vector<f32> m_vTwIm {};
+    std::vector<f32> m_vSplitRe {}; /* `e^(-2pi*i*k/n)`, `m_half` */
+    std::vector<f32> m_vSplitIm {};
+    std::vector<f32> m_vRe {}; /* scratch, `m_half` */
+    std::vector<f32> m_vIm {};
+
+    void transform(f32* pRe, f32* pIm) const;
+
+public:
+    void setup(long n);
+    long size() const { return m_n; }
+    long nBins() const { return m_half + 1; }
+
+    /* `n` real samples to `nBins()` */
+    void forward(const f32* pIn, f32* pRe, f32* pIm);
+    /* `nBins()` to `n` real samples */
+    void inverse(const f32* pRe, const f32* pIm, f32* pOut);
+};
+
+} /* namespace fft */
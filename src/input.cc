@@ -7,6 +7,7 @@
 #include "utils.hh"
 #endif
 
+#include <algorithm>
 #include <ncurses.h>
 
 namespace input
@@ -32,8 +33,6 @@ read(app::PipeWirePlayer* p)
     };
 
     auto holdSeek = [&]() -> void {
-        std::lock_guard lock(p->m_pw.mtx);
-
         int step;
         int key0;
         int key1;
@@ -54,10 +53,10 @@ read(app::PipeWirePlayer* p)
         timeout(50);
         while (c == key0 || c == key1)
         {
-            p->m_hSnd.seek(p->secToPcm(step), SEEK_CUR);
+            /* decoder does the actual seek, repeats while holding the key pile up into one */
+            p->seekBy(step);
             p->m_term.updateStatus();
             p->m_term.updateBottomLine();
-            p->m_pcmPos = p->m_hSnd.seek(0, SEEK_CUR) * p->m_pw.channels;
             p->m_term.drawUI();
             c = getch();
         }
@@ -81,7 +80,6 @@ read(app::PipeWirePlayer* p)
 
     while ((c = getch()))
     {
-        f64 newVol = p->m_volume;
         switch (c)
         {
             case 'q':
@@ -90,19 +88,19 @@ read(app::PipeWirePlayer* p)
                 break;
 
             case '0':
-                newVol += 0.04;
-                [[fallthrough]];
+                p->addVolume(0.05);
+                break;
+
             case ')':
-                newVol += 0.01;
-                p->setVolume(newVol);
+                p->addVolume(0.01);
                 break;
 
             case '9':
-                newVol -= 0.04;
-                [[fallthrough]];
+                p->addVolume(-0.05);
+                break;
+
             case '(':
-                newVol -= 0.01;
-                p->setVolume(newVol);
+                p->addVolume(-0.01);
                 break;
 
             case KEY_RIGHT:
@@ -208,7 +206,7 @@ read(app::PipeWirePlayer* p)
                 
             case 'z':
             case 'Z':
-                p->centerOn(p->m_currSongIdx);
+                p->centerOn(p->state().currSongIdx);
                 p->m_term.updatePlayList();
                 p->m_term.updateBottomLine();
                 break;
@@ -227,6 +225,10 @@ read(app::PipeWirePlayer* p)
                 p->toggleMute();
                 break;
 
+            case 'b':
+                p->toggleGapless();
+                break;
+
             case KEY_RESIZE:
             case 12: /* C-l */
                 p->m_term.resizeWindows();
@@ -257,6 +259,22 @@ read(app::PipeWirePlayer* p)
                 p->restoreOrigSampleRate();
                 break;
 
+            case 'p':
+                p->togglePreservePitch();
+                break;
+
+            case 'e':
+                p->cycleEqPreset(1);
+                break;
+
+            case 'E':
+                p->cycleEqPreset(-1);
+                break;
+
+            case 'c':
+                p->toggleConvolve();
+                break;
+
             case ERR:
                 break;
 
@@ -272,7 +290,7 @@ read(app::PipeWirePlayer* p)
 #endif
 
         p->m_term.updateStatus();
-        if (!p->m_bPaused) p->m_term.updateVisualizer();
+        if (!p->state().bPaused) p->m_term.updateVisualizer();
 
         p->m_term.drawUI();
     }
@@ -389,7 +407,7 @@ parseTimeString(std::wstring_view ts, app::PipeWirePlayer* p)
         ret = wcstoul(numbers[0].data(), &end, 10);
 
         if (percent)
-            ret = (p->m_pcmSize * ((f64)ret/100.0)) / p->m_pw.channels / p->m_pw.sampleRate;
+            ret = p->getMaxTimeInSec() * ((f64)ret/100.0);
     }
     else
     {
@@ -0,0 +1,165 @@
+#include "limit.hh"
+#include "defaults.hh"
+
+#include <cmath>
+#include <cstring>
+
+namespace limit
+{
+
+constexpr long nOversample = 4;
+
+void
+Limiter::setup(long nChannels, u32 sampleRate, long maxFrames, f32 releaseMs)
+{
+    m_fir = resample::Filter(resample::quality::fast, 1.0);
+    m_nChannels = nChannels;
+    m_maxFrames = maxFrames;
+    m_lookahead = std::max(std::lround(defaults::limiterLookaheadMs * sampleRate / 1000.0), 1L);
+    /* newest frame the filter sees is `nTaps/2` ahead of the point it interpolates */
+    m_delay = m_lookahead + m_fir.nTaps / 2;
+    m_nHistory = std::max(m_delay, m_fir.nTaps - 1);
+    m_ceiling = std::pow(10.0f, defaults::limiterCeilingDb / 20.0f);
+    if (releaseMs <= 0.0f) releaseMs = defaults::limiterReleaseMs;
+    m_release = std::exp(-1.0 / (releaseMs * sampleRate / 1000.0));
+
+    m_vRows.resize(m_nChannels * (m_nHistory + m_maxFrames));
+    m_vPeak.resize(m_maxFrames);
+    m_vAcc.resize(m_maxFrames);
+    m_vGain.resize(m_maxFrames);
+    m_vMinVal.resize(m_lookahead + 1);
+    m_vMinPos.resize(m_lookahead + 1);
+    m_vBox.resize(m_lookahead);
+
+    reset();
+}
+
+void
+Limiter::reset()
+{
+    std::fill(m_vRows.begin(), m_vRows.end(), 0.0f);
+    std::fill(m_vBox.begin(), m_vBox.end(), 1.0f);
+    m_boxSum = m_lookahead;
+    m_boxPos = 0;
+    m_minHead = m_minSize = 0;
+    m_pos = 0;
+    m_env = 1.0f;
+}
+
+void
+Limiter::prime(const f32* pFrames)
+{
+    reset();
+
+    const long rowSize = m_nHistory + m_maxFrames;
+    for (long c = 0; c < m_nChannels; c++)
+    {
+        f32* pRow = &m_vRows[c * rowSize + m_nHistory - m_delay];
+        for (long i = 0; i < m_delay; i++)
+            pRow[i] = pFrames[i*m_nChannels + c];
+    }
+}
+
+void
+Limiter::block(f32* pData, long nFrames)
+{
+    const long ch = m_nChannels;
+    const long rowSize = m_nHistory + m_maxFrames;
+    const long nTaps = m_fir.nTaps;
+    const long half = nTaps / 2;
+
+    std::fill(m_vPeak.begin(), m_vPeak.begin() + nFrames, 0.0f);
+
+    for (long c = 0; c < ch; c++)
+    {
+        f32* pRow = &m_vRows[c * rowSize];
+        for (long i = 0; i < nFrames; i++)
+            pRow[m_nHistory + i] = pData[i*ch + c];
+
+        /* sample itself, then the points after it, each loop runs along the block so it vectorizes */
+        const f32* pStart = pRow + m_nHistory - (nTaps - 1);
+        for (long i = 0; i < nFrames; i++)
+            m_vPeak[i] = std::max(m_vPeak[i], std::abs(pStart[i + half - 1]));
+
+        for (long p = 1; p < nOversample; p++)
+        {
+            const f32* pCoeffs = &m_fir.vCoeffs[(p * resample::nPhases / nOversample) * nTaps];
+            std::fill(m_vAcc.begin(), m_vAcc.begin() + nFrames, 0.0f);
+            for (long k = 0; k < nTaps; k++)
+            {
+                const f32 coeff = pCoeffs[k];
+                const f32* pIn = pStart + k;
+                for (long i = 0; i < nFrames; i++)
+                    m_vAcc[i] += coeff * pIn[i];
+            }
+            for (long i = 0; i < nFrames; i++)
+                m_vPeak[i] = std::max(m_vPeak[i], std::abs(m_vAcc[i]));
+        }
+    }
+
+    const long window = m_lookahead + 1;
+    f32 minGain = 1.0f;
+
+    for (long i = 0; i < nFrames; i++, m_pos++)
+    {
+        f32 need = m_vPeak[i] > m_ceiling ? m_ceiling / m_vPeak[i] : 1.0f;
+
+        /* sliding minimum over the look-ahead: drop what fell out first, so the new one always has a slot of its own,
+         * then whatever is no lower than it */
+        if (m_minSize > 0 && m_vMinPos[m_minHead] <= m_pos - window)
+        {
+            m_minHead = (m_minHead + 1) % window;
+            m_minSize--;
+        }
+        while (m_minSize > 0 && m_vMinVal[(m_minHead + m_minSize - 1) % window] >= need)
+            m_minSize--;
+        long tail = (m_minHead + m_minSize) % window;
+        m_vMinVal[tail] = need;
+        m_vMinPos[tail] = m_pos;
+        m_minSize++;
+        f32 hold = m_vMinVal[m_minHead];
+
+        /* down right away, back up with the release */
+        m_env = hold < m_env ? hold : hold + (m_env - hold) * m_release;
+
+        m_boxSum += m_env - m_vBox[m_boxPos];
+        m_vBox[m_boxPos] = m_env;
+        if (++m_boxPos == m_lookahead) m_boxPos = 0;
+
+        m_vGain[i] = std::min((f32)(m_boxSum / m_lookahead), 1.0f);
+        minGain = std::min(minGain, m_vGain[i]);
+    }
+
+    /* recompute once a block so rounding can't pile up */
+    m_boxSum = 0.0;
+    for (f32 g : m_vBox) m_boxSum += g;
+
+    for (long c = 0; c < ch; c++)
+    {
+        f32* pRow = &m_vRows[c * rowSize];
+        const f32* pDelayed = pRow + m_nHistory - m_delay;
+        for (long i = 0; i < nFrames; i++)
+            pData[i*ch + c] = pDelayed[i] * m_vGain[i];
+
+        memmove(pRow, pRow + nFrames, m_nHistory * sizeof(f32));
+    }
+
+    if (minGain < m_minGain.load(std::memory_order_relaxed))
+        m_minGain.store(minGain, std::memory_order_relaxed);
+}
+
+void
+Limiter::process(f32* pData, long nFrames)
+{
+    for (long i = 0; i < nFrames; i += m_maxFrames)
+        block(pData + i*m_nChannels, std::min(nFrames - i, m_maxFrames));
+}
+
+f32
+Limiter::takeReduction()
+{
+    f32 g = m_minGain.exchange(1.0f, std::memory_order_relaxed);
+    return 20.0f * std::log10(g);
+}
+
+} /* namespace limit */
@@ -0,0 +1,57 @@
+#pragma once
+#include "resample.hh"
+
+#include <atomic>
+#include <vector>
+
+namespace limit
+{
+
+/* Look-ahead brickwall limiter on 4x oversampled true peak, all channels share one gain.
+ * Gain needed for each frame goes through a sliding minimum and a release, then a moving average as long
+ * as the look-ahead, so it has ramped all the way down by the time the peak comes out. */
+class Limiter
+{
+    resample::Filter m_fir {}; /* 1:1, in between phases are the oversampled points */
+    std::vector<f32> m_vRows {}; /* planar, `m_nHistory` frames before the current block */
+    std::vector<f32> m_vPeak {}; /* per frame of the block, loudest channel */
+    std::vector<f32> m_vAcc {};
+    std::vector<f32> m_vGain {};
+    std::vector<f32> m_vMinVal {}; /* monotonic deque for the sliding minimum, ring of `m_lookahead + 1` */
+    std::vector<s64> m_vMinPos {};
+    long m_minHead = 0;
+    long m_minSize = 0;
+    std::vector<f32> m_vBox {}; /* last `m_lookahead` released gains, for the moving average */
+    long m_boxPos = 0;
+    f64 m_boxSum = 0.0;
+    long m_nChannels = 0;
+    long m_maxFrames = 0;
+    long m_lookahead = 0;
+    long m_delay = 0; /* look-ahead plus how far the detector runs behind */
+    long m_nHistory = 0;
+    s64 m_pos = 0; /* frames seen since reset */
+    f32 m_ceiling = 1.0f;
+    f32 m_release = 0.0f; /* per frame coefficient */
+    f32 m_env = 1.0f;
+    std::atomic<f32> m_minGain = 1.0f; /* deepest since `takeReduction()` */
+
+    void block(f32* pData, long nFrames);
+
+public:
+    /* `maxFrames` per `block()`, `process()` splits bigger ones, resets, `releaseMs` 0 is `defaults::limiterReleaseMs` */
+    void setup(long nChannels, u32 sampleRate, long maxFrames, f32 releaseMs = 0.0f);
+    /* output frames come this much after their input */
+    long latency() const { return m_delay; }
+
+    /* start over from silence */
+    void reset();
+    /* start over from `latency()` interleaved frames that already went in, last one is the newest,
+     * the first ones out are those, so it can take over from a plain delay as long as its own */
+    void prime(const f32* pFrames);
+    /* NOTE: audio thread only, interleaved in place */
+    void process(f32* pData, long nFrames);
+    /* any thread, deepest gain reduction in dB since the last call, 0 when it didn't act */
+    f32 takeReduction();
+};
+
+} /* namespace limit */
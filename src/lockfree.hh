@@ -0,0 +1,187 @@
+#pragma once
+#include "ultratypes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+namespace lockfree
+{
+
+/* Sequence lock for small trivially copyable values.
+ * Writers never block, readers retry while a write is in progress, neither side allocates,
+ * so it's fine to publish from the realtime audio callback and read from anywhere.
+ * Writers must be serialized by the caller. */
+template<typename T>
+class SeqLock
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    static constexpr size_t m_nWords = (sizeof(T) + sizeof(u64) - 1) / sizeof(u64);
+
+    std::atomic<u32> m_seq = 0;
+    /* stored word by word with relaxed atomics, so a torn read is not a data race */
+    std::atomic<u64> m_aWords[m_nWords] {};
+
+public:
+    void store(const T& val);
+    T load() const;
+    /* one attempt, false when a store was in progress, for readers that can't wait */
+    bool tryLoad(T* pVal) const;
+};
+
+template<typename T>
+inline void
+SeqLock<T>::store(const T& val)
+{
+    u64 aTmp[m_nWords] {};
+    memcpy(aTmp, &val, sizeof(T));
+
+    u32 seq = m_seq.load(std::memory_order_relaxed);
+    m_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0; i < m_nWords; i++)
+        m_aWords[i].store(aTmp[i], std::memory_order_relaxed);
+
+    m_seq.store(seq + 2, std::memory_order_release);
+}
+
+template<typename T>
+inline T
+SeqLock<T>::load() const
+{
+    u64 aTmp[m_nWords];
+    u32 seq0, seq1;
+
+    do
+    {
+        seq0 = m_seq.load(std::memory_order_acquire);
+
+        for (size_t i = 0; i < m_nWords; i++)
+            aTmp[i] = m_aWords[i].load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq1 = m_seq.load(std::memory_order_relaxed);
+    } while (seq0 != seq1 || (seq0 & 1));
+
+    T val;
+    memcpy(&val, aTmp, sizeof(T));
+    return val;
+}
+
+template<typename T>
+inline bool
+SeqLock<T>::tryLoad(T* pVal) const
+{
+    u64 aTmp[m_nWords];
+
+    u32 seq0 = m_seq.load(std::memory_order_acquire);
+    if (seq0 & 1) return false;
+
+    for (size_t i = 0; i < m_nWords; i++)
+        aTmp[i] = m_aWords[i].load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_seq.load(std::memory_order_relaxed) != seq0) return false;
+
+    memcpy(pVal, aTmp, sizeof(T));
+    return true;
+}
+
+/* Bounded multiple producer, single consumer queue (Vyukov's sequence per slot).
+ * Storage is allocated once, push and pop never block or allocate,
+ * order is kept: consumer stops at a slot that is still being written. */
+template<typename T>
+class MPSC
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        T val;
+    };
+
+    std::unique_ptr<Slot[]> m_pSlots {};
+    size_t m_cap = 0;
+    size_t m_mask = 0;
+    alignas(64) std::atomic<size_t> m_write = 0;
+    alignas(64) size_t m_read = 0;
+
+public:
+    /* capacity gets rounded up to the power of two */
+    explicit MPSC(size_t minCapacity);
+
+    /* any thread, false when full */
+    bool push(const T& val);
+    /* consumer only, false when empty */
+    bool pop(T* pVal);
+};
+
+template<typename T>
+MPSC<T>::MPSC(size_t minCapacity)
+{
+    m_cap = std::bit_ceil(std::max(minCapacity, (size_t)2));
+    m_mask = m_cap - 1;
+    m_pSlots = std::make_unique<Slot[]>(m_cap);
+
+    for (size_t i = 0; i < m_cap; i++)
+        m_pSlots[i].seq.store(i, std::memory_order_relaxed);
+}
+
+template<typename T>
+inline bool
+MPSC<T>::push(const T& val)
+{
+    size_t pos = m_write.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        Slot& slot = m_pSlots[pos & m_mask];
+        size_t seq = slot.seq.load(std::memory_order_acquire);
+        s64 diff = (s64)seq - (s64)pos;
+
+        if (diff == 0)
+        {
+            /* slot is free, claim it */
+            if (m_write.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                slot.val = val;
+                slot.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            /* consumer hasn't freed it yet */
+            return false;
+        }
+        else
+        {
+            /* someone else claimed it */
+            pos = m_write.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template<typename T>
+inline bool
+MPSC<T>::pop(T* pVal)
+{
+    Slot& slot = m_pSlots[m_read & m_mask];
+    size_t seq = slot.seq.load(std::memory_order_acquire);
+
+    /* empty, or producer is in the middle of writing */
+    if (seq != m_read + 1) return false;
+
+    *pVal = slot.val;
+    slot.seq.store(m_read + m_cap, std::memory_order_release);
+    m_read++;
+
+    return true;
+}
+
+} /* namespace lockfree */
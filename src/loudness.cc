@@ -0,0 +1,633 @@
+#include "loudness.hh"
+#include "channels.hh"
+#include "defaults.hh"
+#include "dsp.hh"
+#include "resample.hh"
+#include "utils.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <numbers>
+#include <strings.h>
+#include <sys/resource.h>
+
+namespace loudness
+{
+
+constexpr long maxTagBytes = 1 << 24; /* cover art can sit in the middle of the comments */
+constexpr long measureFrames = 4096; /* frames decoded in one read */
+constexpr long nOversample = 4; /* for true peak */
+constexpr f64 absoluteGate = -70.0; /* LUFS */
+constexpr f64 relativeGate = -10.0; /* LU below the absolute-gated loudness */
+constexpr std::string_view cacheMagic = "kmp-loudness 1";
+
+/* "REPLAYGAIN_TRACK_GAIN=-6.5 dB" and friends */
+static void
+parseComment(std::string_view kv, Gain* pGain)
+{
+    auto eq = kv.find('=');
+    if (eq == std::string_view::npos) return;
+
+    std::string key(kv.substr(0, eq));
+    std::string val(kv.substr(eq + 1));
+    f64 v = std::strtod(val.data(), nullptr);
+
+    auto is = [&](const char* s) { return strcasecmp(key.data(), s) == 0; };
+
+    if (is("REPLAYGAIN_TRACK_GAIN")) pGain->trackDb = v;
+    else if (is("REPLAYGAIN_TRACK_PEAK")) pGain->trackPeak = v;
+    else if (is("REPLAYGAIN_ALBUM_GAIN")) pGain->albumDb = v;
+    else if (is("REPLAYGAIN_ALBUM_PEAK")) pGain->albumPeak = v;
+    /* RFC 7845, Q7.8 relative to -23 LUFS, and replaygain tags take precedence */
+    else if (is("R128_TRACK_GAIN") && std::isnan(pGain->trackDb)) pGain->trackDb = v / 256.0 + (referenceLufs + 23.0);
+    else if (is("R128_ALBUM_GAIN") && std::isnan(pGain->albumDb)) pGain->albumDb = v / 256.0 + (referenceLufs + 23.0);
+}
+
+static u32
+le32(const u8* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static u32
+be32(const u8* p)
+{
+    return ((u32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static u32
+syncSafe(const u8* p)
+{
+    return (p[0] & 0x7f) << 21 | (p[1] & 0x7f) << 14 | (p[2] & 0x7f) << 7 | (p[3] & 0x7f);
+}
+
+/* https://xiph.org/vorbis/doc/v-comment.html */
+static void
+parseVorbisComments(const u8* p, size_t size, Gain* pGain)
+{
+    size_t pos = 0;
+    auto take = [&](size_t n) { bool b = size - pos >= n; if (b) pos += n; return b; };
+
+    if (!take(4)) return;
+    if (!take(le32(p + pos - 4))) return; /* vendor */
+    if (!take(4)) return;
+
+    u32 nComments = le32(p + pos - 4);
+    for (u32 i = 0; i < nComments; i++)
+    {
+        if (!take(4)) return;
+        u32 len = le32(p + pos - 4);
+        if (!take(len)) return;
+        parseComment({(const char*)p + pos - len, len}, pGain);
+    }
+}
+
+static bool
+readExact(FILE* pF, void* pDst, size_t n)
+{
+    return fread(pDst, 1, n, pF) == n;
+}
+
+static void
+readFlac(FILE* pF, Gain* pGain)
+{
+    u8 hdr[4];
+    bool bLast = false;
+
+    while (!bLast && readExact(pF, hdr, 4))
+    {
+        bLast = hdr[0] & 0x80;
+        long len = (hdr[1] << 16) | (hdr[2] << 8) | hdr[3];
+
+        if ((hdr[0] & 0x7f) == 4) /* VORBIS_COMMENT */
+        {
+            std::vector<u8> v(len);
+            if (readExact(pF, v.data(), len)) parseVorbisComments(v.data(), len, pGain);
+            return;
+        }
+
+        if (fseek(pF, len, SEEK_CUR) != 0) return;
+    }
+}
+
+/* comment header is the second packet, vorbis and opus only */
+static void
+readOgg(FILE* pF, Gain* pGain)
+{
+    std::vector<u8> vPacket;
+    long nPacket = 0;
+    u8 hdr[27], aSegs[255];
+
+    while (readExact(pF, hdr, 27) && memcmp(hdr, "OggS", 4) == 0)
+    {
+        u8 nSegs = hdr[26];
+        if (!readExact(pF, aSegs, nSegs)) return;
+
+        for (u8 i = 0; i < nSegs; i++)
+        {
+            size_t at = vPacket.size();
+            vPacket.resize(at + aSegs[i]);
+            if (!readExact(pF, vPacket.data() + at, aSegs[i])) return;
+            if ((long)vPacket.size() > maxTagBytes) return;
+
+            /* lacing value under 255 ends the packet */
+            if (aSegs[i] == 255) continue;
+
+            if (nPacket == 1)
+            {
+                if (vPacket.size() > 7 && memcmp(vPacket.data(), "\x03vorbis", 7) == 0)
+                    parseVorbisComments(vPacket.data() + 7, vPacket.size() - 7, pGain);
+                else if (vPacket.size() > 8 && memcmp(vPacket.data(), "OpusTags", 8) == 0)
+                    parseVorbisComments(vPacket.data() + 8, vPacket.size() - 8, pGain);
+                return;
+            }
+
+            vPacket.clear();
+            nPacket++;
+        }
+    }
+}
+
+/* TXXX text as plain bytes, utf-16 only survives if it's ascii */
+static std::string
+id3Text(const u8* p, size_t n, u8 encoding)
+{
+    std::string s;
+    bool bWide = encoding == 1 || encoding == 2;
+
+    for (size_t i = 0; i < n; i += bWide ? 2 : 1)
+    {
+        u16 c = bWide && i + 1 < n ? (encoding == 2 ? (p[i] << 8 | p[i + 1]) : (p[i] | p[i + 1] << 8)) : p[i];
+        if (c == 0xfeff || c == 0xfffe) continue; /* bom */
+        if (c == 0) s.push_back('\0');
+        else if (c < 0x80) s.push_back((char)c);
+    }
+
+    return s;
+}
+
+/* https://id3.org/id3v2.4.0-structure, TXXX frames of 2.3 and 2.4 */
+static void
+readId3(FILE* pF, const u8* pHdr, Gain* pGain)
+{
+    const u8 version = pHdr[3];
+    if (version != 3 && version != 4) return;
+
+    long size = syncSafe(pHdr + 6);
+    if (size > maxTagBytes) return;
+
+    std::vector<u8> v(size);
+    if (!readExact(pF, v.data(), size)) return;
+
+    long pos = 0;
+    if (pHdr[5] & 0x40) /* extended header */
+        pos = version == 4 ? syncSafe(v.data()) : be32(v.data()) + 4;
+
+    while (pos + 10 <= size && v[pos] != 0)
+    {
+        const u8* pFrame = &v[pos];
+        long len = version == 4 ? syncSafe(pFrame + 4) : be32(pFrame + 4);
+        if (len <= 0 || pos + 10 + len > size) return;
+
+        if (memcmp(pFrame, "TXXX", 4) == 0)
+        {
+            /* description and value split by a nul */
+            std::string s = id3Text(pFrame + 11, len - 1, pFrame[10]);
+            auto nul = s.find('\0');
+            if (nul != std::string::npos)
+            {
+                std::string value = s.substr(nul + 1);
+                value.erase(std::find(value.begin(), value.end(), '\0'), value.end());
+                parseComment(s.substr(0, nul) + "=" + value, pGain);
+            }
+        }
+
+        pos += 10 + len;
+    }
+}
+
+bool
+readTags(std::string_view path, Gain* pGain)
+{
+    FILE* pF = fopen(std::string(path).data(), "rb");
+    if (!pF) return false;
+
+    u8 hdr[10] {};
+    if (readExact(pF, hdr, 4))
+    {
+        if (memcmp(hdr, "fLaC", 4) == 0) readFlac(pF, pGain);
+        else if (memcmp(hdr, "OggS", 4) == 0) { fseek(pF, 0, SEEK_SET); readOgg(pF, pGain); }
+        else if (memcmp(hdr, "ID3", 3) == 0 && readExact(pF, hdr + 4, 6)) readId3(pF, hdr, pGain);
+    }
+
+    fclose(pF);
+
+    return !std::isnan(pGain->trackDb);
+}
+
+struct Biquad
+{
+    f64 b0, b1, b2, a1, a2;
+    f64 z1 = 0.0, z2 = 0.0;
+
+    f64
+    operator()(f64 x)
+    {
+        f64 y = b0*x + z1;
+        z1 = b1*x - a1*y + z2;
+        z2 = b2*x - a2*y;
+        return y;
+    }
+};
+
+/* ITU-R BS.1770 K-weighting at any rate, the two stages from the spec's 48kHz coefficients */
+static void
+kWeighting(f64 rate, Biquad* pShelf, Biquad* pHighPass)
+{
+    {
+        const f64 f0 = 1681.974450955533, gainDb = 3.999843853973347, q = 0.7071752369554196;
+        const f64 k = std::tan(std::numbers::pi * f0 / rate);
+        const f64 vh = std::pow(10.0, gainDb / 20.0);
+        const f64 vb = std::pow(vh, 0.4996667741545416);
+        const f64 a0 = 1.0 + k/q + k*k;
+
+        *pShelf = {(vh + vb*k/q + k*k) / a0, 2.0*(k*k - vh) / a0, (vh - vb*k/q + k*k) / a0,
+                   2.0*(k*k - 1.0) / a0, (1.0 - k/q + k*k) / a0};
+    }
+    {
+        const f64 f0 = 38.13547087602444, q = 0.5003270373238773;
+        const f64 k = std::tan(std::numbers::pi * f0 / rate);
+        const f64 a0 = 1.0 + k/q + k*k;
+
+        *pHighPass = {1.0, -2.0, 1.0, 2.0*(k*k - 1.0) / a0, (1.0 - k/q + k*k) / a0};
+    }
+}
+
+/* surround counts more, lfe not at all */
+static f64
+channelWeight(u32 pos)
+{
+    switch (pos)
+    {
+        case SPA_AUDIO_CHANNEL_LFE: return 0.0;
+        case SPA_AUDIO_CHANNEL_SL:
+        case SPA_AUDIO_CHANNEL_SR:
+        case SPA_AUDIO_CHANNEL_RL:
+        case SPA_AUDIO_CHANNEL_RR: return 1.41;
+        default: return 1.0;
+    }
+}
+
+static f64
+blockLoudness(f64 energy)
+{
+    return -0.691 + 10.0 * std::log10(energy);
+}
+
+bool
+measure(SndfileHandle& h, Gain* pGain, const std::atomic<bool>& bStop)
+{
+    const long nCh = h.channels();
+    const f64 rate = h.samplerate();
+    if (nCh <= 0 || rate <= 0.0) return false;
+
+    channels::Layout layout = channels::fileLayout(h);
+    std::vector<f64> vWeights(nCh);
+    std::vector<Biquad> vShelf(nCh), vHighPass(nCh);
+    for (long c = 0; c < nCh; c++)
+    {
+        vWeights[c] = channelWeight(layout.aPositions[c]);
+        kWeighting(rate, &vShelf[c], &vHighPass[c]);
+    }
+
+    /* 1:1 interpolation filter, phases in between samples give the oversampled peaks */
+    resample::Filter fir(resample::quality::fast, 1.0);
+    const long nTaps = fir.nTaps;
+    std::vector<f32> vRows(nCh * (measureFrames + nTaps - 1));
+    const long rowSize = measureFrames + nTaps - 1;
+
+    const long subBlock = std::max(std::lround(rate / 10.0), 1L); /* 100ms */
+    std::vector<f64> vSub; /* weighted mean square of each 100ms */
+    f64 acc = 0.0;
+    long nAcc = 0;
+    f32 peak = 0.0f;
+
+    std::vector<f32> vBuff(measureFrames * nCh);
+    sf_count_t nRead;
+    while ((nRead = h.readf(vBuff.data(), measureFrames)) > 0)
+    {
+        if (bStop.load(std::memory_order_relaxed)) return false;
+
+        for (long i = 0; i < nRead; i++)
+        {
+            f64 sum = 0.0;
+            for (long c = 0; c < nCh; c++)
+            {
+                f64 y = vHighPass[c](vShelf[c](vBuff[i*nCh + c]));
+                sum += vWeights[c] * y * y;
+            }
+
+            acc += sum;
+            if (++nAcc == subBlock)
+            {
+                vSub.push_back(acc / subBlock);
+                acc = 0.0;
+                nAcc = 0;
+            }
+        }
+
+        for (long c = 0; c < nCh; c++)
+        {
+            /* planar, after the last `nTaps - 1` of the previous read */
+            f32* pRow = &vRows[c * rowSize];
+            for (long i = 0; i < nRead; i++)
+            {
+                pRow[nTaps - 1 + i] = vBuff[i*nCh + c];
+                peak = std::max(peak, std::abs(vBuff[i*nCh + c]));
+            }
+
+            for (long p = 1; p < nOversample; p++)
+            {
+                const f32* pCoeffs = &fir.vCoeffs[(p * resample::nPhases / nOversample) * nTaps];
+                for (long i = 0; i < nRead; i++)
+                    peak = std::max(peak, std::abs(dsp::dot(pRow + i, pCoeffs, nTaps)));
+            }
+
+            memmove(pRow, pRow + nRead, (nTaps - 1) * sizeof(f32));
+        }
+    }
+
+    /* shorter than a block, the whole thing is one */
+    if (vSub.size() < 4)
+    {
+        f64 sum = acc;
+        for (f64 e : vSub) sum += e * subBlock;
+        long n = vSub.size() * subBlock + nAcc;
+        vSub.assign(4, n > 0 ? sum / n : 0.0);
+    }
+
+    /* 400ms blocks overlapping by 75% */
+    std::vector<f64> vBlocks;
+    for (size_t i = 3; i < vSub.size(); i++)
+        vBlocks.push_back((vSub[i - 3] + vSub[i - 2] + vSub[i - 1] + vSub[i]) / 4.0);
+
+    auto gatedMean = [&](f64 gate) -> f64 {
+        f64 sum = 0.0;
+        long n = 0;
+        for (f64 e : vBlocks)
+            if (e > 0.0 && blockLoudness(e) > gate) { sum += e; n++; }
+        return n > 0 ? sum / n : 0.0;
+    };
+
+    f64 ungated = gatedMean(absoluteGate);
+    if (ungated <= 0.0) return false; /* digital silence */
+
+    f64 gated = gatedMean(std::max(blockLoudness(ungated) + relativeGate, absoluteGate));
+    pGain->trackDb = referenceLufs - blockLoudness(gated);
+    pGain->trackPeak = peak;
+
+    return true;
+}
+
+void
+Scanner::start(const std::vector<std::string>& vPaths, long first)
+{
+    m_vPaths = vPaths;
+    m_vGains.assign(m_vPaths.size(), {});
+    m_vbDone.assign(m_vPaths.size(), false);
+    m_vAlbums.resize(m_vPaths.size());
+    m_first = first;
+    m_next = 0;
+    m_bStop = false;
+
+    std::unordered_map<std::string, long> dirs;
+    for (long i = 0; i < (long)m_vPaths.size(); i++)
+    {
+        std::string dir = std::filesystem::path(m_vPaths[i]).parent_path().string();
+        m_vAlbums[i] = dirs.try_emplace(dir, i).first->second;
+    }
+
+    loadCache();
+
+    long nThrds = defaults::loudnessScanThreads > 0 ? defaults::loudnessScanThreads : std::thread::hardware_concurrency();
+    nThrds = std::clamp(nThrds, 1L, std::max((long)m_vPaths.size(), 1L));
+    for (long i = 0; i < nThrds; i++)
+        m_vThrds.emplace_back(&Scanner::work, this);
+}
+
+void
+Scanner::stop()
+{
+    m_bStop = true;
+    for (auto& t : m_vThrds)
+        t.join();
+    m_vThrds.clear();
+
+    saveCache();
+}
+
+void
+Scanner::work()
+{
+    /* NOTE: per thread on linux, playback and the decoder go first */
+    setpriority(PRIO_PROCESS, 0, 19);
+
+    long i;
+    while (!m_bStop && (i = m_next.fetch_add(1)) < (long)m_vPaths.size())
+        scan((m_first + i) % m_vPaths.size());
+}
+
+void
+Scanner::scan(long idx)
+{
+    const std::string& path = m_vPaths[idx];
+
+    std::error_code ec;
+    s64 size = std::filesystem::file_size(path, ec);
+    s64 mtime = ec ? 0 : std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+
+    {
+        std::lock_guard lock(m_mtx);
+        auto it = m_cache.find(path);
+        if (!ec && it != m_cache.end() && it->second.size == size && it->second.mtime == mtime)
+        {
+            m_vGains[idx] = it->second.gain;
+            m_vbDone[idx] = true;
+            m_cnd.notify_all();
+            return;
+        }
+    }
+
+    Gain g {};
+    SndfileHandle h(path.data(), SFM_READ);
+    if (h.error() == 0)
+    {
+        g.sec = (f64)h.frames() / (f64)h.samplerate();
+        if (!readTags(path, &g) && !measure(h, &g, m_bStop))
+            g.trackDb = g.trackPeak = NAN;
+    }
+
+    /* stopped halfway, don't cache a failure that isn't one */
+    if (m_bStop) return;
+
+    std::lock_guard lock(m_mtx);
+    m_vGains[idx] = g;
+    m_vbDone[idx] = true;
+    if (!ec)
+    {
+        m_cache[path] = {size, mtime, g};
+        m_bDirty = true;
+    }
+    m_cnd.notify_all();
+}
+
+enum Scanner::album
+Scanner::albumGain(long idx, Gain* pGain)
+{
+    const Gain& own = m_vGains[idx];
+    if (!std::isnan(own.albumDb))
+    {
+        *pGain = own;
+        return album::known;
+    }
+
+    /* energy mean weighted by duration, close to a proper album-wide gate for anything album-like */
+    f64 energy = 0.0, sec = 0.0;
+    f32 peak = 0.0f;
+    for (long i = 0; i < (long)m_vPaths.size(); i++)
+    {
+        if (m_vAlbums[i] != m_vAlbums[idx]) continue;
+        if (!m_vbDone[i]) return album::pending;
+
+        const Gain& g = m_vGains[i];
+        if (std::isnan(g.trackDb)) continue;
+
+        energy += g.sec * std::pow(10.0, (referenceLufs - g.trackDb) / 10.0);
+        sec += g.sec;
+        peak = std::max(peak, std::isnan(g.trackPeak) ? 0.0f : g.trackPeak);
+    }
+    /* silent or unreadable all the way through */
+    if (sec <= 0.0) return album::unknown;
+
+    *pGain = own;
+    pGain->albumDb = referenceLufs - 10.0 * std::log10(energy / sec);
+    pGain->albumPeak = peak;
+
+    return album::known;
+}
+
+f32
+Scanner::gain(long idx, enum mode eMode, bool bWait)
+{
+    if (eMode == mode::off || idx < 0 || idx >= (long)m_vPaths.size()) return 1.0f;
+
+    std::unique_lock lock(m_mtx);
+
+    Gain g {};
+    bool bKnown = false;
+    for (;;)
+    {
+        if (m_vbDone[idx])
+        {
+            g = m_vGains[idx];
+            /* nothing more is coming once the whole directory is scanned, measured or not */
+            bKnown = eMode != mode::album || albumGain(idx, &g) != album::pending;
+        }
+        if (bKnown || !bWait || m_vThrds.empty()) break;
+        m_cnd.wait(lock);
+    }
+
+    /* album falls back to track until the rest of the directory is in, then to unity if that isn't known either */
+    f32 db = eMode == mode::album && !std::isnan(g.albumDb) ? g.albumDb : g.trackDb;
+    f32 peak = eMode == mode::album && !std::isnan(g.albumDb) ? g.albumPeak : g.trackPeak;
+    if (std::isnan(db)) return 1.0f;
+
+    f32 mul = std::pow(10.0f, (db + defaults::replayGainPreamp) / 20.0f);
+    if (defaults::bReplayGainNoClip && peak > 0.0f)
+        mul = std::min(mul, 1.0f / peak);
+
+    return mul;
+}
+
+static std::filesystem::path
+cachePath()
+{
+    const char* pXdg = getenv("XDG_CACHE_HOME");
+    const char* pHome = getenv("HOME");
+
+    if (pXdg && *pXdg) return std::filesystem::path(pXdg) / "kmp" / "loudness";
+    if (pHome && *pHome) return std::filesystem::path(pHome) / ".cache" / "kmp" / "loudness";
+    return {};
+}
+
+void
+Scanner::loadCache()
+{
+    auto path = cachePath();
+    if (path.empty()) return;
+
+    std::ifstream f(path);
+    std::string line;
+    if (!std::getline(f, line) || line != cacheMagic) return;
+
+    /* size mtime trackDb trackPeak albumDb albumPeak sec path, tab separated */
+    while (std::getline(f, line))
+    {
+        Entry e {};
+        char* p = line.data();
+        char* pEnd;
+        e.size = strtoll(p, &pEnd, 10);
+        e.mtime = strtoll(pEnd, &pEnd, 10);
+        e.gain.trackDb = strtod(pEnd, &pEnd);
+        e.gain.trackPeak = strtod(pEnd, &pEnd);
+        e.gain.albumDb = strtod(pEnd, &pEnd);
+        e.gain.albumPeak = strtod(pEnd, &pEnd);
+        e.gain.sec = strtod(pEnd, &pEnd);
+        if (*pEnd != '\t') continue;
+
+        m_cache[pEnd + 1] = e;
+    }
+}
+
+void
+Scanner::saveCache()
+{
+    std::lock_guard lock(m_mtx);
+    if (!m_bDirty) return;
+
+    auto path = cachePath();
+    if (path.empty()) return;
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    /* whole thing to the side first, so an interrupted write doesn't lose what was there */
+    auto tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::trunc);
+        f << cacheMagic << '\n';
+        for (const auto& [p, e] : m_cache)
+        {
+            if (p.find('\n') != std::string::npos) continue;
+
+            f << FMT("{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}\n", e.size, e.mtime, e.gain.trackDb, e.gain.trackPeak,
+                     e.gain.albumDb, e.gain.albumPeak, e.gain.sec, p);
+        }
+
+        if (!f)
+        {
+            LOG_WARN("can't write '{}'\n", tmp.string());
+            return;
+        }
+    }
+
+    std::filesystem::rename(tmp, path, ec);
+    m_bDirty = false;
+}
+
+} /* namespace loudness */
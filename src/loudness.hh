@@ -0,0 +1,99 @@
+#pragma once
+#include "ultratypes.h"
+
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <sndfile.hh>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace loudness
+{
+
+constexpr f64 referenceLufs = -18.0; /* replaygain 2.0 target, r128 tags aim at -23 */
+
+enum class mode : u8
+{
+    off,
+    track,
+    album, /* files in the same directory */
+    size
+};
+
+constexpr std::string_view modeStrings[] {
+    "Off", "Track", "Album"
+};
+
+/* what's known about one file, NaN where nothing is */
+struct Gain
+{
+    f32 trackDb = NAN;
+    f32 trackPeak = NAN; /* linear, true peak when measured */
+    f32 albumDb = NAN; /* only from tags, otherwise worked out from the rest of the directory */
+    f32 albumPeak = NAN;
+    f64 sec = 0.0; /* duration, weighs tracks against each other for album gain */
+};
+
+/* replaygain or opus r128 tags from flac, ogg and id3v2, libsndfile doesn't expose them */
+bool readTags(std::string_view path, Gain* pGain);
+
+/* EBU R128 integrated loudness and true peak of the whole file, gives up early when `bStop` gets set */
+bool measure(SndfileHandle& h, Gain* pGain, const std::atomic<bool>& bStop);
+
+/* Background scanner for the whole playlist.
+ * Tags are used when there are any, everything else gets decoded on every core at the lowest priority.
+ * Results are cached on disk by path, size and mtime, in `$XDG_CACHE_HOME/kmp/loudness`. */
+class Scanner
+{
+    enum class album : u8
+    {
+        pending, /* some of the directory isn't scanned yet */
+        unknown, /* all of it is, nothing measurable in there */
+        known
+    };
+
+    struct Entry
+    {
+        s64 size = 0;
+        s64 mtime = 0;
+        Gain gain {};
+    };
+
+    std::vector<std::string> m_vPaths {};
+    std::vector<Gain> m_vGains {};
+    std::vector<u8> m_vbDone {};
+    std::vector<long> m_vAlbums {}; /* index of the first song in the same directory */
+    std::unordered_map<std::string, Entry> m_cache {};
+    bool m_bDirty = false; /* cache has something new to save */
+    std::mutex m_mtx {}; /* everything above */
+    std::condition_variable m_cnd {};
+    std::vector<std::thread> m_vThrds {};
+    std::atomic<long> m_next = 0;
+    std::atomic<bool> m_bStop = false;
+    long m_first = 0;
+
+    void work();
+    void scan(long idx);
+    void loadCache();
+    void saveCache();
+    /* NOTE: call locked */
+    enum album albumGain(long idx, Gain* pGain);
+
+public:
+    Scanner() = default;
+    ~Scanner() { stop(); }
+
+    /* starts from `first` and wraps around */
+    void start(const std::vector<std::string>& vPaths, long first);
+    /* joins and saves the cache */
+    void stop();
+    /* linear gain for song `idx` in `eMode`, 1.0 if it isn't known yet unless `bWait` */
+    f32 gain(long idx, enum mode eMode, bool bWait);
+};
+
+} /* namespace loudness */
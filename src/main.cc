@@ -1,4 +1,5 @@
 #include "app.hh"
+#include "bench.hh"
 
 #include <fcntl.h>
 #include <locale>
@@ -8,6 +9,9 @@ main(int argc, char* argv[])
 {
     std::locale::global(std::locale(""));
 
+    if (argc == 2 && std::string_view(argv[1]) == "--bench")
+        return bench::run();
+
 #ifdef NDEBUG
     close(STDERR_FILENO); /* hide libmpg123 errors */
 #endif
@@ -163,11 +163,7 @@ seek([[maybe_unused]] sd_bus_message* m,
 
     s64 val = 0;
     CK(sd_bus_message_read_basic(m, 'x', &val));
-    f64 fval = (f64)val;
-    fval /= 1000*1000;
-    fval += p->getCurrTimeInSec();
-
-    p->setSeek(fval);
+    p->seekBy((f64)val / (1000*1000));
 
     return sd_bus_reply_method_return(m, "");
 }
@@ -243,7 +239,7 @@ playbackStatus([[maybe_unused]] sd_bus* bus,
                [[maybe_unused]] sd_bus_error* retError)
 {
     const auto p = (app::PipeWirePlayer*)data;
-    const char* s = p->m_bPaused ? "Paused" : "Playing"; /* NOTE: "Stopped" ignored */
+    const char* s = p->state().bPaused ? "Paused" : "Playing"; /* NOTE: "Stopped" ignored */
     return sd_bus_message_append_basic(reply, 's', s);
 }
 
@@ -276,7 +272,7 @@ setLoopStatus([[maybe_unused]] sd_bus* bus,
     CK(sd_bus_message_read_basic(value, 's', &t));
 
     LOG_WARN("t: {}\n", t);
-    enum app::repeatMethod method = p->m_eRepeat;
+    enum app::repeatMethod method = p->state().eRepeat;
     for (size_t i = 0; i < std::size(app::repeatMethodStrings); i++)
     {
         if (t == app::repeatMethodStrings[i])
@@ -297,7 +293,7 @@ volume([[maybe_unused]] sd_bus* bus,
        [[maybe_unused]] sd_bus_error* retError)
 {
     const auto p = (app::PipeWirePlayer*)data;
-    f64 vol = p->m_volume;
+    f64 vol = p->state().volume;
     return sd_bus_message_append_basic(reply, 'd', &vol);
 }
 
@@ -328,8 +324,7 @@ position([[maybe_unused]] sd_bus* bus,
          [[maybe_unused]] sd_bus_error* retError)
 {
     auto p = (app::PipeWirePlayer*)data;
-    u64 t = (p->m_pcmPos/p->m_pw.channels) / p->m_pw.sampleRate;
-    t *= 1000 * 1000;
+    s64 t = p->getCurrTimeInSec() * 1000 * 1000;
 
     return sd_bus_message_append_basic(reply, 'x', &t);
 }
@@ -344,10 +339,28 @@ rate([[maybe_unused]] sd_bus* bus,
      [[maybe_unused]] sd_bus_error* retError)
 {
     const auto p = (app::PipeWirePlayer*)data;
-    f64 mul = (f64)p->m_pw.sampleRate / (f64)p->m_pw.origSampleRate;
+    app::PlayerState s = p->state();
+    f64 mul = (f64)s.sampleRate / (f64)s.origSampleRate;
     return sd_bus_message_append_basic(reply, 'd', &mul);
 }
 
+static int
+setRate([[maybe_unused]] sd_bus* bus,
+        [[maybe_unused]] const char* path,
+        [[maybe_unused]] const char* interface,
+        [[maybe_unused]] const char* property,
+        [[maybe_unused]] sd_bus_message* value,
+        [[maybe_unused]] void* data,
+        [[maybe_unused]] sd_bus_error* retError)
+{
+    auto p = (app::PipeWirePlayer*)data;
+    f64 mul;
+    CK(sd_bus_message_read_basic(value, 'd', &mul));
+    p->setSpeed(mul);
+
+    return sd_bus_reply_method_return(value, "");
+}
+
 static int
 minRate([[maybe_unused]] sd_bus* bus,
         [[maybe_unused]] const char* path,
@@ -358,7 +371,7 @@ minRate([[maybe_unused]] sd_bus* bus,
         [[maybe_unused]] sd_bus_error* retError)
 {
     const auto p = (app::PipeWirePlayer*)data;
-    f64 mul = (f64)defaults::minSampleRate / (f64)p->m_pw.origSampleRate;
+    f64 mul = p->state().minSpeed;
     return sd_bus_message_append_basic(reply, 'd', &mul);
 }
 
@@ -372,7 +385,7 @@ maxRate([[maybe_unused]] sd_bus* bus,
         [[maybe_unused]] sd_bus_error* retError)
 {
     const auto p = (app::PipeWirePlayer*)data;
-    f64 mul = (f64)defaults::maxSampleRate / (f64)p->m_pw.origSampleRate;
+    f64 mul = p->state().maxSpeed;
     return sd_bus_message_append_basic(reply, 'd', &mul);
 }
 
@@ -399,15 +412,16 @@ metadata([[maybe_unused]] sd_bus* bus,
          [[maybe_unused]] sd_bus_error* retError)
 {
     const auto p = (app::PipeWirePlayer*)data;
+    auto pInfo = p->info();
 
     CK(sd_bus_message_open_container(reply, 'a', "{sv}"));
 
-    if (!p->m_info.title.empty())
-        CK(msgAppendDictSS(reply, "xesam:title", p->m_info.title.data()));
-    if (!p->m_info.album.empty())
-        CK(msgAppendDictSS(reply, "xesam:album", p->m_info.album.data()));
-    if (!p->m_info.artist.empty())
-        CK(msgAppendDictSAS(reply, "xesam:artist", p->m_info.artist.data()));
+    if (!pInfo->title.empty())
+        CK(msgAppendDictSS(reply, "xesam:title", pInfo->title.data()));
+    if (!pInfo->album.empty())
+        CK(msgAppendDictSS(reply, "xesam:album", pInfo->album.data()));
+    if (!pInfo->artist.empty())
+        CK(msgAppendDictSAS(reply, "xesam:artist", pInfo->artist.data()));
 
     CK(sd_bus_message_close_container(reply));
 
@@ -442,7 +456,7 @@ static const sd_bus_vtable vtMediaPlayer2Player[] = {
     SD_BUS_METHOD("OpenUri", "s", "", msgIgnore, 0),
     MPRIS_PROP("PlaybackStatus", "s", playbackStatus),
     MPRIS_WPROP("LoopStatus", "s", loopStatus, setLoopStatus),
-    MPRIS_WPROP("Rate", "d", rate, writeIgnore), /* this one is not used by playerctl afaik */
+    MPRIS_WPROP("Rate", "d", rate, setRate), /* this one is not used by playerctl afaik */
     MPRIS_WPROP("Shuffle", "b", shuffle, writeIgnore),
     MPRIS_WPROP("Volume", "d", volume, setVolume),
     SD_BUS_PROPERTY("Position", "x", position, 0, 0),
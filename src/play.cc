@@ -1,145 +1,347 @@
-/* https://docs.pipewire.org/page_tutorial4.html */
-
 #include "play.hh"
 #include "app.hh"
+#include "dsp.hh"
 #include "utils.hh"
 
-#include <cmath>
+#include <algorithm>
+#include <cstring>
 
 namespace play
 {
 
-void
-onProcessCB(void* data)
+/* interleaved `eformat` samples into the resampler */
+static void
+pushSamples(resample::Resampler* pR, enum spa_audio_format eformat, const u8* pSrc, long nFrames)
 {
-    auto* p = (app::PipeWirePlayer*)data;
+    switch (eformat)
+    {
+        case SPA_AUDIO_FORMAT_S16:
+            pR->push((const s16*)pSrc, nFrames);
+            break;
 
-    std::lock_guard lock(p->m_pw.mtx);
+        case SPA_AUDIO_FORMAT_S24_32:
+            pR->push((const s32*)pSrc, nFrames, 24);
+            break;
 
-    if (p->m_bChangeParams)
-        pw_main_loop_quit(p->m_pw.pLoop);
+        case SPA_AUDIO_FORMAT_S32:
+            pR->push((const s32*)pSrc, nFrames);
+            break;
 
-    p->m_mtxPauseSwitch.lock();
-    if (p->m_bPaused)
+        default:
+            pR->push((const f32*)pSrc, nFrames);
+            break;
+    }
+}
+
+/* interleaved `eformat` samples as float, converted into `pBuff` unless they already are */
+static const f32*
+toF32(f32* pBuff, enum spa_audio_format eformat, const u8* pSrc, long nSamples)
+{
+    switch (eformat)
     {
-        pw_main_loop_quit(p->m_pw.pLoop);
-        /* NOTE: unlock in `PipeWirePlayer::playCurrent()` */
-        return;
+        case SPA_AUDIO_FORMAT_S16:
+            dsp::convert(pBuff, (const s16*)pSrc, nSamples);
+            return pBuff;
+
+        case SPA_AUDIO_FORMAT_S24_32:
+            dsp::convert(pBuff, (const s32*)pSrc, nSamples, 24);
+            return pBuff;
+
+        case SPA_AUDIO_FORMAT_S32:
+            dsp::convert(pBuff, (const s32*)pSrc, nSamples);
+            return pBuff;
+
+        default:
+            return (const f32*)pSrc;
     }
-    p->m_mtxPauseSwitch.unlock();
+}
+
+/* keep the last `m_history` worth of popped source bytes */
+static void
+keepHistory(app::PipeWirePlayer* p, const u8* pSrc, long nBytes, long stride)
+{
+    const long cap = p->m_history.size() / stride;
+    const long nFrames = nBytes / stride;
 
-    pw_buffer* b;
-    if ((b = pw_stream_dequeue_buffer(p->m_pw.pStream)) == nullptr)
+    if (nFrames >= cap)
     {
-        pw_log_warn("out of buffers: %m");
+        memcpy(p->m_history.data(), pSrc + (nFrames - cap)*stride, cap * stride);
+        p->m_nHistory = cap;
         return;
     }
 
-    spa_buffer* buf = b->buffer;
-    f32* dst;
+    long nKeep = std::min(p->m_nHistory, cap - nFrames);
+    memmove(p->m_history.data(), p->m_history.data() + (p->m_nHistory - nKeep)*stride, nKeep * stride);
+    memcpy(p->m_history.data() + nKeep*stride, pSrc, nBytes);
+    p->m_nHistory = nKeep + nFrames;
+}
+
+/* same latency as the limiter while it's out, bytes untouched, so it can go in later without a gap or a repeat */
+static void
+delayLikeLimiter(app::PipeWirePlayer* p, u8* pData, long nBytes)
+{
+    u8* pDelay = p->m_limitDelay.data();
+    u8* pTmp = p->m_limitScratch.data();
+    const long n = p->m_limitDelay.size();
 
-    if ((dst = (f32*)buf->datas[0].data) == nullptr)
+    if (nBytes >= n)
     {
-        CERR("dst == nullptr\n");
-        return;
+        memcpy(pTmp, pData + nBytes - n, n);
+        memmove(pData + n, pData, nBytes - n);
+        memcpy(pData, pDelay, n);
+        memcpy(pDelay, pTmp, n);
+    }
+    else
+    {
+        memcpy(pTmp, pData, nBytes);
+        memcpy(pData, pDelay, nBytes);
+        memmove(pDelay, pDelay + nBytes, n - nBytes);
+        memcpy(pDelay + n - nBytes, pTmp, nBytes);
     }
+}
 
-    int stride = sizeof(f32) * p->m_pw.channels;
-    int nFrames = buf->datas[0].maxsize / stride;
-    if (b->requested) nFrames = SPA_MIN(b->requested, (u64)nFrames);
+/* float frames to `eformat`, dithered the way `dither::forFormat()` says */
+static void
+requantize(app::PipeWirePlayer* p, u8* pDst, enum spa_audio_format eformat, const f32* pSrc, long nFrames)
+{
+    const long nChannels = p->m_pw.channels;
+    const dither::mode eMode = dither::forFormat(eformat);
 
-    if (nFrames > 1024*4) nFrames = 1024*4; /* limit to arbitrary number, `SPA_MAX` maybe? */
+    switch (eformat)
+    {
+        case SPA_AUDIO_FORMAT_S16:
+            p->m_dither.quantize((s16*)pDst, pSrc, nFrames, nChannels, eMode);
+            break;
 
-    p->m_pw.lastNFrames = nFrames;
-    p->m_hSnd.readf(p->m_chunk, nFrames);
-    int chunkPos = 0;
+        case SPA_AUDIO_FORMAT_S24_32:
+            p->m_dither.quantize((s32*)pDst, pSrc, nFrames, nChannels, eMode, 24);
+            break;
 
-    /* non linear nicer ramping */
-    f32 vol = p->m_bMuted ? 0.0 : std::pow(p->m_volume, defaults::volumePower);
+        case SPA_AUDIO_FORMAT_S32:
+            p->m_dither.quantize((s32*)pDst, pSrc, nFrames, nChannels, eMode, 32);
+            break;
+
+        default:
+            if ((const u8*)pSrc != pDst) memcpy(pDst, pSrc, nFrames * nChannels * sizeof(f32));
+            break;
+    }
+}
 
-    for (int i = 0; i < nFrames; i++)
+long
+render(void* data, u8* pDst, long nFrames, const sink::Timing& t)
+{
+    auto* p = (app::PipeWirePlayer*)data;
+
+    const long sampleSize = p->m_pw.sampleSize;
+    const long stride = sampleSize * p->m_pw.channels;
+    const enum spa_audio_format eformat = p->m_pw.eformat;
+    auto& r = p->m_resampler;
+    auto& w = p->m_stretch;
+
+    p->m_pw.lastNFrames = nFrames;
+
+    /* no file io here, decoder thread fills the ring */
+    bool bFlushed = p->m_ring.applyFlush();
+    if (bFlushed)
     {
-        for (int j = 0; j < (int)p->m_pw.channels; j++)
+        p->m_pcmPos = p->m_flushPos;
+        p->m_lastGain = 0.0f; /* fade in from the seek point instead of jumping into it */
+        p->m_bStretching = w.tempo() != 1.0;
+        p->m_bResampling = p->m_bStretching || r.ratio() != 1.0;
+        p->m_nHistory = 0;
+        r.reset();
+        w.reset();
+        p->m_chain.reset();
+        p->m_bLimiting = false;
+        std::fill(p->m_limitDelay.begin(), p->m_limitDelay.end(), 0);
+    }
+    else
+    {
+        /* speed moved off 1:1, both stages pick up right after what just went out so there is no step */
+        if (!p->m_bResampling && (r.ratio() != 1.0 || w.tempo() != 1.0))
         {
-            /* modify each sample here */
-            f32 val = p->m_chunk[chunkPos] * vol;
-
-            *dst++ = val;
+            long nHistory = std::min(r.history(), p->m_nHistory);
+            r.reset();
+            pushSamples(&r, eformat, p->m_history.data() + (p->m_nHistory - nHistory)*stride, nHistory);
+            r.skip(nHistory);
+            p->m_bResampling = true;
+        }
 
-            chunkPos++;
-            p->m_pcmPos++;
+        if (!p->m_bStretching && w.tempo() != 1.0)
+        {
+            long nHistory = std::min(w.hop(), p->m_nHistory);
+            const u8* pHistory = p->m_history.data() + (p->m_nHistory - nHistory)*stride;
+            w.prime(toF32(p->m_stretchIn.data(), eformat, pHistory, nHistory * p->m_pw.channels), nHistory);
+            p->m_bStretching = true;
         }
     }
 
-    /* update position last time */
-    p->m_pcmPos = p->m_hSnd.seek(0, SEEK_CUR) * p->m_pw.channels;
+    long nBytes = nFrames * stride;
+    bool bPaused = p->m_bPaused;
+    long nPopped = 0;
+    long nOut = 0; /* bytes of audio in `m_chunk` */
+    f64 ahead = 0.0; /* source frames popped before the first frame of this buffer */
+    bool bUnderrun = false;
+    f32* pFloat = nullptr; /* this buffer as float, when it went through the resampler or goes through the chain */
 
-    buf->datas[0].chunk->offset = 0;
-    buf->datas[0].chunk->stride = stride;
-    buf->datas[0].chunk->size = nFrames * stride;
+    if (!bPaused && !p->m_bResampling)
+    {
+        nOut = nPopped = p->m_ring.pop(p->m_chunk.data(), nBytes);
+        keepHistory(p, p->m_chunk.data(), nPopped, stride);
+        ahead = (f64)nPopped / stride;
+        bUnderrun = nPopped < nBytes;
+    }
+    else if (!bPaused && !p->m_bStretching)
+    {
+        long nNeed = std::min(r.inputNeeded(nFrames), r.room());
+        nPopped = p->m_ring.pop(p->m_resampleIn.data(), nNeed * stride);
+        keepHistory(p, p->m_resampleIn.data(), nPopped, stride);
+        pushSamples(&r, eformat, p->m_resampleIn.data(), nPopped / stride);
+        ahead = r.delay();
+        bUnderrun = nPopped < nNeed * stride;
+    }
+    else if (!bPaused)
+    {
+        /* ring -> stretch -> resampler, each asking the next one down how much it needs */
+        long nWant = std::min({r.inputNeeded(nFrames), r.room(), w.maxOut()});
+        long nNeed = std::min(w.inputNeeded(nWant), w.room());
+        nPopped = p->m_ring.pop(p->m_resampleIn.data(), nNeed * stride);
+        keepHistory(p, p->m_resampleIn.data(), nPopped, stride);
+        w.push(toF32(p->m_stretchIn.data(), eformat, p->m_resampleIn.data(), nPopped / sampleSize), nPopped / stride);
 
-    pw_stream_queue_buffer(p->m_pw.pStream, b);
+        long nStretched = w.process(p->m_stretchOut.data(), nWant);
+        r.push(p->m_stretchOut.data(), nStretched);
+        ahead = w.delay() + r.delay() * w.tempo();
+        bUnderrun = nPopped < nNeed * stride;
+    }
 
-    if (p->m_bNext                          ||
-        p->m_bPrev                          ||
-        p->m_bNewSongSelected               ||
-        p->m_bFinished                      ||
-        p->m_pcmPos > (long)p->m_pcmSize - 1)
+    if (!bPaused && p->m_bResampling)
     {
-        pw_main_loop_quit(p->m_pw.pLoop);
+        /* float goes straight out */
+        pFloat = eformat == SPA_AUDIO_FORMAT_F32 ? (f32*)p->m_chunk.data() : p->m_resampleOut.data();
+        nOut = r.process(pFloat, nFrames) * stride;
+
+        /* back at exactly 1:1 with nothing left inside, next buffer comes straight from the ring */
+        if (!p->m_bStretching && r.ratio() == 1.0 && r.delay() <= 0.0)
+            p->m_bResampling = false;
     }
-}
 
-void
-stateChangedCB([[maybe_unused]] void* data,
-               [[maybe_unused]] enum pw_stream_state old,
-			   [[maybe_unused]] enum pw_stream_state state,
-               [[maybe_unused]] const char* error)
-{
-    /*
-    switch (state)
+    /* limiter stays in once something could go over full scale, until the next flush,
+     * before that the output runs through a delay as long as it, which it takes over from */
+    f32 gain = p->m_gain.load(std::memory_order_relaxed);
+    const long nChannels = p->m_pw.channels;
+    if (defaults::bLimiter && !p->m_bLimiting &&
+        (gain > 1.0f || p->m_lastGain > 1.0f || p->m_chain.active() || p->m_bResampling ||
+         (eformat == SPA_AUDIO_FORMAT_F32 && !defaults::bBitPerfect)))
     {
-        case PW_STREAM_STATE_ERROR:
-            if (error) CERR("PW_STREAM_STATE_ERROR: {}\n", error);
-            break;
+        f32* pScratch = (f32*)p->m_limitScratch.data();
+        p->m_limiter.prime(toF32(pScratch, eformat, p->m_limitDelay.data(), p->m_limitDelay.size() / sampleSize));
+        p->m_bLimiting = true;
+    }
+    else if (defaults::bLimiter && !p->m_bLimiting && !pFloat && nOut > 0)
+    {
+        delayLikeLimiter(p, p->m_chunk.data(), nOut);
+    }
 
-        case PW_STREAM_STATE_UNCONNECTED:
-            CERR("PW_STREAM_STATE_UNCONNECTED\n");
-            break;
+    /* integer volume gets dithered too, so it goes through float like everything else */
+    const bool bUnity = gain == 1.0f && p->m_lastGain == 1.0f;
+    const bool bDitherGain = !bUnity && dither::forFormat(eformat) != dither::mode::off;
 
-        case PW_STREAM_STATE_CONNECTING:
-            CERR("PW_STREAM_STATE_CONNECTING\n");
-            break;
+    if ((p->m_chain.active() || p->m_bLimiting || bDitherGain) && !pFloat && nOut > 0)
+    {
+        pFloat = eformat == SPA_AUDIO_FORMAT_F32 ? (f32*)p->m_chunk.data() : p->m_resampleOut.data();
+        toF32(pFloat, eformat, p->m_chunk.data(), nOut / sampleSize);
+    }
 
-        case PW_STREAM_STATE_PAUSED:
-            CERR("PW_STREAM_STATE_PAUSED\n");
-            break;
+    bool bGained = false; /* volume already went in, before the limiter and the one requantization */
+    if (pFloat)
+    {
+        if (p->m_chain.active()) p->m_chain.process(pFloat, nOut / stride, nChannels, p->m_pw.deviceRate);
+        dsp::gain(pFloat, pFloat, nOut / stride, nChannels, p->m_lastGain, gain);
+        if (p->m_bLimiting) p->m_limiter.process(pFloat, nOut / stride);
+        bGained = true;
+        requantize(p, p->m_chunk.data(), eformat, pFloat, nOut / stride);
+    }
 
-        case PW_STREAM_STATE_STREAMING:
-            CERR("PW_STREAM_STATE_STREAMING\n");
-            break;
+    if (nOut < nBytes)
+    {
+        /* feed silence (zero in every format), track end, underrun or the last cycle before deactivation */
+        std::fill(p->m_chunk.begin() + nOut, p->m_chunk.begin() + nBytes, 0);
+        if (bUnderrun && !p->m_bEof && !bFlushed) p->m_nUnderruns.fetch_add(1, std::memory_order_relaxed);
+    }
 
-        default:
-            break;
+    f64 played = p->m_playedSec.load(std::memory_order_relaxed) + (f64)(nOut / stride) / p->m_pw.deviceRate;
+    p->m_playedSec.store(played, std::memory_order_relaxed);
+
+    long fill = p->m_ring.size();
+    if (fill < p->m_minFill.load(std::memory_order_relaxed))
+        p->m_minFill.store(fill, std::memory_order_relaxed);
+
+    /* ramp over the whole buffer when volume changed, so there is no zipper noise */
+    const u8* src = p->m_chunk.data();
+
+    if (p->m_pw.sinkFormat != eformat)
+    {
+        /* float all the way here, integer sink gets it requantized once */
+        const f32* pOut = (const f32*)src;
+        if (!bGained && !bUnity)
+        {
+            dsp::gain(p->m_resampleOut.data(), pOut, nFrames, nChannels, p->m_lastGain, gain);
+            pOut = p->m_resampleOut.data();
+        }
+        requantize(p, pDst, p->m_pw.sinkFormat, pOut, nFrames);
     }
-    */
-}
+    else if (bGained || bUnity)
+    {
+        /* unity gain, samples go out untouched */
+        memcpy(pDst, src, nBytes);
+    }
+    else
+    {
+        switch (p->m_pw.eformat)
+        {
+            case SPA_AUDIO_FORMAT_S16:
+                dsp::gain((s16*)pDst, (const s16*)src, nFrames, nChannels, p->m_lastGain, gain);
+                break;
 
-void
-ioChangedCB([[maybe_unused]] void* data,
-            [[maybe_unused]] uint32_t id,
-            [[maybe_unused]] void* area,
-            [[maybe_unused]] uint32_t size)
-{
-    //
-}
+            case SPA_AUDIO_FORMAT_S24_32:
+                dsp::gain((s32*)pDst, (const s32*)src, nFrames, nChannels, p->m_lastGain, gain, 24);
+                break;
 
-void
-paramChangedCB([[maybe_unused]] void* data,
-               [[maybe_unused]] uint32_t id,
-               [[maybe_unused]] const spa_pod* param)
-{
-    //
+            case SPA_AUDIO_FORMAT_S32:
+                dsp::gain((s32*)pDst, (const s32*)src, nFrames, nChannels, p->m_lastGain, gain);
+                break;
+
+            default:
+                dsp::gain((f32*)pDst, (const f32*)src, nFrames, nChannels, p->m_lastGain, gain);
+                break;
+        }
+    }
+    p->m_lastGain = gain;
+
+    p->m_pcmPos += nPopped / sampleSize;
+
+    /* gapless splice, position restarts at the first sample of the next track */
+    bool bJump = bFlushed;
+    size_t mark = p->m_trackMark.load(std::memory_order_acquire);
+    if (mark != p->m_noMark && p->m_ring.readPos() >= mark)
+    {
+        p->m_pcmPos = (p->m_ring.readPos() - mark) / sampleSize;
+        p->m_trackMark.store(p->m_noMark, std::memory_order_release);
+        bJump = true;
+    }
+
+    if (t.nowNs != 0)
+    {
+        /* first frame of this buffer isn't out yet either, nor what the chain and limiter are holding back */
+        f64 ratio = (p->m_bResampling ? r.ratio() : 1.0) * (p->m_bStretching ? w.tempo() : 1.0);
+        long held = p->m_chain.latency() + (defaults::bLimiter ? p->m_limiter.latency() : 0);
+        f64 frame = (f64)p->m_pcmPos / nChannels - ahead - (t.latency + held) * ratio;
+        f64 rate = nOut > 0 ? (f64)p->m_pw.sampleRate : 0.0;
+        p->m_clock.set(t.nowNs, frame, rate, bJump);
+    }
+
+    return nOut / stride;
 }
 
 } /* namespace play */
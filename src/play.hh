@@ -1,13 +1,10 @@
 #pragma once
-
-#include <pipewire/pipewire.h>
+#include "sink.hh"
 
 namespace play
 {
 
-void onProcessCB(void* data);
-void stateChangedCB(void* data, enum pw_stream_state old, enum pw_stream_state state, const char* error);
-void ioChangedCB(void* data, uint32_t id, void* area, uint32_t size);
-void paramChangedCB(void* data, uint32_t id, const spa_pod* param);
+/* `sink::RenderFn` for `app::PipeWirePlayer`, ring -> gain -> sink */
+long render(void* data, u8* pDst, long nFrames, const sink::Timing& t);
 
 } /* namespace play */
@@ -0,0 +1,181 @@
+#include "prefetch.hh"
+#include "defaults.hh"
+#include "utils.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace prefetch
+{
+
+constexpr long chunkBytes = 2 << 20; /* one `readahead()`, replanning is checked in between */
+constexpr long probeBytes = 4096; /* timed cold read, stands for the storage latency */
+constexpr long maxHints = 4;
+
+void
+Prefetcher::start(const std::vector<std::string>& vPaths)
+{
+    m_vPaths = vPaths;
+    m_vWarmed.assign(m_vPaths.size(), 0);
+    m_bStop = false;
+    m_thrd = std::thread(&Prefetcher::work, this);
+}
+
+void
+Prefetcher::stop()
+{
+    {
+        std::lock_guard lock(m_mtx);
+        m_bStop = true;
+    }
+    m_cnd.notify_all();
+    if (m_thrd.joinable()) m_thrd.join();
+}
+
+void
+Prefetcher::plan(std::vector<long> vOrder)
+{
+    {
+        std::lock_guard lock(m_mtx);
+        m_vOrder = std::move(vOrder);
+        m_bDirty = true;
+    }
+    m_cnd.notify_all();
+}
+
+void
+Prefetcher::hint(long idx)
+{
+    {
+        std::lock_guard lock(m_mtx);
+        std::erase(m_vHints, idx);
+        m_vHints.insert(m_vHints.begin(), idx);
+        if ((long)m_vHints.size() > maxHints) m_vHints.pop_back();
+        m_hintTime = utils::timeNow();
+        m_bDirty = true;
+    }
+    m_cnd.notify_all();
+}
+
+bool
+Prefetcher::changed()
+{
+    std::lock_guard lock(m_mtx);
+    return m_bDirty || m_bStop;
+}
+
+void
+Prefetcher::work()
+{
+    /* NOTE: per thread on linux, playback and the decoder go first */
+    setpriority(PRIO_PROCESS, 0, 19);
+
+    const f64 settleSec = defaults::prefetchSettleMs / 1000.0;
+
+    while (true)
+    {
+        std::vector<long> vCandidates;
+        {
+            std::unique_lock lock(m_mtx);
+            m_cnd.wait(lock, [&] { return m_bDirty || m_bStop; });
+
+            /* let scrolling or typing stop first */
+            f64 wait;
+            while (!m_bStop && (wait = m_hintTime + settleSec - utils::timeNow()) > 0.0)
+                m_cnd.wait_for(lock, std::chrono::duration<f64>(wait));
+            if (m_bStop) return;
+
+            m_bDirty = false;
+
+            /* next in order is the likeliest, then whatever the user is pointing at, then the rest */
+            auto add = [&](long idx) {
+                if (idx >= 0 && idx < (long)m_vPaths.size() && std::find(vCandidates.begin(), vCandidates.end(), idx) == vCandidates.end())
+                    vCandidates.push_back(idx);
+            };
+            if (!m_vOrder.empty()) add(m_vOrder.front());
+            for (long idx : m_vHints) add(idx);
+            for (long idx : m_vOrder) add(idx);
+        }
+
+        /* slow mounts look further ahead */
+        f64 depth = std::max(m_latencyMs / defaults::prefetchLatencyMs, 1.0);
+        s64 budget = std::min(defaults::prefetchBudgetMiB * depth, (f64)defaults::prefetchMaxBudgetMiB) * (1 << 20);
+        long nTracks = std::min((long)std::ceil(defaults::prefetchTracks * depth), (long)vCandidates.size());
+        const s64 head = defaults::prefetchHeadKiB * 1024;
+
+        /* whatever fell out of the plan is up to the kernel to keep or drop */
+        for (long idx = 0; idx < (long)m_vWarmed.size(); idx++)
+            if (std::find(vCandidates.begin(), vCandidates.begin() + nTracks, idx) == vCandidates.begin() + nTracks)
+                m_vWarmed[idx] = 0;
+
+        /* heads of every candidate first, then whole files in order */
+        s64 used = 0;
+        for (long i = 0; i < nTracks; i++)
+            used += m_vWarmed[vCandidates[i]];
+
+        bool bDone = true;
+        for (s64 upTo : {head, (s64)1 << 62})
+        {
+            for (long i = 0; bDone && i < nTracks && used < budget; i++)
+            {
+                s64 had = m_vWarmed[vCandidates[i]];
+                bDone = warm(vCandidates[i], std::min(upTo, had + budget - used));
+                used += m_vWarmed[vCandidates[i]] - had;
+            }
+        }
+    }
+}
+
+bool
+Prefetcher::warm(long idx, s64 nBytes)
+{
+    if (m_vWarmed[idx] >= nBytes) return true;
+
+    int fd = open(m_vPaths[idx].data(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return true;
+
+    struct stat st {};
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return true;
+    }
+    nBytes = std::min(nBytes, (s64)st.st_size);
+
+    if (m_vWarmed[idx] == 0 && nBytes > 0)
+    {
+        /* header read, cold every time a file is first touched, which is exactly the stall this is hiding */
+        u8 aProbe[probeBytes];
+        f64 t0 = utils::timeNow();
+        ssize_t n = pread(fd, aProbe, sizeof(aProbe), 0);
+        f64 ms = (utils::timeNow() - t0) * 1000.0;
+        if (n > 0) m_latencyMs = m_latencyMs == 0.0 ? ms : m_latencyMs*0.75 + ms*0.25;
+    }
+
+    bool bDone = true;
+    s64 pos = m_vWarmed[idx];
+    while (pos < nBytes)
+    {
+        if (changed())
+        {
+            bDone = false;
+            break;
+        }
+
+        s64 len = std::min((s64)chunkBytes, nBytes - pos);
+        /* filesystems without readahead() still take the hint */
+        if (readahead(fd, pos, len) != 0) posix_fadvise(fd, pos, len, POSIX_FADV_WILLNEED);
+        pos += len;
+    }
+    m_vWarmed[idx] = std::max(m_vWarmed[idx], pos);
+
+    close(fd);
+    return bDone;
+}
+
+} /* namespace prefetch */
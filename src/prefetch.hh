@@ -0,0 +1,50 @@
+#pragma once
+#include "ultratypes.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace prefetch
+{
+
+/* Warms the page cache for what's likely to play next, so a track starts without waiting on a cold disk.
+ * The first few candidates get their heads read, where the header and the first decode come from, then the
+ * whole files in order until the byte budget runs out. Slower cold reads deepen both in proportion.
+ * One thread at the lowest priority, `readahead()` one chunk at a time, so the decoder's own reads don't
+ * queue up behind it. */
+class Prefetcher
+{
+    std::vector<std::string> m_vPaths {};
+    std::vector<s64> m_vWarmed {}; /* bytes from the start of each file already read ahead, worker only */
+    std::vector<long> m_vOrder {}; /* upcoming in playback order */
+    std::vector<long> m_vHints {}; /* selected or found in the ui, most recent first */
+    f64 m_hintTime = 0.0; /* when the last hint came in, `utils::timeNow()` */
+    bool m_bDirty = false; /* order or hints changed since the worker looked */
+    std::mutex m_mtx {}; /* everything above, except `m_vWarmed` */
+    std::condition_variable m_cnd {};
+    std::thread m_thrd {};
+    std::atomic<bool> m_bStop = false;
+    f64 m_latencyMs = 0.0; /* average cold read latency, worker only */
+
+    void work();
+    /* false when replanned or stopped halfway */
+    bool warm(long idx, s64 nBytes);
+    bool changed();
+
+public:
+    Prefetcher() = default;
+    ~Prefetcher() { stop(); }
+
+    void start(const std::vector<std::string>& vPaths);
+    void stop();
+    /* NOTE: player thread, whenever the current track or repeat method changes */
+    void plan(std::vector<long> vOrder);
+    /* from any thread, goes in after `defaults::prefetchSettleMs` so scrolling past doesn't read everything */
+    void hint(long idx);
+};
+
+} /* namespace prefetch */
@@ -0,0 +1,249 @@
+#include "resample.hh"
+#include "dsp.hh"
+
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+namespace resample
+{
+
+struct Preset
+{
+    long halfTaps; /* zero crossings on each side at 1:1 */
+    f64 beta; /* kaiser window, higher is deeper stopband and wider transition */
+    f64 rolloff; /* cutoff relative to nyquist */
+};
+
+static const Preset f_aPresets[] {
+    {8, 6.0, 0.85},
+    {16, 8.0, 0.91},
+    {32, 10.0, 0.95}
+};
+
+constexpr long maxTaps = 2 * maxHistory;
+
+/* zeroth order modified bessel function of the first kind */
+static f64
+besselI0(f64 x)
+{
+    f64 sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+
+    return sum;
+}
+
+static f64
+sinc(f64 x)
+{
+    if (x == 0.0) return 1.0;
+
+    f64 px = std::numbers::pi * x;
+    return std::sin(px) / px;
+}
+
+f64
+stretchFor(f64 ratio)
+{
+    ratio = std::clamp(ratio, minRatio, maxRatio);
+    return ratio <= 1.0 ? 1.0 : std::ceil(ratio * 8.0) / 8.0;
+}
+
+Filter::Filter(enum quality eQuality, f64 ratio)
+{
+    const Preset& q = f_aPresets[(int)eQuality];
+    stretch = stretchFor(ratio);
+
+    const long half = std::ceil(q.halfTaps * stretch);
+    const f64 cutoff = q.rolloff / stretch;
+    const f64 i0Beta = besselI0(q.beta);
+
+    nTaps = half * 2;
+    vCoeffs.resize((nPhases + 1) * nTaps);
+
+    for (long p = 0; p <= nPhases; p++)
+    {
+        const f64 frac = (f64)p / (f64)nPhases;
+        f32* pRow = &vCoeffs[p * nTaps];
+        f64 sum = 0.0;
+
+        for (long k = 0; k < nTaps; k++)
+        {
+            /* distance from the output frame, in input frames */
+            f64 x = (f64)(k - half + 1) - frac;
+            f64 t = x / (f64)half;
+            f64 w = std::abs(t) < 1.0 ? besselI0(q.beta * std::sqrt(1.0 - t*t)) / i0Beta : 0.0;
+            f64 h = cutoff * sinc(cutoff * x) * w;
+
+            pRow[k] = h;
+            sum += h;
+        }
+
+        /* unity gain at dc for every phase, otherwise phase interpolation ripples */
+        for (long k = 0; k < nTaps; k++)
+            pRow[k] /= sum;
+    }
+}
+
+void
+Resampler::setup(long nChannels, long maxOut)
+{
+    m_nChannels = nChannels;
+    m_cap = (long)std::ceil(maxOut * maxRatio) + maxTaps + 4;
+    m_vIn.resize(m_nChannels * m_cap);
+    m_vKernel.resize(maxTaps);
+
+    reset();
+}
+
+void
+Resampler::setFilter(Filter* pFilter)
+{
+    const long oldHistory = history();
+    std::swap(m_filter, *pFilter);
+
+    if (pFilter->nTaps == 0)
+    {
+        reset();
+        return;
+    }
+
+    /* wider filter looks further back, pad with silence instead of reading before the buffer */
+    long pad = history() - oldHistory;
+    if (pad <= 0) return;
+
+    for (long c = 0; c < m_nChannels; c++)
+    {
+        f32* pRow = &m_vIn[c * m_cap];
+        memmove(pRow + pad, pRow, m_nIn * sizeof(f32));
+        std::fill(pRow, pRow + pad, 0.0f);
+    }
+    m_nIn += pad;
+    m_pos += pad;
+}
+
+void
+Resampler::reset()
+{
+    m_nIn = std::max(history(), 0L);
+    m_pos = (f64)m_nIn;
+    std::fill(m_vIn.begin(), m_vIn.end(), 0.0f);
+}
+
+long
+Resampler::inputNeeded(long nOut) const
+{
+    if (nOut <= 0) return 0;
+
+    /* copying doesn't look ahead */
+    if (m_ratio == 1.0)
+        return std::max((long)std::round(m_pos) + nOut - m_nIn, 0L);
+
+    /* one extra, accumulated `m_pos` can end up a hair past the computed last one */
+    f64 last = m_pos + (f64)(nOut - 1) * m_ratio;
+    long need = (long)last + m_filter.nTaps / 2 + 2 - m_nIn;
+
+    return std::max(need, 0L);
+}
+
+template<typename T>
+void
+Resampler::pushAs(const T* pSrc, long nFrames, f32 scale)
+{
+    nFrames = std::min(nFrames, room());
+
+    for (long c = 0; c < m_nChannels; c++)
+    {
+        f32* pRow = &m_vIn[c * m_cap + m_nIn];
+        for (long i = 0; i < nFrames; i++)
+            pRow[i] = (f32)pSrc[i*m_nChannels + c] * scale;
+    }
+    m_nIn += nFrames;
+}
+
+void
+Resampler::push(const f32* pSrc, long nFrames)
+{
+    pushAs(pSrc, nFrames, 1.0f);
+}
+
+void
+Resampler::push(const s16* pSrc, long nFrames)
+{
+    pushAs(pSrc, nFrames, 1.0f / 32768.0f);
+}
+
+void
+Resampler::push(const s32* pSrc, long nFrames, int nBits)
+{
+    pushAs(pSrc, nFrames, 1.0f / (f32)(1LL << (nBits - 1)));
+}
+
+long
+Resampler::process(f32* pDst, long nOut)
+{
+    /* exactly 1:1 is the input itself, off by at most half a frame if the ratio only just came back to it */
+    if (m_ratio == 1.0)
+    {
+        const long first = std::lround(m_pos);
+        const long n = std::clamp(m_nIn - first, 0L, nOut);
+        for (long c = 0; c < m_nChannels; c++)
+        {
+            const f32* pRow = &m_vIn[c * m_cap + first];
+            for (long i = 0; i < n; i++)
+                pDst[i*m_nChannels + c] = pRow[i];
+        }
+        m_pos = first + n;
+        compact();
+
+        return n;
+    }
+
+    const long nTaps = m_filter.nTaps;
+    const long half = nTaps / 2;
+
+    long i = 0;
+    for (; i < nOut; i++)
+    {
+        const long center = (long)m_pos;
+        if (center + half >= m_nIn) break;
+
+        const f64 phase = (m_pos - (f64)center) * nPhases;
+        const long p = std::min((long)phase, nPhases - 1);
+        const f32* pRow = &m_filter.vCoeffs[p * nTaps];
+        dsp::lerp(m_vKernel.data(), pRow, pRow + nTaps, (f32)(phase - (f64)p), nTaps);
+
+        const long first = center - half + 1;
+        for (long c = 0; c < m_nChannels; c++)
+            pDst[i*m_nChannels + c] = dsp::dot(&m_vIn[c * m_cap + first], m_vKernel.data(), nTaps);
+
+        m_pos += m_ratio;
+    }
+
+    compact();
+
+    return i;
+}
+
+void
+Resampler::compact()
+{
+    /* keep what the next output frame looks back at */
+    long drop = std::min((long)m_pos - history(), m_nIn);
+    if (drop <= 0) return;
+
+    for (long c = 0; c < m_nChannels; c++)
+    {
+        f32* pRow = &m_vIn[c * m_cap];
+        memmove(pRow, pRow + drop, (m_nIn - drop) * sizeof(f32));
+    }
+    m_nIn -= drop;
+    m_pos -= drop;
+}
+
+} /* namespace resample */
@@ -0,0 +1,84 @@
+#pragma once
+#include "ultratypes.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace resample
+{
+
+constexpr long nPhases = 256; /* filter phases per input frame, in between gets interpolated */
+constexpr f64 maxRatio = 8.0; /* input frames per output frame, faster than this is too much work per quantum */
+constexpr f64 minRatio = 1.0 / 256.0;
+constexpr long maxHistory = 32 * (long)maxRatio; /* most frames any filter looks back at */
+
+enum class quality : u8
+{
+    fast, /* 16 taps */
+    medium, /* 32 taps */
+    best, /* 64 taps */
+    size
+};
+
+/* windowed-sinc for one cutoff, `nPhases + 1` rows of `nTaps` */
+struct Filter
+{
+    std::vector<f32> vCoeffs {};
+    long nTaps = 0;
+    f64 stretch = 0.0; /* how much wider than at 1:1 it is, 0 if empty */
+
+    Filter() = default;
+    Filter(enum quality eQuality, f64 ratio);
+};
+
+/* widening `ratio` needs to cut off above the output nyquist, rounded so small speed steps share a filter */
+f64 stretchFor(f64 ratio);
+
+/* Polyphase resampler with continuously variable ratio.
+ * Input is kept planar so each output sample is one contiguous dot product. */
+class Resampler
+{
+    Filter m_filter {};
+    std::vector<f32> m_vIn {}; /* `m_nChannels` rows of `m_cap` frames */
+    std::vector<f32> m_vKernel {}; /* filter interpolated for the current phase */
+    long m_nChannels = 0;
+    long m_cap = 0;
+    long m_nIn = 0; /* frames in each row */
+    f64 m_pos = 0.0; /* where the next output frame is centered in `m_vIn` */
+    f64 m_ratio = 1.0;
+
+    template<typename T> void pushAs(const T* pSrc, long nFrames, f32 scale);
+    void compact();
+
+public:
+    /* room for `maxOut` frames per `process()` at `maxRatio` with the widest filter, resets */
+    void setup(long nChannels, long maxOut);
+    bool needsFilter(f64 ratio) const { return stretchFor(ratio) != m_filter.stretch; }
+    /* swaps with `*pFilter`, so whatever was there gets freed outside of the audio thread */
+    void setFilter(Filter* pFilter);
+    void setRatio(f64 ratio) { m_ratio = std::clamp(ratio, minRatio, maxRatio); }
+    f64 ratio() const { return m_ratio; }
+
+    /* start over with silence behind the first frame */
+    void reset();
+    /* frames of history the filter looks back at */
+    long history() const { return m_filter.nTaps / 2 - 1; }
+    /* treat `nFrames` pushed frames as already played */
+    void skip(long nFrames) { m_pos += nFrames; compact(); }
+
+    /* input frames to push before `process()` can make `nOut` */
+    long inputNeeded(long nOut) const;
+    /* how many input frames still fit */
+    long room() const { return m_cap - m_nIn; }
+    long capacity() const { return m_cap; }
+    /* interleaved, no more than `room()` */
+    void push(const f32* pSrc, long nFrames);
+    void push(const s16* pSrc, long nFrames);
+    void push(const s32* pSrc, long nFrames, int nBits = 32);
+    /* interleaved, returns frames made, less than `nOut` if input ran out, exactly 1:1 copies */
+    long process(f32* pDst, long nOut);
+    /* input frames pushed ahead of the next output frame */
+    f64 delay() const { return (f64)m_nIn - m_pos; }
+};
+
+} /* namespace resample */
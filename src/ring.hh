@@ -0,0 +1,124 @@
+#pragma once
+#include "ultratypes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+namespace ring
+{
+
+/* Single producer, single consumer lock-free ring buffer.
+ * Storage is allocated once in the constructor, push/pop never allocate or block,
+ * so the consumer side is safe to use from the realtime audio callback. */
+template<typename T>
+class SPSC
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    static constexpr size_t npos = ~0UL;
+
+    std::unique_ptr<T[]> m_pData {};
+    size_t m_cap = 0;
+    size_t m_mask = 0;
+    alignas(64) std::atomic<size_t> m_write = 0;
+    alignas(64) std::atomic<size_t> m_read = 0;
+    alignas(64) std::atomic<size_t> m_flush = npos;
+
+public:
+    SPSC() = default;
+    /* capacity gets rounded up to the power of two */
+    explicit SPSC(size_t minCapacity);
+
+    size_t capacity() const { return m_cap; }
+    /* filled size, exact for either side, estimation for anyone else */
+    size_t size() const;
+    size_t space() const { return m_cap - size(); }
+    bool empty() const { return size() == 0; }
+    /* running counters, for marking positions in the stream */
+    size_t readPos() const { return m_read.load(std::memory_order_acquire); }
+    size_t writePos() const { return m_write.load(std::memory_order_acquire); }
+
+    /* producer side, returns number of elements actually written */
+    size_t push(const T* pSrc, size_t n);
+    /* producer side, everything pushed so far is dropped on the next `applyFlush()` */
+    void flush() { m_flush.store(m_write.load(std::memory_order_relaxed), std::memory_order_release); }
+
+    /* consumer side, returns number of elements actually read */
+    size_t pop(T* pDst, size_t n);
+    /* consumer side, returns true if pending `flush()` got applied */
+    bool applyFlush();
+
+    /* only when neither side is active */
+    void clear() { m_write = 0; m_read = 0; m_flush = npos; }
+};
+
+template<typename T>
+SPSC<T>::SPSC(size_t minCapacity)
+{
+    m_cap = std::bit_ceil(minCapacity);
+    m_mask = m_cap - 1;
+    m_pData = std::make_unique<T[]>(m_cap);
+}
+
+template<typename T>
+inline size_t
+SPSC<T>::size() const
+{
+    /* load read index first, so write index is never behind it */
+    size_t r = m_read.load(std::memory_order_acquire);
+    size_t w = m_write.load(std::memory_order_acquire);
+    return w - r;
+}
+
+template<typename T>
+inline size_t
+SPSC<T>::push(const T* pSrc, size_t n)
+{
+    size_t w = m_write.load(std::memory_order_relaxed);
+    size_t r = m_read.load(std::memory_order_acquire);
+    n = std::min(n, m_cap - (w - r));
+
+    size_t off = w & m_mask;
+    size_t n0 = std::min(n, m_cap - off);
+    memcpy(&m_pData[off], pSrc, n0 * sizeof(T));
+    memcpy(&m_pData[0], pSrc + n0, (n - n0) * sizeof(T));
+
+    m_write.store(w + n, std::memory_order_release);
+    return n;
+}
+
+template<typename T>
+inline size_t
+SPSC<T>::pop(T* pDst, size_t n)
+{
+    size_t r = m_read.load(std::memory_order_relaxed);
+    size_t w = m_write.load(std::memory_order_acquire);
+    n = std::min(n, w - r);
+
+    size_t off = r & m_mask;
+    size_t n0 = std::min(n, m_cap - off);
+    memcpy(pDst, &m_pData[off], n0 * sizeof(T));
+    memcpy(pDst + n0, &m_pData[0], (n - n0) * sizeof(T));
+
+    m_read.store(r + n, std::memory_order_release);
+    return n;
+}
+
+template<typename T>
+inline bool
+SPSC<T>::applyFlush()
+{
+    size_t f = m_flush.exchange(npos, std::memory_order_acquire);
+    if (f == npos) return false;
+
+    /* consumer might have already read past the flush point, never go backwards */
+    if (f > m_read.load(std::memory_order_relaxed))
+        m_read.store(f, std::memory_order_release);
+
+    return true;
+}
+
+} /* namespace ring */
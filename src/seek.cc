@@ -0,0 +1,435 @@
+#include "seek.hh"
+#include "defaults.hh"
+#include "utils.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <strings.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace seek
+{
+
+constexpr long bufferBytes = 1 << 20; /* read at once while walking headers */
+constexpr long syncBytes = 1 << 16; /* garbage before the first frame that's still looked through */
+constexpr long warmupFrames = 4; /* mp3 frames decoded and thrown away after a seek, main data can start that far back */
+constexpr std::string_view cacheMagic = "kmp-seek 1";
+
+/* frame header, https://www.mp3-tech.org/programmer/frame_header.html */
+struct Header
+{
+    u32 sampleRate = 0;
+    long nChannels = 0;
+    long layer = 0;
+    long size = 0; /* bytes, header included */
+    long frameSamples = 0;
+    long sideInfo = 0; /* layer 3 side information after the header, where a xing header would start */
+};
+
+static u32
+be32(const u8* p)
+{
+    return ((u32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static u32
+syncSafe(const u8* p)
+{
+    return (p[0] & 0x7f) << 21 | (p[1] & 0x7f) << 14 | (p[2] & 0x7f) << 7 | (p[3] & 0x7f);
+}
+
+static bool
+parseHeader(const u8* p, Header* pH)
+{
+    /* kbps, mpeg 1 then 2 and 2.5, by layer */
+    static constexpr u16 aBitrates[2][3][15] {
+        {
+            {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+            {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+            {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320},
+        },
+        {
+            {0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+            {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+            {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+        },
+    };
+    static constexpr u32 aRates[3] {44100, 48000, 32000};
+
+    u32 h = be32(p);
+    long version = (h >> 19) & 3; /* 0 is 2.5, 1 reserved, 2 is mpeg 2, 3 mpeg 1 */
+    long layer = 4 - ((h >> 17) & 3);
+    long bitrate = (h >> 12) & 15;
+    long rate = (h >> 10) & 3;
+
+    /* free format has no size in the header */
+    if ((h >> 21) != 0x7ff || version == 1 || layer == 4 || bitrate == 0 || bitrate == 15 || rate == 3)
+        return false;
+
+    bool bMpeg1 = version == 3;
+    s64 bps = aBitrates[!bMpeg1][layer - 1][bitrate] * 1000;
+    long padding = (h >> 9) & 1;
+
+    pH->sampleRate = aRates[rate] >> (bMpeg1 ? 0 : version == 2 ? 1 : 2);
+    pH->nChannels = ((h >> 6) & 3) == 3 ? 1 : 2;
+    pH->layer = layer;
+
+    if (layer == 1)
+    {
+        pH->frameSamples = 384;
+        pH->size = (12 * bps / pH->sampleRate + padding) * 4;
+    }
+    else
+    {
+        pH->frameSamples = layer == 3 && !bMpeg1 ? 576 : 1152;
+        pH->size = pH->frameSamples / 8 * bps / pH->sampleRate + padding;
+    }
+
+    if (layer == 3) pH->sideInfo = bMpeg1 ? (pH->nChannels == 1 ? 17 : 32) : (pH->nChannels == 1 ? 9 : 17);
+    else pH->sideInfo = 0;
+
+    return true;
+}
+
+static bool
+sameStream(const Header& a, const Header& b)
+{
+    return a.sampleRate == b.sampleRate && a.nChannels == b.nChannels && a.layer == b.layer;
+}
+
+/* whole file through one buffer, `at()` is null past the end */
+class Reader
+{
+    int m_fd = -1;
+    s64 m_size = 0;
+    std::vector<u8> m_vBuff = std::vector<u8>(bufferBytes);
+    s64 m_start = 0;
+    long m_len = 0;
+
+public:
+    Reader(int fd, s64 size) : m_fd(fd), m_size(size) {}
+
+    const u8*
+    at(s64 offset, long nBytes)
+    {
+        if (offset < m_start || offset + nBytes > m_start + m_len)
+        {
+            if (offset + nBytes > m_size) return nullptr;
+
+            ssize_t n = pread(m_fd, m_vBuff.data(), std::min((s64)bufferBytes, m_size - offset), offset);
+            m_start = offset;
+            m_len = std::max(n, (ssize_t)0);
+            if (m_len < nBytes) return nullptr;
+        }
+
+        return m_vBuff.data() + (offset - m_start);
+    }
+};
+
+/* id3v1, ape and lyrics3 tags after the last frame */
+static bool
+isTrailer(Reader& r, s64 offset, s64 size)
+{
+    if (size - offset < 8) return true; /* too short to be anything mpg123 would decode */
+
+    const u8* p = r.at(offset, 8);
+    if (!p) return false;
+
+    if (size - offset == 128 && memcmp(p, "TAG", 3) == 0) return true;
+    return size - offset >= 8 && (memcmp(p, "APETAGEX", 8) == 0 || memcmp(p, "LYRICSBE", 8) == 0 || memcmp(p, "ID3", 3) == 0);
+}
+
+const Point*
+Table::before(s64 frame) const
+{
+    if (vPoints.empty()) return nullptr;
+
+    frame -= warmupFrames * frameSamples;
+    auto it = std::upper_bound(vPoints.begin(), vPoints.end(), frame, [](s64 f, const Point& p) { return f < p.frame; });
+
+    return it == vPoints.begin() ? &vPoints.front() : &*(it - 1);
+}
+
+bool
+build(std::string_view path, Table* pTable, const std::atomic<bool>& bStop)
+{
+    int fd = open(std::string(path).data(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st {};
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    const s64 size = st.st_size;
+    Reader r(fd, size);
+    auto fail = [&] {
+        close(fd);
+        return false;
+    };
+
+    /* id3v2 in front, size excludes the header and the footer */
+    s64 pos = 0;
+    if (const u8* p = r.at(0, 10); p && memcmp(p, "ID3", 3) == 0)
+        pos = 10 + syncSafe(p + 6) + (p[5] & 0x10 ? 10 : 0);
+
+    /* first header that the next one agrees with */
+    Header first {};
+    const s64 syncEnd = pos + syncBytes;
+    for (;; pos++)
+    {
+        const u8* p = r.at(pos, 4);
+        if (!p || pos >= syncEnd) return fail();
+        if (p[0] != 0xff || !parseHeader(p, &first)) continue;
+
+        Header next {};
+        const u8* pNext = r.at(pos + first.size, 4);
+        if (pNext && parseHeader(pNext, &next) && sameStream(first, next)) break;
+    }
+
+    /* libsndfile takes exact length and seeking from these itself, crc comes before the side information */
+    if (const u8* p = r.at(pos, std::min((s64)64, size - pos)))
+    {
+        for (long at : {4 + first.sideInfo, 6 + first.sideInfo})
+            if (at + 4 <= first.size && (memcmp(p + at, "Xing", 4) == 0 || memcmp(p + at, "Info", 4) == 0))
+                return fail();
+        if (first.size >= 40 && memcmp(p + 36, "VBRI", 4) == 0) return fail();
+    }
+
+    Table t {};
+    t.sampleRate = first.sampleRate;
+    t.nChannels = first.nChannels;
+    t.frameSamples = first.frameSamples;
+
+    s64 nMp3Frames = 0;
+    while (pos < size)
+    {
+        if ((nMp3Frames & 1023) == 0 && bStop) return fail();
+
+        Header h {};
+        const u8* p = r.at(pos, 4);
+        if (!p || !parseHeader(p, &h) || !sameStream(first, h))
+        {
+            /* mpg123 would resync somewhere in the middle, can't tell how many frames it would find */
+            if (!isTrailer(r, pos, size)) return fail();
+            break;
+        }
+
+        /* cut off last frame doesn't get decoded either */
+        if (pos + h.size > size) break;
+
+        if (nMp3Frames % defaults::seekPointFrames == 0)
+            t.vPoints.push_back({nMp3Frames * t.frameSamples, pos});
+
+        nMp3Frames++;
+        pos += h.size;
+    }
+
+    close(fd);
+    if (nMp3Frames == 0) return false;
+
+    t.nFrames = nMp3Frames * t.frameSamples;
+    *pTable = std::move(t);
+
+    return true;
+}
+
+static std::filesystem::path
+cachePath(const std::string& path)
+{
+    const char* pXdg = getenv("XDG_CACHE_HOME");
+    const char* pHome = getenv("HOME");
+    std::string name = FMT("{:016x}", utils::hashFNV(path)); /* same name from every build, unlike `std::hash` */
+
+    if (pXdg && *pXdg) return std::filesystem::path(pXdg) / "kmp" / "seek" / name;
+    if (pHome && *pHome) return std::filesystem::path(pHome) / ".cache" / "kmp" / "seek" / name;
+    return {};
+}
+
+/* false if there's nothing for this exact file, `pTable` is null when it isn't indexable */
+static bool
+loadCache(const std::string& path, s64 size, s64 mtime, std::shared_ptr<const Table>* pTable)
+{
+    auto cache = cachePath(path);
+    if (cache.empty()) return false;
+
+    std::ifstream f(cache);
+    std::string line;
+    if (!std::getline(f, line) || line != cacheMagic) return false;
+
+    /* size mtime nFrames sampleRate nChannels frameSamples path, tab separated, nFrames is -1 for nothing to index */
+    if (!std::getline(f, line)) return false;
+    char* p = line.data();
+    char* pEnd;
+    Table t {};
+    s64 cachedSize = strtoll(p, &pEnd, 10);
+    s64 cachedMtime = strtoll(pEnd, &pEnd, 10);
+    t.nFrames = strtoll(pEnd, &pEnd, 10);
+    t.sampleRate = strtoul(pEnd, &pEnd, 10);
+    t.nChannels = strtol(pEnd, &pEnd, 10);
+    t.frameSamples = strtol(pEnd, &pEnd, 10);
+    if (*pEnd != '\t' || pEnd + 1 != path || cachedSize != size || cachedMtime != mtime) return false;
+
+    if (t.nFrames < 0)
+    {
+        *pTable = nullptr;
+        return true;
+    }
+
+    /* frame offset */
+    while (std::getline(f, line))
+    {
+        Point pt {};
+        pt.frame = strtoll(line.data(), &pEnd, 10);
+        pt.offset = strtoll(pEnd, &pEnd, 10);
+        t.vPoints.push_back(pt);
+    }
+    if (t.vPoints.empty() || t.frameSamples <= 0) return false;
+
+    *pTable = std::make_shared<const Table>(std::move(t));
+    return true;
+}
+
+static void
+saveCache(const std::string& path, s64 size, s64 mtime, const Table* pTable)
+{
+    auto cache = cachePath(path);
+    if (cache.empty() || path.find('\n') != std::string::npos) return;
+
+    std::error_code ec;
+    std::filesystem::create_directories(cache.parent_path(), ec);
+
+    /* to the side first, so an interrupted write doesn't leave half a table */
+    auto tmp = cache;
+    tmp += ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::trunc);
+        f << cacheMagic << '\n';
+        if (pTable)
+        {
+            f << FMT("{}\t{}\t{}\t{}\t{}\t{}\t{}\n", size, mtime, pTable->nFrames, pTable->sampleRate,
+                     pTable->nChannels, pTable->frameSamples, path);
+            for (const Point& pt : pTable->vPoints)
+                f << FMT("{}\t{}\n", pt.frame, pt.offset);
+        }
+        else
+        {
+            f << FMT("{}\t{}\t-1\t0\t0\t0\t{}\n", size, mtime, path);
+        }
+
+        if (!f)
+        {
+            LOG_WARN("can't write '{}'\n", tmp.string());
+            return;
+        }
+    }
+
+    std::filesystem::rename(tmp, cache, ec);
+    if (ec) LOG_WARN("can't write '{}': {}\n", cache.string(), ec.message());
+}
+
+void
+Indexer::start()
+{
+    m_bStop = false;
+    m_thrd = std::thread(&Indexer::work, this);
+}
+
+void
+Indexer::stop()
+{
+    {
+        std::lock_guard lock(m_mtx);
+        m_bStop = true;
+    }
+    m_cnd.notify_all();
+    if (m_thrd.joinable()) m_thrd.join();
+}
+
+std::shared_ptr<const Table>
+Indexer::get(std::string_view path)
+{
+    std::lock_guard lock(m_mtx);
+
+    std::string key(path);
+    auto it = m_tables.find(key);
+    if (it != m_tables.end()) return it->second;
+
+    /* ogg and opus seek by bisection and know their length from the last granule position, flac has seektables */
+    if (path.size() < 4 || strcasecmp(path.data() + path.size() - 4, ".mp3") != 0)
+    {
+        m_tables[key] = nullptr;
+        return nullptr;
+    }
+
+    if (std::find(m_vQueue.begin(), m_vQueue.end(), key) == m_vQueue.end())
+    {
+        m_vQueue.push_back(std::move(key));
+        m_cnd.notify_all();
+    }
+
+    return nullptr;
+}
+
+void
+Indexer::work()
+{
+    /* NOTE: per thread on linux, playback and the decoder go first */
+    setpriority(PRIO_PROCESS, 0, 19);
+
+    while (true)
+    {
+        std::string path;
+        {
+            std::unique_lock lock(m_mtx);
+            m_cnd.wait(lock, [&] { return !m_vQueue.empty() || m_bStop; });
+            if (m_bStop) return;
+
+            /* whatever got played last is what's playing */
+            path = std::move(m_vQueue.back());
+            m_vQueue.pop_back();
+        }
+
+        index(path);
+    }
+}
+
+void
+Indexer::index(const std::string& path)
+{
+    std::error_code ec;
+    s64 size = std::filesystem::file_size(path, ec);
+    s64 mtime = ec ? 0 : std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+
+    std::shared_ptr<const Table> pTable {};
+    if (ec || !loadCache(path, size, mtime, &pTable))
+    {
+        Table t {};
+        if (build(path, &t, m_bStop)) pTable = std::make_shared<const Table>(std::move(t));
+        else if (m_bStop) return;
+
+        if (!ec)
+        {
+            saveCache(path, size, mtime, pTable.get());
+            if (pTable)
+                LOG_OK("seek: {} frames, {} points in '{}'\n", pTable->nFrames, pTable->vPoints.size(), path);
+        }
+    }
+
+    {
+        std::lock_guard lock(m_mtx);
+        m_tables[path] = std::move(pTable);
+    }
+    m_generation.fetch_add(1, std::memory_order_release);
+}
+
+} /* namespace seek */
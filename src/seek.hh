@@ -0,0 +1,70 @@
+#pragma once
+#include "ultratypes.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace seek
+{
+
+/* mp3 frame that starts at byte `offset` decodes into frames from `frame` on */
+struct Point
+{
+    s64 frame = 0;
+    s64 offset = 0;
+};
+
+/* Every `defaults::seekPointFrames`th mp3 frame of a file and how long it really is.
+ * libsndfile guesses the length of an mp3 without a xing, info or vbri header from the first frame's bitrate,
+ * and seeks in one by decoding its way there. */
+struct Table
+{
+    s64 nFrames = 0; /* exact, mpg123 trims nothing without a lame tag */
+    u32 sampleRate = 0;
+    long nChannels = 0;
+    long frameSamples = 0; /* per mp3 frame */
+    std::vector<Point> vPoints {}; /* by frame, first one is the first mp3 frame */
+
+    /* last point far enough before `frame` for the bit reservoir to fill back up, the first one otherwise */
+    const Point* before(s64 frame) const;
+};
+
+/* walks mp3 frame headers, false for anything else, free format, or files that already have a xing header */
+bool build(std::string_view path, Table* pTable, const std::atomic<bool>& bStop);
+
+/* Builds tables in the background the first time a track plays, one thread at the lowest priority.
+ * Results are cached on disk by path, size and mtime, one file per track in `$XDG_CACHE_HOME/kmp/seek`,
+ * so later runs only read that. */
+class Indexer
+{
+    std::unordered_map<std::string, std::shared_ptr<const Table>> m_tables {}; /* null where there is nothing to index */
+    std::vector<std::string> m_vQueue {};
+    std::mutex m_mtx {}; /* everything above */
+    std::condition_variable m_cnd {};
+    std::thread m_thrd {};
+    std::atomic<bool> m_bStop = false;
+    std::atomic<u64> m_generation = 0; /* bumped after every table that got done */
+
+    void work();
+    void index(const std::string& path);
+
+public:
+    Indexer() = default;
+    ~Indexer() { stop(); }
+
+    void start();
+    void stop();
+    /* any thread, never blocks, null until it's done, queues it the first time */
+    std::shared_ptr<const Table> get(std::string_view path);
+    /* compare with what it was at the last `get()` to know when to ask again */
+    u64 generation() const { return m_generation.load(std::memory_order_acquire); }
+};
+
+} /* namespace seek */
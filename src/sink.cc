@@ -0,0 +1,348 @@
+/* https://docs.pipewire.org/page_tutorial4.html */
+
+#include "sink.hh"
+#include "defaults.hh"
+#include "timing.hh"
+#include "utils.hh"
+
+#include <algorithm>
+#include <chrono>
+
+namespace sink
+{
+
+u32
+sampleSize(enum spa_audio_format eformat)
+{
+    return eformat == SPA_AUDIO_FORMAT_S16 ? sizeof(s16) : sizeof(f32);
+}
+
+const pw_stream_events PipeWire::m_streamEvents {
+    .version = PW_VERSION_STREAM_EVENTS,
+    .destroy {},
+    .state_changed {},
+    .control_info {},
+    .io_changed {},
+    .param_changed = PipeWire::paramChangedCB,
+    .add_buffer {},
+    .remove_buffer {},
+    .process = PipeWire::onProcessCB,
+    .drained {},
+    .command {},
+    .trigger_done {},
+};
+
+static const spa_pod*
+buildFormat(spa_pod_builder* b, const Format& fmt)
+{
+    spa_audio_info_raw rawInfo {
+        .format = fmt.eformat,
+        .flags {},
+        .rate = fmt.sampleRate,
+        .channels = fmt.layout.nChannels,
+        .position {}
+    };
+
+    const u32* pPos = fmt.layout.aPositions;
+    std::copy(pPos, pPos + fmt.layout.nChannels, rawInfo.position);
+    if (std::count(pPos, pPos + fmt.layout.nChannels, (u32)SPA_AUDIO_CHANNEL_UNKNOWN) > 0)
+        rawInfo.flags = SPA_AUDIO_FLAG_UNPOSITIONED;
+
+    return spa_format_audio_raw_build(b, SPA_PARAM_EnumFormat, &rawInfo);
+}
+
+void
+PipeWire::onProcessCB(void* data)
+{
+    auto* s = (PipeWire*)data;
+
+    pw_buffer* b;
+    if ((b = pw_stream_dequeue_buffer(s->m_pStream)) == nullptr)
+    {
+        pw_log_warn("out of buffers: %m");
+        return;
+    }
+
+    spa_buffer* buf = b->buffer;
+    u8* dst;
+
+    if ((dst = (u8*)buf->datas[0].data) == nullptr)
+    {
+        CERR("dst == nullptr\n");
+        return;
+    }
+
+    int stride = sampleSize(s->m_fmt.eformat) * s->m_fmt.layout.nChannels;
+    int nFrames = buf->datas[0].maxsize / stride;
+    if (b->requested) nFrames = SPA_MIN(b->requested, (u64)nFrames);
+    if (nFrames > maxQuantum) nFrames = maxQuantum;
+    if (b->requested) s->m_quantum.store(nFrames, std::memory_order_relaxed);
+
+    /* whatever is queued in the stream, resampler and graph hasn't been heard yet */
+    Timing tm {};
+    pw_time t {};
+    if (pw_stream_get_time_n(s->m_pStream, &t, sizeof(t)) == 0 && t.now != 0)
+    {
+        tm.nowNs = t.now;
+        tm.latency = (f64)t.buffered + (f64)t.queued / stride;
+        if (t.rate.denom > 0)
+            tm.latency += (f64)t.delay * t.rate.num * s->m_fmt.sampleRate / t.rate.denom;
+    }
+
+    s->m_render(s->m_pData, dst, nFrames, tm);
+
+    buf->datas[0].chunk->offset = 0;
+    buf->datas[0].chunk->stride = stride;
+    buf->datas[0].chunk->size = nFrames * stride;
+    b->size = nFrames * stride; /* `pw_time.queued` sums these, in bytes like the latency above expects */
+
+    pw_stream_queue_buffer(s->m_pStream, b);
+}
+
+void
+PipeWire::paramChangedCB(void* data, uint32_t id, const spa_pod* param)
+{
+    auto* s = (PipeWire*)data;
+
+    if (param == nullptr || id != SPA_PARAM_Format)
+        return;
+
+    u32 mediaType, mediaSubtype;
+    if (spa_format_parse(param, &mediaType, &mediaSubtype) < 0 || mediaType != SPA_MEDIA_TYPE_audio)
+        return;
+
+    spa_audio_info_raw info {};
+    if (spa_format_audio_raw_parse(param, &info) < 0)
+        return;
+
+    /* wake up `reconfigure()` waiting for renegotiation */
+    s->m_bFormatChanged = true;
+    pw_thread_loop_signal(s->m_pLoop, false);
+}
+
+void
+PipeWire::start(const Format& fmt, bool bActive, RenderFn render, void* pData)
+{
+    u8 setupBuffer[1024] {};
+    const spa_pod* params[1] {};
+    spa_pod_builder b = SPA_POD_BUILDER_INIT(setupBuffer, sizeof(setupBuffer));
+
+    m_fmt = fmt;
+    m_render = render;
+    m_pData = pData;
+
+    m_pLoop = pw_thread_loop_new("kmpLoop", nullptr);
+
+    m_pStream = pw_stream_new_simple(pw_thread_loop_get_loop(m_pLoop),
+                                     "kmpStream",
+                                     pw_properties_new(PW_KEY_MEDIA_TYPE, "Audio",
+                                                       PW_KEY_MEDIA_CATEGORY, "Playback",
+                                                       PW_KEY_MEDIA_ROLE, "Music",
+                                                       nullptr),
+                                     &m_streamEvents,
+                                     this);
+
+    params[0] = buildFormat(&b, m_fmt);
+
+    pw_stream_connect(m_pStream,
+                      PW_DIRECTION_OUTPUT,
+                      PW_ID_ANY,
+                      (enum pw_stream_flags)(PW_STREAM_FLAG_AUTOCONNECT |
+                                             PW_STREAM_FLAG_MAP_BUFFERS |
+                                             PW_STREAM_FLAG_ASYNC |
+                                             (bActive ? 0 : PW_STREAM_FLAG_INACTIVE)),
+                      params, std::size(params));
+
+    pw_thread_loop_start(m_pLoop);
+}
+
+void
+PipeWire::stop()
+{
+    if (!m_pLoop) return;
+
+    /* in this order */
+    pw_thread_loop_stop(m_pLoop);
+    pw_stream_destroy(m_pStream);
+    pw_thread_loop_destroy(m_pLoop);
+
+    m_pStream = nullptr;
+    m_pLoop = nullptr;
+}
+
+void
+PipeWire::reconfigure(const Format& fmt, bool bWait)
+{
+    /* NOTE: call with the loop locked, renegotiates in place without reconnecting */
+    u8 setupBuffer[1024] {};
+    const spa_pod* params[1] {};
+    spa_pod_builder b = SPA_POD_BUILDER_INIT(setupBuffer, sizeof(setupBuffer));
+
+    m_fmt = fmt;
+    params[0] = buildFormat(&b, m_fmt);
+
+    m_bFormatChanged = false;
+    pw_stream_update_params(m_pStream, params, std::size(params));
+
+    /* inactive stream won't get processed before the graph agrees anyway */
+    if (bWait)
+        while (!m_bFormatChanged)
+            if (pw_thread_loop_timed_wait(m_pLoop, 1) != 0)
+                break;
+}
+
+void
+PipeWire::setActive(bool bActive)
+{
+    /* NOTE: call with the loop locked */
+    pw_stream_set_active(m_pStream, bActive);
+}
+
+Null::Null(long quantum, bool bRealtime)
+    : m_quantum(std::clamp(quantum, 1L, maxQuantum)), m_bRealtime(bRealtime) {}
+
+void
+Null::start(const Format& fmt, bool bActive, RenderFn render, void* pData)
+{
+    m_fmt = fmt;
+    m_render = render;
+    m_pData = pData;
+    m_bActive = bActive;
+    m_vBuff.resize(m_quantum * SPA_AUDIO_MAX_CHANNELS * sizeof(f32));
+
+    m_bRunning = true;
+    m_thrd = std::thread(&Null::loop, this);
+}
+
+void
+Null::stop()
+{
+    if (!m_thrd.joinable()) return;
+
+    m_bRunning = false;
+    m_thrd.join();
+}
+
+void
+Null::reconfigure(const Format& fmt, [[maybe_unused]] bool bWait)
+{
+    /* NOTE: call locked, next quantum is already in the new format */
+    m_fmt = fmt;
+}
+
+void
+Null::loop()
+{
+    /* simulated clock, runs off the sample count, realtime only paces it to the wall clock */
+    s64 startNs = timing::nowNs();
+    m_playedNs = 0;
+
+    while (m_bRunning)
+    {
+        long nPlayed = 0;
+        {
+            std::lock_guard lock(m_mtx);
+
+            if (m_bActive)
+            {
+                long nRendered = m_render(m_pData, m_vBuff.data(), m_quantum, {startNs + m_playedNs, 0.0});
+
+                /* silence is as good as audio in realtime, otherwise wait for the decoder instead */
+                nPlayed = m_bRealtime ? m_quantum : nRendered;
+                if (nPlayed > 0) consume(m_vBuff.data(), nPlayed);
+                m_playedNs += nPlayed * 1000000000LL / m_fmt.sampleRate;
+            }
+        }
+
+        if (m_bRealtime)
+        {
+            if (nPlayed == 0)
+            {
+                /* paused, don't catch up on resume */
+                std::this_thread::sleep_for(std::chrono::milliseconds(defaults::decoderSleep));
+                startNs = timing::nowNs() - m_playedNs;
+            }
+            else
+            {
+                s64 wait = startNs + m_playedNs - timing::nowNs();
+                if (wait > 0) std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+            }
+        }
+        else if (nPlayed == 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void
+Wav::start(const Format& fmt, bool bActive, RenderFn render, void* pData)
+{
+    int subFormat;
+    switch (fmt.eformat)
+    {
+        case SPA_AUDIO_FORMAT_S16: subFormat = SF_FORMAT_PCM_16; break;
+        case SPA_AUDIO_FORMAT_S24_32: subFormat = SF_FORMAT_PCM_24; break;
+        case SPA_AUDIO_FORMAT_S32: subFormat = SF_FORMAT_PCM_32; break;
+        default: subFormat = SF_FORMAT_FLOAT; break;
+    }
+
+    m_hSnd = SndfileHandle(m_path.data(), SFM_WRITE, SF_FORMAT_WAV | subFormat, fmt.layout.nChannels, fmt.sampleRate);
+    if (m_hSnd.error())
+        LOG_WARN("'{}': {}\n", m_path, m_hSnd.strError());
+
+    m_nChannels = fmt.layout.nChannels;
+    m_vS24.resize(m_quantum * m_nChannels);
+
+    Null::start(fmt, bActive, render, pData);
+}
+
+void
+Wav::consume(const u8* pData, long nFrames)
+{
+    if (m_hSnd.error()) return;
+
+    if (m_fmt.layout.nChannels != m_nChannels)
+    {
+        if (!m_bWarned) LOG_WARN("'{}': {} channels don't fit into {} channel file, dropping\n", m_path, m_fmt.layout.nChannels, m_nChannels);
+        m_bWarned = true;
+        return;
+    }
+
+    switch (m_fmt.eformat)
+    {
+        case SPA_AUDIO_FORMAT_S16:
+            m_hSnd.writef((const s16*)pData, nFrames);
+            break;
+
+        case SPA_AUDIO_FORMAT_S24_32:
+            /* libsndfile wants int samples left-justified */
+            for (long i = 0; i < nFrames * m_nChannels; i++)
+                m_vS24[i] = (s32)((u32)((const s32*)pData)[i] << 8);
+            m_hSnd.writef(m_vS24.data(), nFrames);
+            break;
+
+        case SPA_AUDIO_FORMAT_S32:
+            m_hSnd.writef((const s32*)pData, nFrames);
+            break;
+
+        default:
+            m_hSnd.writef((const f32*)pData, nFrames);
+            break;
+    }
+}
+
+std::unique_ptr<AudioSink>
+make(std::string_view spec)
+{
+    if (spec == "pipewire")
+        return std::make_unique<PipeWire>();
+    if (spec == "null")
+        return std::make_unique<Null>(defaults::nullSinkQuantum, defaults::bNullSinkRealtime);
+    if (spec.starts_with("wav:") && spec.size() > 4)
+        return std::make_unique<Wav>(spec.substr(4), defaults::nullSinkQuantum, defaults::bNullSinkRealtime);
+
+    return nullptr;
+}
+
+} /* namespace sink */
@@ -0,0 +1,162 @@
+#pragma once
+#include "channels.hh"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <pipewire/pipewire.h>
+#include <sndfile.hh>
+#include <spa/param/audio/format-utils.h>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace sink
+{
+
+constexpr long maxQuantum = 1024*4; /* most frames a sink asks `RenderFn` for in one go */
+
+struct Format
+{
+    enum spa_audio_format eformat = SPA_AUDIO_FORMAT_F32;
+    u32 sampleRate = 48000;
+    channels::Layout layout {};
+};
+
+/* bytes per sample */
+u32 sampleSize(enum spa_audio_format eformat);
+
+/* when the first frame handed to `RenderFn` gets heard */
+struct Timing
+{
+    s64 nowNs = 0; /* CLOCK_MONOTONIC, 0 when sink doesn't know */
+    f64 latency = 0.0; /* frames still queued ahead of this buffer */
+};
+
+/* fill `nFrames` of `pDst` in the current format, runs on the sink's thread,
+ * returns how many of those were actual audio and not underrun/pause silence */
+using RenderFn = long (*)(void* pData, u8* pDst, long nFrames, const Timing& t);
+
+class AudioSink
+{
+public:
+    virtual ~AudioSink() = default;
+
+    virtual const char* name() const = 0;
+    virtual bool started() const = 0;
+    /* starts pulling from `render`, inactive sink doesn't call it until `setActive(true)` */
+    virtual void start(const Format& fmt, bool bActive, RenderFn render, void* pData) = 0;
+    virtual void stop() = 0;
+
+    /* with `lock()` held, changes format in place, `bWait` returns once the sink runs in the new format */
+    virtual void reconfigure(const Format& fmt, bool bWait) = 0;
+    /* with `lock()` held */
+    virtual void setActive(bool bActive) = 0;
+
+    /* frames `RenderFn` usually gets asked for, 0 until the sink knows */
+    virtual long quantum() const = 0;
+    /* rate and layout `start()` got stay for good, `reconfigure()` may only change the sample format */
+    virtual bool fixedFormat() const { return false; }
+
+    /* `RenderFn` doesn't run while locked, both do nothing until `start()` */
+    virtual void lock() = 0;
+    virtual void unlock() = 0;
+};
+
+/* pipewire stream on its own `pw_thread_loop` */
+class PipeWire : public AudioSink
+{
+    pw_thread_loop* m_pLoop {};
+    pw_stream* m_pStream {};
+    Format m_fmt {};
+    RenderFn m_render {};
+    void* m_pData {};
+    bool m_bFormatChanged = false; /* set by `paramChangedCB()` */
+    std::atomic<long> m_quantum = 0; /* last `requested` by the graph */
+    static const pw_stream_events m_streamEvents;
+
+    static void onProcessCB(void* data);
+    static void paramChangedCB(void* data, uint32_t id, const spa_pod* param);
+
+public:
+    PipeWire() { pw_init(nullptr, nullptr); }
+    ~PipeWire() override { stop(); pw_deinit(); }
+
+    const char* name() const override { return "pipewire"; }
+    bool started() const override { return m_pLoop != nullptr; }
+    long quantum() const override { return m_quantum.load(std::memory_order_relaxed); }
+    void start(const Format& fmt, bool bActive, RenderFn render, void* pData) override;
+    void stop() override;
+    void reconfigure(const Format& fmt, bool bWait) override;
+    void setActive(bool bActive) override;
+    void lock() override { if (m_pLoop) pw_thread_loop_lock(m_pLoop); }
+    void unlock() override { if (m_pLoop) pw_thread_loop_unlock(m_pLoop); }
+};
+
+/* Pulls `quantum` frames at a time on its own thread and throws them away.
+ * Realtime paces itself to the sample rate, otherwise it runs as fast as the decoder keeps up
+ * and waits for audio instead of rendering underrun silence, so the output is the same every run. */
+class Null : public AudioSink
+{
+protected:
+    Format m_fmt {};
+    RenderFn m_render {};
+    void* m_pData {};
+    long m_quantum = 0;
+    bool m_bRealtime = true;
+    bool m_bActive = true;
+    std::vector<u8> m_vBuff {};
+    std::mutex m_mtx {};
+    std::thread m_thrd {};
+    std::atomic<bool> m_bRunning = false;
+    s64 m_playedNs = 0; /* of audio, by the simulated clock */
+
+    /* whatever got rendered, on the sink's thread with the lock held */
+    virtual void consume([[maybe_unused]] const u8* pData, [[maybe_unused]] long nFrames) {}
+    void loop();
+
+public:
+    Null(long quantum, bool bRealtime);
+    ~Null() override { stop(); }
+
+    const char* name() const override { return "null"; }
+    bool started() const override { return m_thrd.joinable(); }
+    long quantum() const override { return m_quantum; }
+    void start(const Format& fmt, bool bActive, RenderFn render, void* pData) override;
+    void stop() override;
+    void reconfigure(const Format& fmt, bool bWait) override;
+    void setActive(bool bActive) override { m_bActive = bActive; }
+    void lock() override { if (started()) m_mtx.lock(); }
+    void unlock() override { if (started()) m_mtx.unlock(); }
+
+    /* how much audio got pulled, read after `stop()` */
+    f64 playedSec() const { return (f64)m_playedNs / 1e9; }
+};
+
+/* Null sink that writes the rendered stream to a wav file.
+ * File takes the format the sink was started with, later sample formats get converted by libsndfile,
+ * player resamples and mixes later tracks to its rate and layout. */
+class Wav : public Null
+{
+    std::string m_path {};
+    SndfileHandle m_hSnd {};
+    u32 m_nChannels = 0; /* of the file */
+    std::vector<s32> m_vS24 {}; /* s24 samples shifted up for libsndfile */
+    bool m_bWarned = false;
+
+    void consume(const u8* pData, long nFrames) override;
+
+public:
+    Wav(std::string_view path, long quantum, bool bRealtime) : Null(quantum, bRealtime), m_path(path) {}
+    ~Wav() override { stop(); }
+
+    const char* name() const override { return "wav"; }
+    bool fixedFormat() const override { return true; }
+    void start(const Format& fmt, bool bActive, RenderFn render, void* pData) override;
+};
+
+/* "pipewire", "null" or "wav:path/to/file.wav", nullptr if it's none of those */
+std::unique_ptr<AudioSink> make(std::string_view spec);
+
+} /* namespace sink */
@@ -0,0 +1,209 @@
+#include "stretch.hh"
+#include "defaults.hh"
+#include "dsp.hh"
+
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+namespace stretch
+{
+
+/* coarse search stride, best one gets refined frame by frame */
+constexpr long searchStep = 4;
+
+void
+Wsola::setup(long nChannels, u32 sampleRate, long maxOut)
+{
+    m_nChannels = nChannels;
+    m_hop = std::max((long)(sampleRate * defaults::stretchWindowMs / 2000), 16L);
+    m_search = std::max((long)(sampleRate * defaults::stretchSearchMs / 1000), searchStep);
+    m_maxOut = maxOut;
+
+    /* a few hops worth at `maxTempo`, plus a window and the search range around the last one */
+    m_cap = (long)std::ceil((maxOut + 2*m_hop) * maxTempo) + 4*m_hop + 2*m_search + 16;
+
+    m_vIn.resize(m_cap * m_nChannels);
+    m_vMono.resize(m_cap);
+    m_vEnergy.resize(2*m_search + m_hop + 2);
+    m_vOut.resize((maxOut + m_hop) * m_nChannels);
+    m_vTail.resize(m_hop * m_nChannels);
+
+    m_vWindow.resize(2 * m_hop);
+    for (long i = 0; i < 2*m_hop; i++)
+        m_vWindow[i] = 0.5 - 0.5 * std::cos(2.0 * std::numbers::pi * (f64)i / (f64)(2*m_hop));
+
+    reset();
+}
+
+void
+Wsola::reset()
+{
+    m_nIn = 0;
+    m_nOut = 0;
+    m_nominal = 0.0;
+    m_prev = -1;
+    m_nDrop = 0;
+    std::fill(m_vTail.begin(), m_vTail.end(), 0.0f);
+}
+
+void
+Wsola::prime(const f32* pHistory, long nFrames)
+{
+    reset();
+
+    /* first segment covers the history and whatever comes right after it,
+     * its faded in first half is thrown away and the tail continues exactly where history ends */
+    nFrames = std::min(nFrames, m_hop);
+    long pad = m_hop - nFrames;
+    std::fill(m_vIn.begin(), m_vIn.begin() + pad * m_nChannels, 0.0f);
+    std::fill(m_vMono.begin(), m_vMono.begin() + pad, 0.0f);
+    m_nIn = pad;
+    push(pHistory, nFrames);
+
+    m_nDrop = m_hop;
+}
+
+long
+Wsola::inputNeeded(long nOut) const
+{
+    long nMissing = nOut + m_nDrop - m_nOut;
+    if (nMissing <= 0) return 0;
+
+    /* input the last of the hops needed to get there reads up to */
+    long nSteps = (nMissing + m_hop - 1) / m_hop;
+    f64 last = m_nominal + (f64)(nSteps - 1) * m_hop * m_tempo;
+    long need = (long)last + m_search + 2*m_hop + 1 - m_nIn;
+
+    return std::max(need, 0L);
+}
+
+void
+Wsola::push(const f32* pSrc, long nFrames)
+{
+    nFrames = std::min(nFrames, room());
+
+    memcpy(&m_vIn[m_nIn * m_nChannels], pSrc, nFrames * m_nChannels * sizeof(f32));
+    for (long i = 0; i < nFrames; i++)
+    {
+        f32 sum = 0.0f;
+        for (long c = 0; c < m_nChannels; c++)
+            sum += pSrc[i*m_nChannels + c];
+        m_vMono[m_nIn + i] = sum;
+    }
+    m_nIn += nFrames;
+}
+
+long
+Wsola::bestStart()
+{
+    const long nominal = (long)m_nominal;
+    if (m_prev < 0) return nominal;
+
+    const long lo = std::max(nominal - m_search, 0L);
+    const long hi = nominal + m_search;
+    /* what the previous segment would have continued with */
+    const f32* pTarget = &m_vMono[m_prev + m_hop];
+
+    /* energy of each candidate from running sums, so only the cross term needs a dot product */
+    f64* pE = m_vEnergy.data();
+    pE[0] = 0.0;
+    for (long i = lo; i < hi + m_hop; i++)
+        pE[i - lo + 1] = pE[i - lo] + (f64)m_vMono[i] * m_vMono[i];
+
+    auto score = [&](long c) -> f64 {
+        f64 energy = pE[c - lo + m_hop] - pE[c - lo];
+        return (f64)dsp::dot(&m_vMono[c], pTarget, m_hop) / std::sqrt(energy + 1e-9);
+    };
+
+    long best = lo;
+    f64 bestScore = -HUGE_VAL;
+    for (long c = lo; c <= hi; c += searchStep)
+        if (f64 s = score(c); s > bestScore) { bestScore = s; best = c; }
+
+    const long from = std::max(best - searchStep + 1, lo), to = std::min(best + searchStep - 1, hi);
+    for (long c = from; c <= to; c++)
+        if (f64 s = score(c); s > bestScore) { bestScore = s; best = c; }
+
+    return best;
+}
+
+bool
+Wsola::step()
+{
+    /* whole search range and a window past its end has to be there */
+    if ((long)m_nominal + m_search + 2*m_hop > m_nIn) return false;
+    if (m_nOut + m_hop > (long)m_vOut.size() / m_nChannels) return false;
+
+    const long start = bestStart();
+    const long ch = m_nChannels;
+    const f32* pSeg = &m_vIn[start * ch];
+    f32* pOut = &m_vOut[m_nOut * ch];
+
+    /* overlap-add first half onto the previous tail, second half becomes the new tail */
+    for (long i = 0; i < m_hop; i++)
+    {
+        const f32 w0 = m_vWindow[i], w1 = m_vWindow[m_hop + i];
+        for (long c = 0; c < ch; c++)
+        {
+            pOut[i*ch + c] = m_vTail[i*ch + c] + w0 * pSeg[i*ch + c];
+            m_vTail[i*ch + c] = w1 * pSeg[(m_hop + i)*ch + c];
+        }
+    }
+    m_nOut += m_hop;
+
+    if (m_nDrop > 0)
+    {
+        long n = std::min(m_nDrop, m_nOut);
+        memmove(m_vOut.data(), &m_vOut[n * ch], (m_nOut - n) * ch * sizeof(f32));
+        m_nOut -= n;
+        m_nDrop -= n;
+    }
+
+    m_prev = start;
+    m_nominal += (f64)m_hop * m_tempo;
+    compact();
+
+    return true;
+}
+
+void
+Wsola::compact()
+{
+    /* next target starts at `m_prev + m_hop`, next candidates at `m_nominal - m_search` */
+    long drop = std::min(m_prev + m_hop, (long)m_nominal - m_search);
+    drop = std::min(drop, m_nIn);
+    if (drop <= 0) return;
+
+    memmove(m_vIn.data(), &m_vIn[drop * m_nChannels], (m_nIn - drop) * m_nChannels * sizeof(f32));
+    memmove(m_vMono.data(), &m_vMono[drop], (m_nIn - drop) * sizeof(f32));
+    m_nIn -= drop;
+    m_nominal -= drop;
+    m_prev -= drop;
+}
+
+long
+Wsola::process(f32* pDst, long nOut)
+{
+    while (m_nOut < nOut && step())
+        ;
+
+    long n = std::min(nOut, m_nOut);
+    memcpy(pDst, m_vOut.data(), n * m_nChannels * sizeof(f32));
+    memmove(m_vOut.data(), &m_vOut[n * m_nChannels], (m_nOut - n) * m_nChannels * sizeof(f32));
+    m_nOut -= n;
+
+    return n;
+}
+
+f64
+Wsola::delay() const
+{
+    /* `prime()`d output starts `m_nDrop` frames in, before any segment those are 1:1 */
+    if (m_prev < 0) return (f64)m_nIn - m_nominal - (f64)m_nDrop;
+
+    /* tail picks up at `m_prev + m_hop`, frames still in `m_vOut` come before that */
+    return (f64)m_nIn - ((f64)(m_prev + m_hop) - (f64)m_nOut * m_tempo);
+}
+
+} /* namespace stretch */
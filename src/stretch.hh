@@ -0,0 +1,65 @@
+#pragma once
+#include "ultratypes.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace stretch
+{
+
+constexpr f64 minTempo = 0.25;
+constexpr f64 maxTempo = 4.0;
+
+/* WSOLA time-stretch, changes tempo and keeps the pitch.
+ * Hann windowed segments overlap by half, each next one is picked within `defaults::stretchSearchMs`
+ * of where the tempo says, wherever it lines up best with the natural continuation of the previous one. */
+class Wsola
+{
+    std::vector<f32> m_vIn {}; /* interleaved, `m_cap` frames */
+    std::vector<f32> m_vMono {}; /* channels summed, for the search */
+    std::vector<f64> m_vEnergy {}; /* running sum of `m_vMono` squared over the search range */
+    std::vector<f32> m_vOut {}; /* interleaved, made but not taken by `process()` */
+    std::vector<f32> m_vTail {}; /* second half of the last windowed segment */
+    std::vector<f32> m_vWindow {}; /* hann, `2*m_hop` */
+    long m_nChannels = 0;
+    long m_hop = 0; /* output frames per segment, half the window */
+    long m_search = 0; /* frames either way around the nominal position */
+    long m_cap = 0;
+    long m_maxOut = 0;
+    long m_nIn = 0;
+    long m_nOut = 0;
+    f64 m_nominal = 0.0; /* where the next segment starts by tempo, in `m_vIn` */
+    long m_prev = -1; /* where the last segment started, -1 before the first one */
+    long m_nDrop = 0; /* output frames to throw away after `prime()` */
+    f64 m_tempo = 1.0;
+
+    long bestStart();
+    bool step();
+    void compact();
+
+public:
+    /* room for `maxOut` frames per `process()` at `maxTempo`, resets */
+    void setup(long nChannels, u32 sampleRate, long maxOut);
+    void setTempo(f64 tempo) { m_tempo = std::clamp(tempo, minTempo, maxTempo); }
+    f64 tempo() const { return m_tempo; }
+    long hop() const { return m_hop; }
+    long maxOut() const { return m_maxOut; }
+
+    /* start over, fades in from silence */
+    void reset();
+    /* start over right after `nFrames` of interleaved `pHistory` that already went out, so there is no fade */
+    void prime(const f32* pHistory, long nFrames);
+
+    /* input frames to push before `process()` can make `nOut` */
+    long inputNeeded(long nOut) const;
+    long room() const { return m_cap - m_nIn; }
+    long capacity() const { return m_cap; }
+    /* interleaved, no more than `room()` */
+    void push(const f32* pSrc, long nFrames);
+    /* interleaved, returns frames made, less than `nOut` if input ran out */
+    long process(f32* pDst, long nOut);
+    /* input frames pushed ahead of the next output frame, roughly */
+    f64 delay() const;
+};
+
+} /* namespace stretch */
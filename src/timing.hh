@@ -0,0 +1,69 @@
+#pragma once
+#include "lockfree.hh"
+
+#include <algorithm>
+#include <ctime>
+
+namespace timing
+{
+
+/* CLOCK_MONOTONIC in nanoseconds, same clock as `pw_time::now` */
+inline s64
+nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (s64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Audible position of the current track.
+ * Audio callback anchors it every cycle, readers extrapolate from the last anchor. */
+class Clock
+{
+    struct Anchor
+    {
+        s64 ns = 0; /* CLOCK_MONOTONIC */
+        f64 frame = 0.0; /* frame heard at `ns` */
+        f64 rate = 0.0; /* frames per second from `ns` on, 0 when stopped */
+    };
+
+    lockfree::SeqLock<Anchor> m_anchor {};
+
+public:
+    /* writers must be serialized (loop lock), `bJump` for seeks and track changes,
+     * otherwise it never goes backwards and catches up with jitter at half speed instead */
+    void set(s64 ns, f64 frame, f64 rate, bool bJump = false);
+    /* freeze at whatever is heard now */
+    void stop() { s64 ns = nowNs(); set(ns, frameAt(ns), 0.0); }
+
+    /* any thread, lock-free */
+    f64 frameAt(s64 ns) const;
+    f64 frame() const { return frameAt(nowNs()); }
+};
+
+inline void
+Clock::set(s64 ns, f64 frame, f64 rate, bool bJump)
+{
+    frame = std::max(frame, 0.0);
+
+    if (!bJump)
+    {
+        f64 predicted = frameAt(ns);
+        if (frame < predicted)
+        {
+            frame = predicted;
+            rate *= 0.5;
+        }
+    }
+
+    m_anchor.store({ns, frame, rate});
+}
+
+inline f64
+Clock::frameAt(s64 ns) const
+{
+    Anchor a = m_anchor.load();
+    return a.frame + (f64)std::max(ns - a.ns, (s64)0) * a.rate / 1e9;
+}
+
+} /* namespace timing */
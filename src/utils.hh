@@ -87,7 +87,7 @@ hashFNV(std::string_view str)
 {
     u64 hash = 0xCBF29CE484222325;
     for (u64 i = 0; i < (u64)str.size(); i++)
-        hash = (hash ^ (u64)str[i]) * 0x100000001B3;
+        hash = (hash ^ (u64)(u8)str[i]) * 0x100000001B3; /* bytes, so it doesn't depend on `char` signedness */
     return hash;
 }
 
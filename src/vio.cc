@@ -0,0 +1,474 @@
+#include "vio.hh"
+#include "defaults.hh"
+#include "utils.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace vio
+{
+
+static std::atomic<u64> s_nSyscalls = 0;
+static std::atomic<u64> s_nBytes = 0;
+
+static void
+count(u64 nSyscalls, u64 nBytes)
+{
+    s_nSyscalls.fetch_add(nSyscalls, std::memory_order_relaxed);
+    s_nBytes.fetch_add(nBytes, std::memory_order_relaxed);
+}
+
+Stats
+stats()
+{
+    return {s_nSyscalls.load(std::memory_order_relaxed), s_nBytes.load(std::memory_order_relaxed)};
+}
+
+File::File(int fd, sf_count_t size)
+    : m_fd(fd), m_size(size) {}
+
+File::~File()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        count(1, 0);
+    }
+}
+
+int
+File::release()
+{
+    return std::exchange(m_fd, -1);
+}
+
+sf_count_t
+File::seek(sf_count_t offset, int whence)
+{
+    if (whence == SEEK_CUR) offset += tell();
+    else if (whence == SEEK_END) offset += size();
+    if (offset < 0) return -1;
+
+    m_pos = m_origin + offset;
+    return offset;
+}
+
+sf_count_t
+File::read(void* pDst, sf_count_t nBytes)
+{
+    nBytes = std::max(std::min(nBytes, m_size - m_pos), (sf_count_t)0);
+    if (nBytes == 0) return 0;
+
+    sf_count_t nRead = std::max(readAt(pDst, nBytes), (sf_count_t)0);
+    m_pos += nRead;
+    return nRead;
+}
+
+/* pread() straight into libsndfile's buffer, one syscall per read it does */
+class Pread : public File
+{
+public:
+    using File::File;
+
+    sf_count_t readAt(void* pDst, sf_count_t nBytes) override;
+};
+
+sf_count_t
+Pread::readAt(void* pDst, sf_count_t nBytes)
+{
+    sf_count_t done = 0;
+    while (done < nBytes)
+    {
+        ssize_t n = pread(m_fd, (u8*)pDst + done, nBytes - done, m_pos + done);
+        count(1, std::max(n, (ssize_t)0));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+
+    return done;
+}
+
+/* Whole file mapped, reads are memcpy()s and page faults, the syscalls left are the hints.
+ * NOTE: the file getting truncated while it's open is SIGBUS, same as any mmap() reader. */
+class Mmap : public File
+{
+    const u8* m_pData = nullptr;
+    sf_count_t m_hintFrom = 0; /* what `MADV_WILLNEED` covered last */
+    sf_count_t m_hintTo = 0;
+
+public:
+    Mmap(int fd, sf_count_t size);
+    ~Mmap() override;
+
+    bool ok() const { return m_pData != nullptr; }
+    sf_count_t readAt(void* pDst, sf_count_t nBytes) override;
+};
+
+Mmap::Mmap(int fd, sf_count_t size)
+    : File(fd, size)
+{
+    if (size <= 0) return;
+
+    void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    count(1, 0);
+    if (p == MAP_FAILED) return;
+
+    m_pData = (const u8*)p;
+    madvise(p, size, MADV_SEQUENTIAL);
+    count(1, 0);
+}
+
+Mmap::~Mmap()
+{
+    if (!m_pData) return;
+
+    munmap((void*)m_pData, m_size);
+    count(1, 0);
+}
+
+sf_count_t
+Mmap::readAt(void* pDst, sf_count_t nBytes)
+{
+    const sf_count_t ahead = defaults::ioBlockKiB * 1024 * defaults::ioQueueDepth;
+    const sf_count_t pageMask = sysconf(_SC_PAGESIZE) - 1;
+
+    /* hint again halfway through the last window, or right away after seeking out of it */
+    bool bOutside = m_pos < m_hintFrom || m_pos >= m_hintTo;
+    bool bHalfway = m_hintTo < m_size && m_pos + nBytes > m_hintTo - ahead / 2;
+    if (bOutside || bHalfway)
+    {
+        m_hintFrom = m_pos & ~pageMask;
+        m_hintTo = std::min(m_hintFrom + ahead, m_size);
+        madvise((void*)(m_pData + m_hintFrom), m_hintTo - m_hintFrom, MADV_WILLNEED);
+        count(1, 0);
+    }
+
+    memcpy(pDst, m_pData + m_pos, nBytes);
+    count(0, nBytes);
+
+    return nBytes;
+}
+
+/* Ring of `defaults::ioQueueDepth` reads, `defaults::ioBlockKiB` each at aligned offsets, kept going ahead of
+ * the read position, so a slow filesystem has all of them in flight while the decoder works through one.
+ * Straight io_uring syscalls, liburing would only wrap these few. */
+class Uring : public File
+{
+    struct Slot
+    {
+        u8* pBuff = nullptr;
+        sf_count_t offset = -1; /* block it holds or is reading, -1 for none */
+        long nHave = 0; /* bytes from `offset` that are in */
+        long nWant = 0;
+        bool bBusy = false; /* kernel can still write into `pBuff` */
+    };
+
+    long m_block = 0;
+    std::vector<Slot> m_vSlots {};
+    u8* m_pBuff = nullptr; /* every slot's, page aligned */
+    int m_ring = -1;
+    void* m_pSq = nullptr;
+    void* m_pCq = nullptr;
+    size_t m_sqSize = 0;
+    size_t m_cqSize = 0;
+    io_uring_sqe* m_pSqes = nullptr;
+    size_t m_sqesSize = 0;
+    u32* m_pSqTail = nullptr;
+    u32* m_pSqArray = nullptr;
+    u32 m_sqMask = 0;
+    u32* m_pCqHead = nullptr;
+    u32* m_pCqTail = nullptr;
+    io_uring_cqe* m_pCqes = nullptr;
+    u32 m_cqMask = 0;
+    u32 m_nQueued = 0; /* written to the submission ring, not yet submitted */
+
+    bool setup();
+    void queue(long slot, sf_count_t offset, u8* pDst, long nBytes);
+    bool enter(u32 minComplete);
+    bool reap(bool bWait);
+    bool readAhead(sf_count_t firstBlock);
+
+public:
+    Uring(int fd, sf_count_t size);
+    ~Uring() override;
+
+    bool ok() const { return m_pSqes != nullptr; }
+    sf_count_t readAt(void* pDst, sf_count_t nBytes) override;
+};
+
+Uring::Uring(int fd, sf_count_t size)
+    : File(fd, size), m_block(defaults::ioBlockKiB * 1024), m_vSlots(std::max(defaults::ioQueueDepth, 1L))
+{
+    m_pBuff = (u8*)std::aligned_alloc(4096, m_block * m_vSlots.size());
+    if (!m_pBuff) return;
+
+    for (long i = 0; i < (long)m_vSlots.size(); i++)
+        m_vSlots[i].pBuff = m_pBuff + i * m_block;
+
+    setup();
+}
+
+Uring::~Uring()
+{
+    /* buffers are the kernel's until their reads complete */
+    bool bDrained = true;
+    for (auto& s : m_vSlots)
+        while (bDrained && s.bBusy) bDrained = reap(true);
+
+    if (m_pSqes) munmap(m_pSqes, m_sqesSize);
+    if (m_pCq && m_pCq != m_pSq) munmap(m_pCq, m_cqSize);
+    if (m_pSq) munmap(m_pSq, m_sqSize);
+    if (m_ring >= 0) close(m_ring);
+    if (bDrained) std::free(m_pBuff);
+    else LOG_BAD("io_uring reads never completed, leaking their buffers\n");
+}
+
+bool
+Uring::setup()
+{
+    io_uring_params params {};
+    m_ring = syscall(__NR_io_uring_setup, (u32)m_vSlots.size(), &params);
+    count(1, 0);
+    if (m_ring < 0) return false;
+
+    m_sqSize = params.sq_off.array + params.sq_entries * sizeof(u32);
+    m_cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+
+    auto map = [&](size_t size, off_t offset) -> void* {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, offset);
+        count(1, 0);
+        return p == MAP_FAILED ? nullptr : p;
+    };
+
+    if (!(m_pSq = map(m_sqSize, IORING_OFF_SQ_RING))) return false;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) m_pCq = m_pSq;
+    else if (!(m_pCq = map(m_cqSize, IORING_OFF_CQ_RING))) return false;
+
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* pSqes = map(m_sqesSize, IORING_OFF_SQES);
+    if (!pSqes) return false;
+
+    u8* pSq = (u8*)m_pSq;
+    u8* pCq = (u8*)m_pCq;
+    m_pSqTail = (u32*)(pSq + params.sq_off.tail);
+    m_pSqArray = (u32*)(pSq + params.sq_off.array);
+    m_sqMask = *(u32*)(pSq + params.sq_off.ring_mask);
+    m_pCqHead = (u32*)(pCq + params.cq_off.head);
+    m_pCqTail = (u32*)(pCq + params.cq_off.tail);
+    m_pCqes = (io_uring_cqe*)(pCq + params.cq_off.cqes);
+    m_cqMask = *(u32*)(pCq + params.cq_off.ring_mask);
+    m_pSqes = (io_uring_sqe*)pSqes;
+
+    return true;
+}
+
+void
+Uring::queue(long slot, sf_count_t offset, u8* pDst, long nBytes)
+{
+    /* never more in flight than there are slots, so the submission ring can't be full */
+    u32 tail = *m_pSqTail;
+    u32 idx = tail & m_sqMask;
+
+    io_uring_sqe* pSqe = &m_pSqes[idx];
+    memset(pSqe, 0, sizeof(*pSqe));
+    pSqe->opcode = IORING_OP_READ;
+    pSqe->fd = m_fd;
+    pSqe->off = offset;
+    pSqe->addr = (u64)pDst;
+    pSqe->len = nBytes;
+    pSqe->user_data = slot;
+
+    m_pSqArray[idx] = idx;
+    __atomic_store_n(m_pSqTail, tail + 1, __ATOMIC_RELEASE);
+    m_nQueued++;
+}
+
+bool
+Uring::enter(u32 minComplete)
+{
+    u32 flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    while (true)
+    {
+        long r = syscall(__NR_io_uring_enter, m_ring, m_nQueued, minComplete, flags, nullptr, 0);
+        count(1, 0);
+        if (r >= 0)
+        {
+            m_nQueued -= std::min((u32)r, m_nQueued);
+            return true;
+        }
+
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            LOG_BAD("io_uring_enter: {}\n", strerror(errno));
+            return false;
+        }
+    }
+}
+
+bool
+Uring::reap(bool bWait)
+{
+    u32 head = *m_pCqHead;
+    u32 tail = __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE);
+
+    if (bWait && head == tail)
+    {
+        if (!enter(1)) return false;
+        tail = __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE);
+    }
+
+    for (; head != tail; head++)
+    {
+        const io_uring_cqe& cqe = m_pCqes[head & m_cqMask];
+        long slot = cqe.user_data;
+        Slot& s = m_vSlots[slot];
+
+        if (cqe.res > 0)
+        {
+            s.nHave += cqe.res;
+            count(0, cqe.res);
+        }
+
+        /* short read, network filesystems do that, ask for the rest into the same buffer */
+        bool bRetry = cqe.res == -EINTR || cqe.res == -EAGAIN;
+        if ((cqe.res > 0 && s.nHave < s.nWant) || bRetry)
+            queue(slot, s.offset + s.nHave, s.pBuff + s.nHave, s.nWant - s.nHave);
+        else s.bBusy = false; /* done, end of file or error, `nHave` says how much is good */
+    }
+    __atomic_store_n(m_pCqHead, head, __ATOMIC_RELEASE);
+
+    return m_nQueued == 0 || enter(0);
+}
+
+bool
+Uring::readAhead(sf_count_t firstBlock)
+{
+    const long depth = m_vSlots.size();
+
+    for (long i = 0; i < depth; i++)
+    {
+        sf_count_t offset = (firstBlock + i) * m_block;
+        if (offset >= m_size) break;
+
+        Slot& s = m_vSlots[(firstBlock + i) % depth];
+        if (s.offset == offset) continue;
+
+        /* only after a seek, stale reads have to land before their buffers get reused */
+        while (s.bBusy)
+            if (!reap(true)) return false;
+
+        s.offset = offset;
+        s.nHave = 0;
+        s.nWant = std::min((sf_count_t)m_block, m_size - offset);
+        s.bBusy = true;
+        queue((firstBlock + i) % depth, offset, s.pBuff, s.nWant);
+    }
+
+    return m_nQueued == 0 || enter(0);
+}
+
+sf_count_t
+Uring::readAt(void* pDst, sf_count_t nBytes)
+{
+    sf_count_t done = 0;
+    while (done < nBytes)
+    {
+        sf_count_t pos = m_pos + done;
+        sf_count_t block = pos / m_block;
+        if (!readAhead(block)) break;
+
+        Slot& s = m_vSlots[block % m_vSlots.size()];
+        bool bOk = true;
+        while (bOk && s.bBusy) bOk = reap(true);
+        if (!bOk) break;
+
+        /* error or end of file */
+        long off = pos - s.offset;
+        if (s.nHave <= off) break;
+
+        long n = std::min(nBytes - done, (sf_count_t)(s.nHave - off));
+        memcpy((u8*)pDst + done, s.pBuff + off, n);
+        done += n;
+    }
+
+    return done;
+}
+
+static SF_VIRTUAL_IO s_virtualIo {
+    .get_filelen = [](void* pUser) { return ((File*)pUser)->size(); },
+    .seek = [](sf_count_t offset, int whence, void* pUser) { return ((File*)pUser)->seek(offset, whence); },
+    .read = [](void* pDst, sf_count_t nBytes, void* pUser) { return ((File*)pUser)->read(pDst, nBytes); },
+    .write = nullptr,
+    .tell = [](void* pUser) { return ((File*)pUser)->tell(); },
+};
+
+Handle::Handle(std::shared_ptr<File> pFile, s64 base)
+    : SndfileHandle(s_virtualIo, pFile.get(), SFM_READ), m_pFile(std::move(pFile)), m_base(base) {}
+
+Handle::~Handle()
+{
+    /* drop this `SNDFILE` reference while the file is still there */
+    SndfileHandle::operator=(SndfileHandle());
+}
+
+Handle
+open(std::string_view path, enum backend eBackend, s64 offset, s64 base)
+{
+    int fd = ::open(std::string(path).data(), O_RDONLY | O_CLOEXEC);
+    count(1, 0);
+    if (fd < 0) return {};
+
+    struct stat st {};
+    count(1, 0);
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        count(1, 0);
+        return {};
+    }
+
+    std::shared_ptr<File> pFile {};
+
+    if (eBackend == backend::mmap)
+    {
+        auto pMmap = std::make_shared<Mmap>(fd, st.st_size);
+        if (pMmap->ok()) pFile = pMmap;
+        else fd = pMmap->release();
+    }
+    else if (eBackend == backend::uring)
+    {
+        auto pUring = std::make_shared<Uring>(fd, st.st_size);
+        if (pUring->ok())
+        {
+            pFile = pUring;
+        }
+        else
+        {
+            static std::once_flag s_warned;
+            std::call_once(s_warned, [] { LOG_WARN("io_uring unavailable, falling back to pread()\n"); });
+            fd = pUring->release();
+        }
+    }
+
+    if (!pFile) pFile = std::make_shared<Pread>(fd, st.st_size);
+    pFile->setOrigin(std::clamp(offset, (s64)0, (s64)st.st_size));
+
+    return Handle(std::move(pFile), base);
+}
+
+} /* namespace vio */
@@ -0,0 +1,79 @@
+#pragma once
+#include "ultratypes.h"
+
+#include <memory>
+#include <sndfile.hh>
+#include <string_view>
+
+namespace vio
+{
+
+enum class backend : u8
+{
+    read, /* pread() whatever libsndfile asks for, same as opening by path */
+    mmap, /* whole file mapped, sequential and will-need hints ahead of decoding, for local disks */
+    uring, /* large aligned reads queued ahead of decoding, for network filesystems where each read waits a round trip */
+    size
+};
+constexpr std::string_view backendStrings[] {"read", "mmap", "uring"};
+
+/* everything every backend did since startup, from any thread */
+struct Stats
+{
+    u64 nSyscalls = 0;
+    u64 nBytes = 0; /* fetched from the file, read-ahead included */
+};
+
+Stats stats();
+
+/* Open file behind `SF_VIRTUAL_IO`, position and length are kept here, backends only fill bytes in.
+ * NOTE: one thread at a time, same as the `SNDFILE` on top of it. */
+class File
+{
+protected:
+    int m_fd = -1;
+    sf_count_t m_size = 0;
+    sf_count_t m_pos = 0; /* from the start of the file, backends never see `m_origin` */
+    sf_count_t m_origin = 0; /* what libsndfile sees as byte 0 */
+
+public:
+    File(int fd, sf_count_t size);
+    virtual ~File();
+
+    /* fd back without closing it, for when a backend couldn't set itself up */
+    int release();
+
+    /* up to `nBytes` at `m_pos`, short only at the end of the file or on error */
+    virtual sf_count_t readAt(void* pDst, sf_count_t nBytes) = 0;
+
+    void setOrigin(sf_count_t origin) { m_pos = m_origin = origin; }
+    sf_count_t size() const { return m_size - m_origin; }
+    sf_count_t tell() const { return m_pos - m_origin; }
+    sf_count_t seek(sf_count_t offset, int whence);
+    sf_count_t read(void* pDst, sf_count_t nBytes);
+};
+
+/* `SndfileHandle` that keeps its `File` alive, copies share both.
+ * libsndfile has no close callback, so the file has to go after the last `SNDFILE` reference does. */
+class Handle : public SndfileHandle
+{
+    std::shared_ptr<File> m_pFile {};
+    s64 m_base = 0; /* frames of the whole file before the first one this decodes */
+
+public:
+    Handle() = default;
+    Handle(std::shared_ptr<File> pFile, s64 base);
+    Handle(const Handle& other) = default;
+    Handle& operator=(const Handle& other) = default; /* bases go first, the old `SNDFILE` closes before its file */
+    ~Handle();
+
+    s64 base() const { return m_base; }
+};
+
+/* read only, `uring` falls back to `read` where the kernel won't set a ring up.
+ * Error is reported the same way as `SndfileHandle(path)`, through `error()`.
+ * Past 0, `offset` hides everything before it from libsndfile, which then decodes from there as frame `base`,
+ * only makes sense at an mp3 frame, see `seek::Table`. */
+Handle open(std::string_view path, enum backend eBackend, s64 offset = 0, s64 base = 0);
+
+} /* namespace vio */
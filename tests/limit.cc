@@ -0,0 +1,47 @@
+/* limiter output stays under the ceiling, even where the peak level keeps falling for longer than the look-ahead */
+
+#include "defaults.hh"
+#include "limit.hh"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+int
+main()
+{
+    constexpr u32 sampleRate = 48000;
+    constexpr long nChannels = 2;
+    constexpr long nFrames = sampleRate * 2;
+    constexpr long quantum = 1024;
+    const f32 ceiling = std::pow(10.0f, defaults::limiterCeilingDb / 20.0f);
+
+    int nFailed = 0;
+    for (f64 freq : {30.0, 50.0, 100.0})
+    {
+        /* short release, so a wrong hold shows up right away instead of hiding under the slow recovery */
+        limit::Limiter limiter;
+        limiter.setup(nChannels, sampleRate, quantum, 1.0f);
+
+        /* decaying tone well over full scale */
+        std::vector<f32> v(nFrames * nChannels);
+        for (long i = 0; i < nFrames; i++)
+        {
+            f64 t = (f64)i / sampleRate;
+            f32 s = 1.2 * std::exp(-t / 0.5) * std::sin(2.0 * M_PI * freq * t);
+            for (long c = 0; c < nChannels; c++) v[i*nChannels + c] = s;
+        }
+
+        for (long i = 0; i < nFrames; i += quantum)
+            limiter.process(&v[i * nChannels], std::min(quantum, nFrames - i));
+
+        f32 peak = 0.0f;
+        for (f32 s : v) peak = std::max(peak, std::abs(s));
+
+        bool bOk = peak <= ceiling * 1.0001f;
+        printf("%s %.0f Hz: peak %.3f dBFS, ceiling %.3f dBFS\n", bOk ? "ok  " : "FAIL", freq, 20.0 * std::log10(peak), 20.0 * std::log10(ceiling));
+        if (!bOk) nFailed++;
+    }
+
+    return nFailed > 0;
+}